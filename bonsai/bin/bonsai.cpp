@@ -1,9 +1,11 @@
+#include <csignal>
 #include <fstream>
 #include <omp.h>
 #include "feature_min.h"
 #include "util.h"
 #include "database.h"
 #include "classifier.h"
+#include "serve.h"
 #include "bitmap.h"
 #include "tx.h"
 #include "setcmp.h"
@@ -22,13 +24,21 @@ using std::begin;
 using std::end;
 
 int classify_main(int argc, char *argv[]) {
-    int co, num_threads(16), emit_kraken(1), emit_fastq(0), emit_all(0), chunk_size(1 << 20), per_set(32);
-    bool canonicalize(true);
+    int co, num_threads(16), emit_kraken(1), emit_fastq(0), emit_all(0), emit_binary(0), groups_per_thread(16), dthreads(1), cache_lg(0), segment_len(0);
+    int compression(COMPRESS_NONE), max_bin_files(256);
+    long long chunk_size(1 << 20);
+    bool canonicalize(true), batch(true), pipeline(true), early_exit(false), use_bloom(true), emit_segments(false), no_output(false);
+    bool bin_classified(true), bin_unclassified(false);
+    double confidence(0.), cascade_confidence(0.);
+    std::string report_path, manifest_path, bin_prefix, bin_rank, bin_clades;
+    std::vector<std::string> stage_paths;
+    placement_t placement;
     std::ios_base::sync_with_stdio(false);
     std::FILE *ofp(stdout);
     if(argc < 4) {
         usage:
         std::fprintf(stderr, "Usage:\n%s <dbpath> <tax_path> <inr1.fq> [Optional: <inr2.fq>]\n"
+                             "   or %s -M <manifest> <dbpath> <tax_path>\n"
                              "Flags:\n-o:\tRedirect output to path instead of stdout.\n"
                              "-c:\tSet chunk size. Default: %i\n"
                              "-a:\tEmit all records, not just classified.\n"
@@ -37,51 +47,201 @@ int classify_main(int argc, char *argv[]) {
                              "-K:\tDo not emit kraken-style output.\n"
                              "-f:\tEmit fastq-style output.\n"
                              "-K:\tDo not emit fastq-formatted output.\n"
+                             "-s:\tRead, classify and write each chunk in turn instead of overlapping them.\n"
+                             "-b:\tLook up each k-mer as it is encoded instead of batching and prefetching lookups per read.\n"
+                             "-S:\tSplit each chunk into this many groups of reads per thread, balanced by total length. Default: 16.\n"
+                             "-z:\tSet number of threads decompressing each input file. BGZF input is decoded in parallel. Default: 1.\n"
+                             "-t:\tSet confidence threshold: move each call up the tree until its clade holds at least this fraction of the read's unambiguous k-mers. Default: 0.\n"
+                             "-e:\tStop looking up a read's k-mers once the rest cannot move it out of its clade or below the confidence threshold.\n"
+                             "   \tThe call is then the full call or one of its ancestors. Unprobed k-mers are reported as S:<count>.\n"
+                             "-r:\tWrite a kraken-style report of reads per taxon to this path.\n"
+                             "-n:\tDo not emit per-read output. Use with -r.\n"
+                             "-B:\tIgnore the database's Bloom filter, if it has one.\n"
+                             "-L:\tSplit single-end reads longer than this many bases into segments of this length, classified in parallel. Default: no splitting.\n"
+                             "-g:\tEmit the calls of a split read's segments as G:<call>,<call>,... Use with -L.\n"
+                             "-M:\tClassify every sample of a manifest, one per line as <name> <output> <r1.fq> [<r2.fq>], with one database load.\n"
+                             "   \tEach sample's output goes to its own path. A table of reads classified per sample goes to -o.\n"
+                             "-H:\tCache lookups of recently seen k-mers in 2^<arg> entries (16 bytes each) per thread. 16 fits in L2. Default: no cache.\n"
+                             "-T:\tBack a mapped database with huge pages: none, thp (transparent) or hugetlb (explicit, from vm.nr_hugepages). Default: none.\n"
+                             "-N:\tPlace a mapped database across NUMA nodes: local (first touch), interleave or replicate (one copy per node). Default: local.\n"
+                             "   \tWith -T or -N, the database is copied into memory instead of shared through the page cache.\n"
+                             "-A:\tPin classification threads to cores, spread over NUMA nodes. Implied by -N replicate.\n"
+                             "-x:\tWrite compact binary output instead of text, which bonsai view converts to text. It holds taxa runs unless -K is set\n"
+                             "   \tand sequences if -f is.\n"
+                             "-Z:\tCompress output as none, gzip (BGZF, which gunzip reads) or zstd, on -p threads alongside classification. Default: none.\n"
+                             "   \tWith -M, this applies to each sample's output. Decompress -x output before bonsai view.\n"
+                             "-d:\tBin reads into FASTQ files by call as they are classified: <arg><taxid>.fq, and <arg>unclassified.fq with -u.\n"
+                             "   \tPairs are interleaved, and reads from FASTA get qualities of I. With -M, each sample's bins start with <arg><sample name>.\n"
+                             "-l:\tBin each read under its call's ancestor at this rank instead. Format: <rank>[:<nodes.dmp>]. Ranks are read\n"
+                             "   \tfrom nodes.dmp, by default the taxonomy. Reads called above the rank are not binned.\n"
+                             "-R:\tBin each read under the deepest of these comma-separated clades containing its call instead.\n"
+                             "-u:\tAlso bin unclassified reads.\n"
+                             "-U:\tOnly bin unclassified reads.\n"
+                             "-m:\tKeep at most this many bin files open at once. Default: 256.\n"
+                             "-D:\tCascade to this database: reads the databases before leave unclassified are looked up in it, in the same pass.\n"
+                             "   \tRepeat for more, in order. Each must be built with the same k, window, spacing and scoring as <dbpath>.\n"
+                             "   \tReads split with -L go down the cascade too: all of a read's segments are looked up in each database it reaches.\n"
+                             "-P:\tAlso pass reads on to the next database if their call's clade holds less than this fraction of their k-mers. Default: 0.\n"
                              "\nIf -f and -k are set, full kraken output will be contained in the fastq comment field."
                              "\n  Default: kraken-style only output.\n",
-                 *argv, 1 << 14);
+                 *argv, *argv, 1 << 14);
         std::exit(EXIT_FAILURE);
     }
-    while((co = getopt(argc, argv, "Cc:p:o:S:afFkKh?")) >= 0) {
+    while((co = getopt(argc, argv, "Cc:d:D:H:l:L:m:M:N:p:o:P:r:R:S:t:T:z:Z:AabBefFgkKnsuUxh?")) >= 0) {
         switch(co) {
             case 'h': case '?': goto usage;
             case 'C': canonicalize = false; break;
+            case 'A': placement.pin_ = true; break;
             case 'a': emit_all = 1; break;
-            case 'c': chunk_size = std::atoi(optarg); break;
+            case 'b': batch = false; break;
+            case 'B': use_bloom = false; break;
+            case 'c': chunk_size = std::strtoll(optarg, nullptr, 10); break;
+            case 'e': early_exit = true; break;
+            case 'g': emit_segments = true; break;
+            case 'H': cache_lg = std::atoi(optarg); break;
+            case 'L': segment_len = std::atoi(optarg); break;
+            case 'M': manifest_path = optarg; break;
+            case 'N': placement.numa_ = parse_numa(optarg); break;
             case 'F': emit_fastq  = 0; break;
             case 'f': emit_fastq  = 1; break;
             case 'K': emit_kraken = 0; break;
             case 'k': emit_kraken = 1; break;
+            case 'n': no_output = true; break;
             case 'p': num_threads = std::atoi(optarg); break;
             case 'o': ofp = std::fopen(optarg, "w"); break;
-            case 'S': per_set = std::atoi(optarg); break;
+            case 'r': report_path = optarg; break;
+            case 'S': groups_per_thread = std::atoi(optarg); break;
+            case 's': pipeline = false; break;
+            case 't': confidence = std::atof(optarg); break;
+            case 'T': placement.huge_ = parse_huge_pages(optarg); break;
+            case 'x': emit_binary = 1; break;
+            case 'z': dthreads = std::atoi(optarg); break;
+            case 'Z': compression = parse_compression(optarg); break;
+            case 'd': bin_prefix = optarg; break;
+            case 'l': bin_rank = optarg; break;
+            case 'm': max_bin_files = std::atoi(optarg); break;
+            case 'R': bin_clades = optarg; break;
+            case 'u': bin_unclassified = true; break;
+            case 'U': bin_unclassified = true, bin_classified = false; break;
+            case 'D': stage_paths.emplace_back(optarg); break;
+            case 'P': cascade_confidence = std::atof(optarg); break;
         }
     }
     LOG_ASSERT(ofp);
-    switch(argc - optind) {
+    if(no_output) emit_kraken = emit_fastq = emit_all = emit_binary = 0; // Whatever other output flags say
+    if(placement.numa_ == NUMA_REPLICATE) placement.pin_ = true;
+    if(cache_lg < 0 || cache_lg > 32) LOG_EXIT("Cache size must be between 2^1 and 2^32 entries. (Got 2^%i)\n", cache_lg);
+    if(chunk_size <= 0) LOG_EXIT("Chunk size must be positive. (Got %lld)\n", chunk_size);
+    if(segment_len < 0) LOG_EXIT("Segment length must be non-negative. (Got %i)\n", segment_len);
+    if(confidence < 0. || confidence > 1.) LOG_EXIT("Confidence threshold must be in [0, 1]. (Got %lf)\n", confidence);
+    if(cascade_confidence < 0. || cascade_confidence > 1.) LOG_EXIT("Cascade threshold must be in [0, 1]. (Got %lf)\n", cascade_confidence);
+    if(stage_paths.size() >= Classifier::MAX_STAGES) LOG_EXIT("At most %u databases can be cascaded.\n", Classifier::MAX_STAGES);
+    if(max_bin_files <= 0) LOG_EXIT("Bin files open at once must be positive. (Got %i)\n", max_bin_files);
+    if(bin_prefix.empty() && (bin_rank.size() || bin_clades.size() || bin_unclassified))
+        LOG_EXIT("-l, -R, -u and -U need bins to write to. Set -d.\n");
+    if(bin_rank.size() && bin_clades.size()) LOG_EXIT("Bin by rank or by clades, not both.\n");
+    std::vector<sample_t> samples;
+    if(manifest_path.size()) {
+        if(argc - optind != 2) goto usage;
+        samples = parse_manifest(manifest_path.data());
+        LOG_DEBUG("Processing %zu samples from %s.\n", samples.size(), manifest_path.data());
+    } else switch(argc - optind) {
         default: goto usage;
         case 3:  LOG_DEBUG("Processing in single-end mode.\n"); break;
         case 4:  LOG_DEBUG("Processing in paired-end mode.\n"); break;
     }
-    Database<khash_t(c)> db(argv[optind]);
+    Database<khash_t(c)> db(argv[optind], use_bloom, placement);
+    if(db.is_mapped()) LOG_INFO("Using memory-mapped database %s.\n", argv[optind]);
+    LOG_INFO("Database placement: %s.\n", placement.str().data());
     //reportDB<khash_t(c)>(&db, stderr);
     //for(auto &i: db._s) --i; // subtract by one since we'll re-subtract during construction.
-    ClassifierGeneric<score::Lex> c(db.db_, db.s_, db.k_, db.k_, num_threads,
-                                   emit_all, emit_fastq, emit_kraken, canonicalize);
-    khash_t(p) *taxmap(build_parent_map(argv[optind + 1]));
-    // We can use optind + 3 for both single-end and paired-end mode since the argument at
-    // index argc is null when argc - optind == 3.
-    process_dataset(c, taxmap, argv[optind + 2], argv[optind + 3],
-                    ofp, chunk_size, per_set);
+    if(db.bf_) LOG_INFO("Using Bloom filter (%zu bytes).\n", size_t(db.bf_->bytes()));
+    if(db.ct_) LOG_INFO("Using compact table with %zu entries (%zu bytes).\n", size_t(db.ct_->size()), size_t(db.ct_->bytes()));
+    // Windowed databases only hold minimizers, which we can reproduce for lexicographic and entropy scoring.
+    const unsigned wsz(db.lookup_window());
+    std::vector<std::unique_ptr<Database<khash_t(c)>>> stages;
+    for(const auto &path: stage_paths) {
+        stages.emplace_back(new Database<khash_t(c)>(path.data(), use_bloom, placement));
+        const Database<khash_t(c)> &sdb(*stages.back());
+        if(sdb.k_ != db.k_ || sdb.w_ != db.w_ || sdb.s_ != db.s_ || sdb.scheme_ != db.scheme_)
+            LOG_EXIT("Database %s was not built with the same k, window, spacing and scoring as %s.\n", path.data(), argv[optind]);
+    }
+    const FlatTaxonomy tax(argv[optind + 1]);
+    std::unique_ptr<TaxonBins> bins;
+    if(bin_prefix.size()) {
+        bins.reset(new TaxonBins(tax, bin_classified, bin_unclassified, max_bin_files));
+        if(bin_rank.size()) {
+            const size_t colon(bin_rank.find(':'));
+            const std::string nodes_path(colon == std::string::npos ? argv[optind + 1]: bin_rank.substr(colon + 1));
+            if(colon != std::string::npos) bin_rank.resize(colon);
+            bins->set_rank(bin_rank.data(), nodes_path.data());
+        } else if(bin_clades.size()) {
+            std::vector<tax_t> clades;
+            for(char *p(&bin_clades[0]), *end; *p; p = end + (*end == ',')) {
+                clades.push_back(std::strtoul(p, &end, 10));
+                if(end == p || (*end && *end != ',')) LOG_EXIT("Malformed clade list %s.\n", bin_clades.data());
+            }
+            bins->set_clades(clades);
+        }
+        for(auto &sample: samples) sample.bin_prefix_ = bin_prefix + sample.name_ + '.';
+    }
+    auto run = [&](auto score) {
+        ClassifierGeneric<decltype(score)> c(db.db_, db.s_, db.k_, wsz, num_threads,
+                                             emit_all, emit_fastq, emit_kraken, canonicalize, db.ct_, db.bf_);
+        c.batch_ = batch;
+        c.early_exit_ = early_exit;
+        c.confidence_ = confidence;
+        c.segment_len_ = segment_len;
+        c.emit_segments_ = emit_segments;
+        c.set_emit_binary(emit_binary);
+        c.bins_ = bins.get();
+        for(const auto &replica: db.replicas_) c.add_replica(replica.db_, replica.ct_, replica.bf_);
+        c.cascade_confidence_ = cascade_confidence;
+        for(const auto &stage: stages) {
+            c.add_stage(stage->db_, stage->ct_, stage->bf_);
+            for(const auto &replica: stage->replicas_) c.add_replica(replica.db_, replica.ct_, replica.bf_, c.nstages() - 1);
+        }
+        c.place_threads(placement.pin_);
+        if(cache_lg) c.enable_cache(cache_lg);
+        std::unique_ptr<AbundanceReport> report(report_path.empty() ? nullptr: new AbundanceReport(tax, c.nt_));
+        c.report_ = report.get();
+        if(samples.size()) {
+            process_samples(c, tax, samples, chunk_size, groups_per_thread, pipeline, dthreads, compression, num_threads);
+            for(const auto &sample: samples) {
+                if(sample.error_.size()) LOG_EXIT("Failed to classify sample %s: %s\n", sample.name_.data(), sample.error_.data());
+                if(sample.write_errno_) LOG_EXIT("Failed to write output for sample %s: %s\n", sample.name_.data(), std::strerror(sample.write_errno_));
+            }
+            write_sample_summary(samples, ofp);
+        } else {
+            // We can use optind + 3 for both single-end and paired-end mode since the argument at
+            // index argc is null when argc - optind == 3.
+            process_dataset(c, tax, argv[optind + 2], argv[optind + 3],
+                            ofp, chunk_size, groups_per_thread, pipeline, dthreads, compression, num_threads, bin_prefix);
+        }
+        if(report) report->write(report_path.data());
+        if(cache_lg) {
+            const u64 hits(c.cache_hits()), total(hits + c.cache_misses());
+            LOG_INFO("K-mer cache: %" PRIu64 " of %" PRIu64 " lookups hit (%.2f%%).\n", hits, total, total ? 100. * hits / total: 0.);
+        }
+        for(unsigned i(0); c.nstages() > 1 && i < c.nstages(); ++i) {
+            const u64 nreads(c.stage_reads(i)), nkept(c.stage_classified(i));
+            LOG_INFO("Database %u (%s): looked up %" PRIu64 " reads, classified %" PRIu64 " (%.2f%%).\n",
+                     i + 1, i ? stage_paths[i - 1].data(): argv[optind], nreads, nkept, nreads ? 100. * nkept / nreads: 0.);
+        }
+    };
+    LOG_INFO("Classifying with k = %u, w = %u.\n", db.k_, wsz);
+    if(wsz > db.k_ && db.scheme_ == score_scheme::ENTROPY) run(score::Entropy{});
+    else                                                   run(score::Lex{});
     if(ofp != stdout) std::fclose(ofp);
-    kh_destroy(p, taxmap);
     LOG_INFO("Successfully completed classify!\n");
     return EXIT_SUCCESS;
 }
 
 int phase2_main(int argc, char *argv[]) {
     int c, mode(score_scheme::LEX), wsz(-1), num_threads(-1), k(31);
-    bool canon(true);
+    bool canon(true), write_mapped(false), write_compact(false);
+    double compact_load(CompactTable::DEFAULT_LOAD), bloom_bits(0.);
+    unsigned compact_vbits(0);
     std::size_t start_size(1<<16);
     std::string spacing, tax_path, seq2taxpath, paths_file;
     std::ios_base::sync_with_stdio(false);
@@ -100,10 +260,15 @@ int phase2_main(int argc, char *argv[]) {
                      "-T: Set tax_path.\n"
                      "-M: Set seq2taxpath.\n"
                      "-S: Set spacing.\n"
-                     , *argv);
+                     "-m: Write the memory-mappable database format (loaded zero-copy by classify).\n"
+                     "-c: Write a compact hash table instead of a khash. Implies -m.\n"
+                     "-l: Set load factor for the compact hash table. Default: %lf.\n"
+                     "-V: Extra value bits for the compact hash table, for taxa which only appear as lcas of colliding k-mers. Default: 0.\n"
+                     "-b: Store a Bloom filter with this many bits per key, which classify checks before probing the table. Implies -m. Suggested: %lf.\n"
+                     , *argv, CompactTable::DEFAULT_LOAD, BlockedBloom::DEFAULT_BITS_PER_KEY);
         std::exit(EXIT_FAILURE);
     }
-    while((c = getopt(argc, argv, "Cw:M:S:p:k:T:F:tefHh?")) >= 0) {
+    while((c = getopt(argc, argv, "Cw:M:S:p:k:T:F:b:l:V:tefmcHh?")) >= 0) {
         switch(c) {
             case 'C': canon = false; break;
             case 'h': case '?': goto usage;
@@ -118,6 +283,11 @@ int phase2_main(int argc, char *argv[]) {
             case 'M': seq2taxpath = optarg; break;
             case 'F': paths_file = optarg; break;
             case 'e': mode = score_scheme::ENTROPY; break;
+            case 'm': write_mapped = true; break;
+            case 'c': write_compact = true; break;
+            case 'l': compact_load = std::atof(optarg); break;
+            case 'V': compact_vbits = std::atoi(optarg); break;
+            case 'b': bloom_bits = std::atof(optarg); break;
         }
     }
     if(wsz < 0 || wsz < k) LOG_EXIT("Window size must be set and >= k for phase2.\n");
@@ -127,28 +297,35 @@ int phase2_main(int argc, char *argv[]) {
     if(inpaths.empty()) LOG_EXIT("Need input files from command line or file. See usage.\n");
     LOG_DEBUG("Got paths\n");
     if(seq2taxpath.empty()) LOG_EXIT("seq2taxpath required for final database generation.");
-    if(score_scheme::LEX == mode || score_scheme::ENTROPY) {
+    if(mode == score_scheme::LEX || mode == score_scheme::ENTROPY) {
         Spacer sp(k, wsz, sv);
         Database<khash_t(c)>  phase2_map(sp);
         // Force using hll so that we can use __sync_bool_compare_and_swap to parallelize.
         std::size_t hash_size(estimate_cardinality<score::Lex>(inpaths, k, k, sp.s_, canon, nullptr, num_threads, 24));
         LOG_DEBUG("Estimated cardinality: %zu\n", hash_size);
         LOG_DEBUG("Parent map bulding from %s\n", argv[optind]);
-        khash_t(p) *taxmap(build_parent_map(argv[optind]));
-        phase2_map.db_ = score_scheme::LEX == mode ? lca_map<score::Lex>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size)
-                                                   : lca_map<score::Entropy>(inpaths, taxmap, seq2taxpath.data(), sp, num_threads, canon, hash_size);
-        phase2_map.write(argv[optind + 1]);
-        kh_destroy(p, taxmap);
+        const FlatTaxonomy tax(argv[optind]);
+        const bool lex(mode == score_scheme::LEX);
+        phase2_map.db_ = lex ? lca_map<score::Lex>(inpaths, &tax, seq2taxpath.data(), sp, num_threads, canon, hash_size)
+                             : lca_map<score::Entropy>(inpaths, &tax, seq2taxpath.data(), sp, num_threads, canon, hash_size);
+        // Classification picks its encoder by the scheme, so record the scorer the minimizers were chosen with.
+        phase2_map.scheme_ = lex ? score_scheme::LEX: score_scheme::ENTROPY;
+        if(bloom_bits > 0.) phase2_map.make_bloom(bloom_bits);
+        if(write_compact) phase2_map.make_compact(tax, compact_load, compact_vbits);
+        phase2_map.write(argv[optind + 1], write_mapped);
         return EXIT_SUCCESS;
     }
     Database<khash_t(64)> phase1_map{Database<khash_t(64)>(argv[optind])};
     Database<khash_t(c)>  phase2_map{phase1_map};
     Spacer sp(k, wsz, phase1_map.s_);
-    khash_t(p) *taxmap(tax_path.empty() ? nullptr: build_parent_map(tax_path.data()));
-    phase2_map.db_ = minimized_map<score::Hash>(inpaths, phase1_map.db_, seq2taxpath.data(), taxmap, sp, num_threads, start_size, canon);
+    if(write_compact && tax_path.empty()) LOG_EXIT("A compact hash table needs a taxonomy (-T) to resolve colliding k-mers.\n");
+    std::unique_ptr<FlatTaxonomy> tax(tax_path.empty() ? nullptr: new FlatTaxonomy(tax_path.data()));
+    phase2_map.db_ = minimized_map<score::Hash>(inpaths, phase1_map.db_, seq2taxpath.data(), tax.get(), sp, num_threads, start_size, canon);
+    phase2_map.scheme_ = mode;
+    if(bloom_bits > 0.) phase2_map.make_bloom(bloom_bits);
+    if(write_compact) phase2_map.make_compact(*tax, compact_load, compact_vbits);
     // Write minimized map
-    phase2_map.write(argv[optind + 1]);
-    if(taxmap) kh_destroy(p, taxmap);
+    phase2_map.write(argv[optind + 1], write_mapped);
     return EXIT_SUCCESS;
 }
 
@@ -234,8 +411,12 @@ int phase1_main(int argc, char *argv[]) {
         }
     }
     if(wsz < 0) wsz = k;
-    khash_t(p) *taxmap(taxmap_preparsed ? khash_load<khash_t(p)>(argv[optind + 1])
-                                        : build_parent_map(argv[optind + 1]));
+    std::unique_ptr<FlatTaxonomy> tax;
+    if(taxmap_preparsed) {
+        khash_t(p) *taxmap(khash_load<khash_t(p)>(argv[optind + 1]));
+        tax.reset(new FlatTaxonomy(taxmap));
+        kh_destroy(p, taxmap);
+    } else tax.reset(new FlatTaxonomy(argv[optind + 1]));
     spvec_t sv(parse_spacing(spacing.data(), k));
     Spacer sp(k, wsz, sv);
     std::vector<std::string> inpaths(argv + optind + 3, argv + argc);
@@ -245,14 +426,171 @@ int phase1_main(int argc, char *argv[]) {
     if(mode == score_scheme::LEX) LOG_EXIT("No phase1 required for lexicographic. Use phase2 instead.\n");
     auto mapbuilder(mode == score_scheme::TAX_DEPTH ? taxdepth_map<score::Lex>
                                                     : ftct_map<score::Lex>);
-    Database<khash_t(64)> db(sp, 1, mapbuilder(inpaths, taxmap, argv[optind], sp, num_threads, canon, hash_size));
+    Database<khash_t(64)> db(sp, 1, mapbuilder(inpaths, tax.get(), argv[optind], sp, num_threads, canon, hash_size));
     for(auto &i: db.s_) {
         LOG_DEBUG("Decrementing value %i to %i\n", i, i - 1);
         --i;
     }
     db.write(argv[optind + 2]);
+    return EXIT_SUCCESS;
+}
+
+int flattax_main(int argc, char *argv[]) {
+    if(argc != 3) {
+        std::fprintf(stderr, "Usage: %s <taxmap.path> <out.path>\n"
+                             "Compiles a taxonomy for fast lca queries. classify, phase1 and phase2 accept the output "
+                             "wherever they take a taxonomy, and map it instead of parsing it.\n", *argv);
+        return EXIT_FAILURE;
+    }
+    const FlatTaxonomy tax(argv[1]);
+    tax.write(argv[2]);
+    LOG_INFO("Wrote taxonomy with %zu taxa to %s.\n", tax.size(), argv[2]);
+    return EXIT_SUCCESS;
+}
+
+int serve_main(int argc, char *argv[]) {
+    int co, num_threads(16), nworkers(1), queue_size(64), groups_per_thread(16), emit_all(0);
+    long long chunk_size(1 << 20);
+    bool use_bloom(true), early_exit(false);
+    double confidence(0.);
+    placement_t placement;
+    while((co = getopt(argc, argv, "c:N:p:q:S:t:T:w:aBeh?")) >= 0) {
+        switch(co) {
+            case 'a': emit_all = 1; break;
+            case 'B': use_bloom = false; break;
+            case 'c': chunk_size = std::strtoll(optarg, nullptr, 10); break;
+            case 'e': early_exit = true; break;
+            case 'N': placement.numa_ = parse_numa(optarg); break;
+            case 'p': num_threads = std::atoi(optarg); break;
+            case 'q': queue_size = std::atoi(optarg); break;
+            case 'S': groups_per_thread = std::atoi(optarg); break;
+            case 't': confidence = std::atof(optarg); break;
+            case 'T': placement.huge_ = parse_huge_pages(optarg); break;
+            case 'w': nworkers = std::atoi(optarg); break;
+            case 'h': case '?': goto usage;
+        }
+    }
+    if(argc - optind != 3 || nworkers < 1 || num_threads < 1 || queue_size < 1 || chunk_size <= 0) {
+        usage:
+        std::fprintf(stderr, "Usage: %s <dbpath> <tax_path> <socket path>\n"
+                             "Holds a database and taxonomy in memory and classifies reads for clients of a Unix socket (see bonsai submit).\n"
+                             "Flags:\n-p:\tSet number of classification threads, split between request workers. Default: 16.\n"
+                             "-w:\tSet number of requests served at once. Default: 1.\n"
+                             "-q:\tSet number of requests which may wait for a worker. Others are turned away. Default: 64.\n"
+                             "-c:\tSet chunk size. Default: %i\n"
+                             "-S:\tSplit each chunk into this many groups of reads per thread. Default: 16.\n"
+                             "-a:\tEmit all records, not just classified.\n"
+                             "-t:\tSet confidence threshold, as for classify. Default: 0.\n"
+                             "-e:\tStop looking up a read's k-mers early, as for classify.\n"
+                             "-B:\tIgnore the database's Bloom filter, if it has one.\n"
+                             "-T:\tBack a mapped database with huge pages, as for classify. Default: none.\n"
+                             "-N:\tPlace a mapped database across NUMA nodes: local or interleave. Default: local.\n", *argv, 1 << 20);
+        return EXIT_FAILURE;
+    }
+    if(confidence < 0. || confidence > 1.) LOG_EXIT("Confidence threshold must be in [0, 1]. (Got %lf)\n", confidence);
+    // Request workers' threads would contend for the same cores, so there is no pinning, which replicas need.
+    if(placement.numa_ == NUMA_REPLICATE) {
+        LOG_WARNING("serve cannot pin threads, which replication needs. Interleaving instead.\n");
+        placement.numa_ = NUMA_INTERLEAVE;
+    }
+    std::signal(SIGPIPE, SIG_IGN); // Clients which hang up show up as write errors instead.
+    Database<khash_t(c)> db(argv[optind], use_bloom, placement);
+    LOG_INFO("Database placement: %s.\n", placement.str().data());
+    const unsigned wsz(db.lookup_window());
+    const FlatTaxonomy tax(argv[optind + 1]);
+    auto run = [&](auto score) {
+        using ClassifierType = ClassifierGeneric<decltype(score)>;
+        std::vector<std::unique_ptr<ClassifierType>> cs;
+        for(int i(0); i < nworkers; ++i) {
+            cs.emplace_back(new ClassifierType(db.db_, db.s_, db.k_, wsz, std::max(num_threads / nworkers, 1),
+                                               emit_all, false, true, true, db.ct_, db.bf_));
+            cs.back()->early_exit_ = early_exit;
+            cs.back()->confidence_ = confidence;
+        }
+        Server<decltype(score)> server(std::move(cs), tax, argv[optind + 2], queue_size, chunk_size, groups_per_thread);
+        server.run();
+    };
+    if(wsz > db.k_ && db.scheme_ == score_scheme::ENTROPY) run(score::Entropy{});
+    else                                                   run(score::Lex{});
+    return EXIT_SUCCESS;
+}
 
-    kh_destroy(p, taxmap);
+int submit_main(int argc, char *argv[]) {
+    int co;
+    bool stream(false), quit(false);
+    std::FILE *ofp(stdout);
+    std::string server_out;
+    while((co = getopt(argc, argv, "o:O:sQh?")) >= 0) {
+        switch(co) {
+            case 'o': if((ofp = std::fopen(optarg, "w")) == nullptr) LOG_EXIT("Could not open %s for writing.\n", optarg); break;
+            case 'O': server_out = optarg; break;
+            case 's': stream = true; break;
+            case 'Q': quit = true; break;
+            case 'h': case '?': goto usage;
+        }
+    }
+    if((stream && quit) || (server_out.size() && (stream || quit)) || (quit   ? argc - optind != 1:
+                            stream ? argc - optind != 2:
+                                     argc - optind != 2 && argc - optind != 3)) {
+        usage:
+        std::fprintf(stderr, "Usage: %s <socket path> <inr1.fq> [Optional: <inr2.fq>]\n"
+                             "Sends reads to a bonsai serve process and writes its classifications.\n"
+                             "Flags:\n-o:\tRedirect output to path instead of stdout.\n"
+                             "-O:\tHave the server write output to path itself instead of sending it back. Not with -s.\n"
+                             "-s:\tSend single-end records over the socket instead of their path. '-' reads them from stdin.\n"
+                             "-Q:\tStop the server once its queued requests are done. No inputs are given.\n", *argv);
+        return EXIT_FAILURE;
+    }
+    std::string header;
+    if(quit) header = "QUIT";
+    else if(stream) header = "STREAM";
+    else {
+        header = "CLASSIFY";
+        if(server_out.size()) {
+            if(server_out[0] != '/') {
+                std::unique_ptr<char, decltype(&std::free)> cwd(::getcwd(nullptr, 0), &std::free);
+                if(!cwd) LOG_EXIT("Could not get working directory: %s\n", std::strerror(errno));
+                server_out = std::string(cwd.get()) + '/' + server_out;
+            }
+            header += " -o " + server_out;
+        }
+        for(int i(optind + 1); i < argc; ++i) {
+            // The server may have another working directory.
+            std::unique_ptr<char, decltype(&std::free)> path(::realpath(argv[i], nullptr), &std::free);
+            if(!path) LOG_EXIT("Could not find %s: %s\n", argv[i], std::strerror(errno));
+            (header += ' ') += path.get();
+        }
+    }
+    const auto start(std::chrono::steady_clock::now());
+    const bool ok(submit_request(argv[optind], header, stream ? argv[optind + 1]: nullptr, ofp));
+    LOG_INFO("Request took %.3lfs.\n", std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    if(ofp != stdout) std::fclose(ofp);
+    return ok ? EXIT_SUCCESS: EXIT_FAILURE;
+}
+
+int view_main(int argc, char *argv[]) {
+    int co, num_threads(4);
+    std::FILE *ofp(stdout);
+    while((co = getopt(argc, argv, "o:p:h?")) >= 0) {
+        switch(co) {
+            case 'o': if((ofp = std::fopen(optarg, "w")) == nullptr) LOG_EXIT("Could not open %s for writing.\n", optarg); break;
+            case 'p': num_threads = std::atoi(optarg); break;
+            case 'h': case '?': goto usage;
+        }
+    }
+    if(argc - optind != 1) {
+        usage:
+        std::fprintf(stderr, "Usage: %s <classify.bin>\n"
+                             "Converts binary classify output (classify -x) to the text classify would have written:\n"
+                             "fastq-style if it holds sequences, kraken-style otherwise.\n"
+                             "Flags:\n-o:\tRedirect output to path instead of stdout.\n"
+                             "-p:\tSet number of threads. Default: 4.\n", *argv);
+        return EXIT_FAILURE;
+    }
+    const BinaryCalls calls(argv[optind]);
+    LOG_DEBUG("Converting %" PRIu64 " records in %zu blocks.\n", calls.nrecords(), calls.nblocks());
+    if(!calls.write_text(fileno(ofp), num_threads)) LOG_EXIT("Could not write output: %s\n", std::strerror(errno));
+    if(ofp != stdout) std::fclose(ofp);
     return EXIT_SUCCESS;
 }
 
@@ -277,7 +615,7 @@ int hist_main(int argc, char *argv[]) {
  }
 
 int err_main(int argc, char *argv[]) {
-    std::fputs("No valid subcommand provided. Options: phase1, phase2, classify, hll, metatree, dist, sketch, setdist\n", stderr);
+    std::fputs("No valid subcommand provided. Options: phase1, phase2, classify, view, serve, submit, flattax, hll, metatree, dist, sketch, setdist\n", stderr);
     return EXIT_FAILURE;
 }
 
@@ -302,8 +640,12 @@ int main(int argc, char *argv[]) {
         {"sketch",   emp::sketch_main},
         {"setdist",  emp::setdist_main},
         {"hist",     hist_main},
+        {"flattax",  flattax_main},
         {"metatree", metatree_main},
-        {"classify", classify_main}
+        {"classify", classify_main},
+        {"view",     view_main},
+        {"serve",    serve_main},
+        {"submit",   submit_main}
     };
     return (argc > 1 && md.find(argv[1]) != md.end() ? md.find(argv[1])->second
                                                      : err_main)(argc - 1, argv + 1);
@@ -0,0 +1,81 @@
+#ifndef _BINNING_H__
+#define _BINNING_H__
+#include "flattax.h"
+#include "kseq_declare.h"
+#include "kspp/ks.h"
+#include <unordered_map>
+
+namespace emp {
+
+/*
+ * Binning reads into FASTQ files by their calls while classifying (classify -d), instead of a second pass over its output.
+ * Each worker appends the reads it bins to its own buffer as bin entries: the bin's taxon and the record's length
+ * (two u32s), then the record. classify_seqs gathers them per chunk in read order, and the writing step hands them to
+ * the sample's ReadBinner, which collects each bin's records and writes them out FLUSH_SIZE at a time.
+ * Bin 0 holds unclassified reads. Pairs are written interleaved. Reads without qualities get PLACEHOLDER_QUAL throughout,
+ * so that every bin is FASTQ.
+ */
+class TaxonBins {
+    const FlatTaxonomy &tax_;
+    std::vector<u32> bin_; // Dense id of each node's bin, or NONE. Empty to bin each call as itself.
+    bool classified_, unclassified_;
+    void select(const std::vector<bool> &selected);
+public:
+    static constexpr tax_t NO_BIN = tax_t(-1);
+    static constexpr char  PLACEHOLDER_QUAL = 'I'; // For reads from FASTA
+    unsigned max_open_; // Bin files open at once
+    TaxonBins(const FlatTaxonomy &tax, bool classified=true, bool unclassified=false, unsigned max_open=256);
+    // Bins each call under the deepest of clades above it, if any.
+    void set_clades(const std::vector<tax_t> &clades);
+    // Bins each call under its ancestor at rank, if any, with ranks from a taxonomy in NCBI's nodes.dmp format.
+    void set_rank(const char *rank, const char *nodes_path);
+    // Bin of a read called as taxon, NO_BIN for none.
+    tax_t bin(tax_t taxon) const {
+        if(taxon == 0) return unclassified_ ? 0: NO_BIN;
+        if(!classified_) return NO_BIN;
+        if(bin_.empty()) return taxon;
+        const u32 d(tax_.dense(taxon));
+        return d == FlatTaxonomy::NONE || bin_[d] == FlatTaxonomy::NONE ? NO_BIN: tax_.id(bin_[d]);
+    }
+};
+
+// Appends bs (and its mate, if paired) to bks as an entry for bin.
+void append_bin_entry(tax_t bin, const bseq1_t *bs, const int is_paired, kstring_t *bks);
+
+// One sample's bin files, <prefix><taxid>.fq and <prefix>unclassified.fq.
+class ReadBinner {
+    struct bin_t {
+        ks::string buf_;
+        int        fd_;
+        u64        used_;    // When fd_ was last written, for closing the least recently used file
+        bool       created_; // Later opens append.
+        bin_t(): fd_(-1), used_(0), created_(false) {}
+    };
+    std::string prefix_;
+    std::unordered_map<tax_t, bin_t> bins_;
+    std::vector<tax_t> open_;
+    unsigned max_open_;
+    u64 buffered_, clock_, nreads_;
+    int err_; // errno of the first failed open or write
+    bool closed_;
+    void flush(tax_t taxon, bin_t &bin);
+public:
+    static constexpr size_t FLUSH_SIZE   = 1 << 20;
+    static constexpr size_t MAX_BUFFERED = size_t(256) << 20; // Beyond this, every bin is flushed.
+    ReadBinner(std::string prefix, unsigned max_open);
+    ReadBinner(const ReadBinner &other) = delete;
+    ReadBinner &operator=(const ReadBinner &other) = delete;
+    ~ReadBinner();
+    std::string path(tax_t taxon) const;
+    // Takes the bin entries in s[0, l).
+    void add(const char *s, size_t l);
+    // Writes out every bin and closes the files. Returns false, with errno set, if any open or write failed.
+    // Later calls do nothing and return the same.
+    bool close();
+    size_t size() const {return bins_.size();}
+    u64 nreads() const {return nreads_;}
+};
+
+} // namespace emp
+
+#endif // #ifndef _BINNING_H__
@@ -0,0 +1,143 @@
+#ifndef _BINOUT_H__
+#define _BINOUT_H__
+#include "kseq_declare.h"
+#include "util.h"
+#include <cstring>
+
+namespace emp {
+
+/*
+ * Compact binary per-read output (classify -x), which `bonsai view` turns back into classify's text.
+ * Text output spends most of its bytes and formatting time on decimal taxa runs; this holds the same
+ * information as varints. A file is laid out as
+ *     binout_header_t
+ *     blocks, one per classified chunk, each a binout_block_t followed by its records,
+ *     the index: one binout_index_t per block,
+ *     binout_trailer_t,
+ * so a reader can mmap it, find the blocks from the trailer and decode them in parallel.
+ * A file without a trailer (e.g., from an interrupted run) can still be read by walking its blocks.
+ * Each record is, with every integer a LEB128 varint:
+ *     name length, name, NUL
+ *     taxon, read length (of the first mate for pairs), hits, missing, ambiguous and skipped k-mers
+ *     number of segment calls (-g), then the calls
+ *     [BINOUT_RUNS, classified reads only] number of runs, then (taxon + 1, run length) per run,
+ *                                          so that ambiguous k-mers ((tax_t)-1) are 0 and missing ones 1
+ *     [BINOUT_SEQS] sequence, then a byte which is 1 if a quality of the same length follows
+ *     [BINOUT_SEQS and BINOUT_PAIRED] the mate's name length, name, NUL, length, sequence and quality, as above
+ * Only the reads classify would have written as text are stored.
+ */
+static constexpr u64 BINOUT_MAGIC       = 0x4C434941534E4F42ull; // "BONSAICL"
+static constexpr u64 BINOUT_INDEX_MAGIC = 0x58494941534E4F42ull; // "BONSAIIX"
+static constexpr u32 BINOUT_VERSION     = 1;
+
+enum binout_flags: u32 {
+    BINOUT_RUNS   = 1, // Taxa runs, as kraken-style output has
+    BINOUT_SEQS   = 2, // Sequences and qualities, as fastq-style output has
+    BINOUT_PAIRED = 4
+};
+
+struct binout_header_t {
+    u64 magic_;
+    u32 version_;
+    u32 flags_;
+};
+
+struct binout_block_t {
+    u64 nbytes_; // Of records, after this header
+    u32 nrecords_;
+    u32 reserved_;
+};
+
+struct binout_index_t {
+    u64 offset_; // Of the block's header, from the start of the file
+    u64 first_;  // Number of records in earlier blocks
+};
+
+struct binout_trailer_t {
+    u64 index_offset_;
+    u64 nblocks_;
+    u64 magic_;
+};
+
+struct binout_read_t {
+    const char *name_, *seq_, *qual_; // seq_ is null without BINOUT_SEQS, qual_ if there is none.
+    u32 l_name_, l_seq_;
+};
+
+struct binout_record_t {
+    binout_read_t read_[2]; // read_[1] is the mate, for paired files with sequences.
+    tax_t taxon_;
+    u32   hits_, missing_, ambig_, skipped_;
+    std::vector<tax_t> segment_calls_;
+    std::vector<std::pair<tax_t, u32>> runs_; // Taxon and length. Empty without BINOUT_RUNS or for unclassified reads.
+};
+
+INLINE void kputvarint(u64 v, kstring_t *ks) {
+    ks_resize(ks, ks->l + 11);
+    while(v >= 0x80) ks->s[ks->l++] = char(v | 0x80), v >>= 7;
+    ks->s[ks->l++] = char(v);
+}
+
+// Returns null if the varint runs past end.
+INLINE const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, u64 &v) {
+    v = 0;
+    for(unsigned shift(0); p < end && shift < 64; shift += 7) {
+        const uint8_t byte(*p++);
+        v |= u64(byte & 0x7F) << shift;
+        if(!(byte & 0x80)) return p;
+    }
+    return nullptr;
+}
+
+// Appends a record for bs (and its mate at bs + 1, if paired) to bks.
+void append_binary_classification(const std::vector<tax_t> &taxa,
+                                  const tax_t taxon, const u32 ambig_count, const u32 missing_count,
+                                  const u32 skipped_count, const bseq1_t *bs, kstring_t *bks, const u32 flags,
+                                  const std::vector<tax_t> *segment_calls=nullptr);
+// Decodes the record at p into rec and returns the end of it, or null if it runs past end.
+const uint8_t *decode_binary_record(const uint8_t *p, const uint8_t *end, const u32 flags, binout_record_t &rec);
+// Appends rec as classify would have written it: fastq-style if the file holds sequences, with the taxa runs
+// in the comment if it holds runs, and kraken-style otherwise. Kraken-style lines of a file without runs end in 0:0.
+// taxa is scratch space.
+void append_binary_as_text(const binout_record_t &rec, const u32 flags, std::vector<tax_t> &taxa, kstring_t *ks);
+
+// A binary output file, mmap'd read-only.
+class BinaryCalls {
+    const uint8_t *map_;
+    size_t size_;
+    binout_header_t h_;
+    std::vector<binout_index_t> index_;
+    u64 nrecords_;
+    // Blocks are not aligned, since records are of any length.
+    binout_block_t block(size_t i) const {
+        binout_block_t ret;
+        std::memcpy(&ret, map_ + index_[i].offset_, sizeof(ret));
+        return ret;
+    }
+public:
+    BinaryCalls(const char *path);
+    BinaryCalls(const BinaryCalls &other) = delete;
+    BinaryCalls &operator=(const BinaryCalls &other) = delete;
+    ~BinaryCalls();
+    u32 flags() const {return h_.flags_;}
+    size_t nblocks() const {return index_.size();}
+    u64 nrecords() const {return nrecords_;}
+    u64 first_record(size_t i) const {return index_[i].first_;}
+    // Calls func on each record of block i, in order. The record's strings point into the mapping.
+    template<typename Func>
+    void for_each(size_t i, const Func &func, binout_record_t &rec) const {
+        const binout_block_t b(block(i));
+        const uint8_t *p(map_ + index_[i].offset_ + sizeof(b)), *end(p + b.nbytes_);
+        for(u32 j(0); j < b.nrecords_; ++j) {
+            if((p = decode_binary_record(p, end, h_.flags_, rec)) == nullptr)
+                LOG_EXIT("Record %" PRIu64 " of binary output is malformed.\n", index_[i].first_ + j);
+            func(rec);
+        }
+    }
+    // Writes every record to fd as text, formatting blocks on nthreads threads. Returns false, with errno set, if writing fails.
+    bool write_text(int fd, int nthreads) const;
+};
+
+} // namespace emp
+
+#endif // #ifndef _BINOUT_H__
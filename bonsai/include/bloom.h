@@ -0,0 +1,60 @@
+#ifndef _BLOOM_H__
+#define _BLOOM_H__
+#include "hash.h"
+#include "util.h"
+
+namespace emp {
+
+/*
+ * Cache-line-blocked Bloom filter over database keys.
+ * The low 32 bits of wang_hash(key) pick a 512-bit block, and nhashes_ 9-bit fields of a remix of
+ * the hash set or test bits within it, so a query touches one cache line.
+ * There are no false negatives: a key the filter rejects is absent from the database.
+ */
+struct bloom_meta_t {
+    u64 nblocks_;
+    u32 nhashes_, pad_;
+};
+
+struct BlockedBloom {
+    static constexpr double DEFAULT_BITS_PER_KEY = 10.;
+    static constexpr u64    BLOCK_WORDS = 8; // 64 bytes
+
+    u64 *words_;
+    bloom_meta_t m_;
+    int owns_; // If not set, words_ points into a mapped database.
+
+    // View of a filter stored elsewhere (e.g., an mmap'd database).
+    BlockedBloom(const bloom_meta_t &meta, u64 *words): words_(words), m_(meta), owns_(0) {}
+    // Empty filter for nkeys keys.
+    BlockedBloom(u64 nkeys, double bits_per_key=DEFAULT_BITS_PER_KEY);
+    BlockedBloom(const BlockedBloom &other) = delete;
+    BlockedBloom &operator=(const BlockedBloom &other) = delete;
+    ~BlockedBloom() {if(owns_) std::free(words_);}
+
+    u64 nwords() const {return m_.nblocks_ * BLOCK_WORDS;}
+    u64 bytes()  const {return nwords() * sizeof(*words_);}
+
+    INLINE const u64 *block(u64 hash) const {
+        return words_ + ((((hash & 0xFFFFFFFFu) * m_.nblocks_) >> 32) * BLOCK_WORDS);
+    }
+    INLINE static u64 remix(u64 hash) {return ((hash >> 32) | (hash << 32)) * UINT64_C(0xD6E8FEB86659FD93);}
+    INLINE void prefetch(u64 kmer) const {__builtin_prefetch(block(wang_hash(kmer)));}
+    INLINE void insert(u64 kmer) {
+        const u64 hash(wang_hash(kmer));
+        u64 *b(const_cast<u64 *>(block(hash))), bits(remix(hash));
+        for(u32 i(0); i < m_.nhashes_; ++i, bits >>= 9) b[(bits >> 6) & 7] |= UINT64_C(1) << (bits & 63);
+    }
+    INLINE bool may_contain(u64 kmer) const {
+        const u64 hash(wang_hash(kmer));
+        const u64 *b(block(hash));
+        u64 bits(remix(hash));
+        for(u32 i(0); i < m_.nhashes_; ++i, bits >>= 9)
+            if((b[(bits >> 6) & 7] & (UINT64_C(1) << (bits & 63))) == 0) return false;
+        return true;
+    }
+};
+
+} // namespace emp
+
+#endif // #ifndef _BLOOM_H__
@@ -1,40 +1,125 @@
 #ifndef _DB_H__
 #define _DB_H__
 #include <atomic>
+#include <cerrno>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include "kspp/ks.h"
+#include "binning.h"
+#include "binout.h"
+#include "bloom.h"
+#include "compact.h"
+#include "compress.h"
+#include "decompress.h"
 #include "encoder.h"
 #include "feature_min.h"
+#include "flattax.h"
 #include "klib/kthread.h"
+#include "kmercache.h"
+#include "placement.h"
+#include "report.h"
+#include "seqscan.h"
 #include "util.h"
 
 namespace emp {
-using tax_counter = linear::counter<tax_t, u16>;
 
 void append_kraken_classification(const tax_counter &hit_counts,
                                   const std::vector<tax_t> &taxa,
                                   const tax_t taxon, const u32 ambig_count, const u32 missing_count,
-                                  bseq1_t *bs, kstring_t *bks);
+                                  const u32 skipped_count, bseq1_t *bs, kstring_t *bks,
+                                  const std::vector<tax_t> *segment_calls=nullptr);
 void append_fastq_classification(const tax_counter &hit_counts,
                                  const std::vector<u32> &taxa,
                                  const tax_t taxon, const u32 ambig_count, const u32 missing_count,
-                                 bseq1_t *bs, kstring_t *bks, const int verbose, const int is_paired);
+                                 const u32 skipped_count, bseq1_t *bs, kstring_t *bks, const int verbose, const int is_paired,
+                                 const std::vector<tax_t> *segment_calls=nullptr);
 void append_taxa_runs(tax_t taxon, const std::vector<tax_t> &taxa, kstring_t *bks);
 
 enum output_format {
     KRAKEN   = 1,
     FASTQ    = 2,
-    EMIT_ALL = 4
+    EMIT_ALL = 4,
+    BINARY   = 8  // Records as binout.h describes, instead of text. Runs and sequences are kept if KRAKEN and FASTQ are set.
+};
+
+// The tables lookups go to: a database's own, or its replica on one NUMA node.
+struct db_tables_t {
+    khash_t(c) *db_;
+    const CompactTable *ct_; // Used instead of db_ if set.
+    const BlockedBloom *bf_; // Checked before db_ or ct_ if set.
+    // Returns 0 for k-mers missing from the database.
+    INLINE tax_t lookup(u64 kmer) const {
+        if(bf_ && !bf_->may_contain(kmer)) return 0;
+        if(ct_) return ct_->get(kmer);
+        const khiter_t ki(kh_get(c, db_, kmer));
+        return ki == kh_end(db_) ? 0: kh_val(db_, ki);
+    }
+    // Touch the cache lines the first probe of lookup(kmer) will need.
+    // With a Bloom filter, only for k-mers which pass it: prefetch_filter(kmer) should come first.
+    INLINE void prefetch_filter(u64 kmer) const {
+        if(bf_) bf_->prefetch(kmer);
+    }
+    INLINE void prefetch(u64 kmer) const {
+        if(bf_ && !bf_->may_contain(kmer)) return;
+        if(ct_) {ct_->prefetch(kmer); return;}
+        const khint_t i(__ac_Wang64_hash(kmer) & (db_->n_buckets - 1));
+        __builtin_prefetch(db_->flags + (i >> 4));
+        __builtin_prefetch(db_->keys + i);
+        __builtin_prefetch(db_->vals + i);
+    }
+    // As above, going through cache first if it is set.
+    INLINE tax_t lookup(u64 kmer, KmerCache *cache) const {
+        return cache ? cache->get(kmer, [this](u64 k) {return this->lookup(k);}): lookup(kmer);
+    }
+    INLINE void prefetch(u64 kmer, const KmerCache *cache) const {
+        if(cache == nullptr || !cache->contains(kmer)) prefetch(kmer);
+    }
 };
 
 template<typename ScoreType>
 struct ClassifierGeneric {
-    khash_t(c) *db_;
+    std::vector<db_tables_t> tables_; // The database's, then one per further NUMA node if it is replicated.
+    // Tables of each further database of a cascade, as tables_. Reads go on to the next database
+    // if the ones before leave them unclassified or below cascade_confidence_.
+    std::vector<std::vector<db_tables_t>> stage_tables_;
+    std::vector<u32> thread_tables_;  // Index into tables_ per thread, if replicated.
+    std::vector<int> thread_cpus_;    // Core per thread, if pinned.
     Spacer sp_;
     Encoder<ScoreType> enc_;
     int nt_;
     int output_flag_;
     std::atomic<u64> classified_[2];
+    static constexpr unsigned MAX_STAGES = 16;
+    std::atomic<u64> stage_reads_[MAX_STAGES], stage_classified_[MAX_STAGES]; // Reads looked up and kept per database, if cascading
+    bool batch_; // Encode a whole read before looking up its k-mers, prefetching ahead.
+    bool early_exit_; // Stop looking up a read's k-mers once they can no longer change its clade.
+    double confidence_; // Minimum fraction of a read's unambiguous k-mers in the clade it is assigned to.
+    double cascade_confidence_; // Reads whose call holds less than this fraction of their k-mers go on to the next database.
+    AbundanceReport *report_; // Counts calls per taxon if set.
+    const TaxonBins *bins_;   // Reads are also binned by call if set.
+    mutable std::vector<KmerCache> caches_; // One per thread, if enabled.
+    u32 segment_len_; // Single-end reads longer than this are split into segments classified in parallel. 0 for none.
+    bool emit_segments_; // Emit the calls of a split read's segments as G:<call>,<call>,...
+    // Per-thread scratch space, kept across chunks.
+    struct alignas(64) worker_t {
+        Encoder<ScoreType> enc_;
+        std::vector<tax_t> taxa_;
+        std::vector<u64>   kmers_;
+        ks::string         out_; // Output of the reads this thread classified in the current chunk.
+        ks::string         bin_out_; // Bin entries of the same reads, if binning
+        worker_t(const Encoder<ScoreType> &enc): enc_(enc), out_(256u) {}
+    };
+    std::vector<worker_t> workers_;
+    // Where each read's output is in its worker's out_, for the current chunk.
+    struct out_ref_t {
+        u32 tid_, len_, bin_len_;
+        u64 offset_, bin_offset_;
+    };
+    std::vector<out_ref_t> out_refs_;
     public:
+    static constexpr size_t PREFETCH_DIST = 16;
+    static constexpr size_t EXIT_INTERVAL = 16; // Lookups between early-exit checks.
     void set_emit_all(bool setting) {
         if(setting) output_flag_ |= output_format::EMIT_ALL;
         else        output_flag_ &= (~output_format::EMIT_ALL);
@@ -49,14 +134,80 @@ struct ClassifierGeneric {
     }
     INLINE int get_emit_all()    {return output_flag_ & output_format::EMIT_ALL;}
     INLINE int get_emit_kraken() {return output_flag_ & output_format::KRAKEN;}
+    void set_emit_binary(bool setting) {
+        if(setting) output_flag_ |= output_format::BINARY;
+        else        output_flag_ &= (~output_format::BINARY);
+    }
     INLINE int get_emit_fastq()  {return output_flag_ & output_format::FASTQ;}
+    INLINE int get_emit_binary() const {return output_flag_ & output_format::BINARY;}
+    u32 binout_flags(bool is_paired) const {
+        return (output_flag_ & output_format::KRAKEN ? BINOUT_RUNS: 0) | (output_flag_ & output_format::FASTQ ? BINOUT_SEQS: 0) |
+               (is_paired ? BINOUT_PAIRED: 0);
+    }
+    const db_tables_t &tables(int tid, unsigned stage=0) const {
+        const std::vector<db_tables_t> &t(stage ? stage_tables_[stage - 1]: tables_);
+        return t[thread_tables_.size() ? thread_tables_[tid] % t.size(): 0];
+    }
+    void add_replica(khash_t(c) *db, const CompactTable *ct, const BlockedBloom *bf, unsigned stage=0) {
+        (stage ? stage_tables_[stage - 1]: tables_).push_back(db_tables_t{db, ct, bf});
+    }
+    // Appends a database to the cascade. It must have been built with the same k, window, spacing and scoring.
+    void add_stage(khash_t(c) *db, const CompactTable *ct, const BlockedBloom *bf) {
+        if(nstages() == MAX_STAGES) LOG_EXIT("At most %u databases can be cascaded.\n", MAX_STAGES);
+        stage_tables_.push_back({db_tables_t{db, ct, bf}});
+    }
+    unsigned nstages() const {return 1 + stage_tables_.size();}
+    // Threads go to NUMA nodes round-robin, as thread_node(). Each looks up its node's replica, if any,
+    // and is pinned to a core there if pin is set. Replicas only pay off with pinning.
+    void place_threads(bool pin) {
+        thread_tables_.clear(), thread_cpus_.clear();
+        for(int tid(0); tid < nt_; ++tid) {
+            if(tables_.size() > 1) thread_tables_.push_back(thread_node(tid) % tables_.size());
+            if(pin)                thread_cpus_.push_back(thread_cpu(tid));
+        }
+    }
+    // kt_for starts fresh threads for each call, so workers check on every work item.
+    void pin(int tid) const {
+        static thread_local int pinned(-1);
+        if(thread_cpus_.size() && pinned != thread_cpus_[tid]) pin_thread(pinned = thread_cpus_[tid]);
+    }
+    // 2^lg entries per thread.
+    void enable_cache(unsigned lg) {
+        caches_.clear();
+        caches_.reserve(nt_);
+        for(int i(0); i < nt_; ++i) caches_.emplace_back(lg);
+    }
+    KmerCache *cache(int tid) const {return caches_.size() ? &caches_[tid]: nullptr;}
+    worker_t &worker(int tid) {return workers_[tid];}
+    void make_workers() {
+        if(workers_.size() == size_t(nt_)) return;
+        workers_.clear();
+        workers_.reserve(nt_);
+        for(int i(0); i < nt_; ++i) workers_.emplace_back(enc_);
+    }
+    bool segmented(const bseq1_t &bs, const int is_paired) const {
+        return segment_len_ && !is_paired && u32(bs.l_seq) > segment_len_;
+    }
+    u64 cache_hits()   const {u64 ret(0); for(const auto &cache: caches_) ret += cache.hits();   return ret;}
+    u64 cache_misses() const {u64 ret(0); for(const auto &cache: caches_) ret += cache.misses(); return ret;}
     ClassifierGeneric(khash_t(c) *map, spvec_t &spaces, u8 k, std::uint16_t wsz, int num_threads=16,
-                      bool emit_all=true, bool emit_fastq=true, bool emit_kraken=false, bool canonicalize=true):
-        db_(map),
+                      bool emit_all=true, bool emit_fastq=true, bool emit_kraken=false, bool canonicalize=true,
+                      const CompactTable *ct=nullptr, const BlockedBloom *bf=nullptr):
+        tables_{db_tables_t{map, ct, bf}},
         sp_(k, wsz, spaces),
         enc_(sp_, canonicalize),
         nt_(num_threads > 0 ? num_threads: 16),
-        classified_{0, 0}
+        classified_{0, 0},
+        stage_reads_{},
+        stage_classified_{},
+        batch_(true),
+        early_exit_(false),
+        confidence_(0.),
+        cascade_confidence_(0.),
+        report_(nullptr),
+        bins_(nullptr),
+        segment_len_(0),
+        emit_segments_(false)
     {
         set_emit_all(emit_all);
         set_emit_fastq(emit_fastq);
@@ -67,6 +218,8 @@ struct ClassifierGeneric {
         ClassifierGeneric(khash_load<khash_t(c)>(dbpath), spaces, k, wsz, num_threads, emit_all, emit_fastq, emit_kraken, canonicalize) {}
     u64 n_classified()   const {return classified_[0];}
     u64 n_unclassified() const {return classified_[1];}
+    u64 stage_reads(unsigned stage)      const {return stage_reads_[stage];}
+    u64 stage_classified(unsigned stage) const {return stage_classified_[stage];}
 };
 
 INLINE void append_taxa_run(const tax_t last_taxa,
@@ -94,133 +247,593 @@ INLINE void append_counts(u32 count, const char character, kstring_t *ks) {
     }
 }
 
+// Calls of a split read's segments, in order, so that chimeras show up as changes along the read.
+INLINE void append_segment_calls(const std::vector<tax_t> *calls, kstring_t *ks) {
+    if(calls == nullptr || calls->empty()) return;
+    kputsn_("G:", 2, ks);
+    for(const tax_t call: *calls) kputuw_(call, ks), kputc_(',', ks);
+    ks->s[ks->l - 1] = '\t';
+}
+
 using Classifier = ClassifierGeneric<score::Lex>;
+// A run of ambiguous k-mers is stored as BF followed by the length of the run.
 template<typename ScoreType>
-unsigned classify_seq(ClassifierGeneric<ScoreType> &c,
-                      Encoder<ScoreType> &enc,
-                      const khash_t(p) *taxmap, bseq1_t *bs, const int is_paired, std::vector<tax_t> &taxa) {
-    u64 kmer;
-    khiter_t ki;
-    linear::counter<tax_t, u16> hit_counts;
-    u32 ambig_count(0), missing_count(0);
-    tax_t taxon(0);
-    ks::string bks(bs->sam, bs->l_sam);
-    bks.clear();
-    taxa.clear();
+INLINE void encode_seq(Encoder<ScoreType> &enc, const char *seq, int len, std::vector<u64> &kmers) {
+    auto func = [&](u64 kmer) {
+        kmers.push_back(kmer);
+        if(unlikely(kmer == BF)) kmers.push_back(1); // A 32-mer of Ts is indistinguishable from BF.
+    };
+    auto skip = [&](u64 n) {kmers.push_back(BF), kmers.push_back(n);};
+    enc.assign(seq, len);
+    if(enc.canonicalize()) enc.template for_each_kmer<true>(func, skip);
+    else                   enc.template for_each_kmer<false>(func, skip);
+}
 
-    enc.assign(bs->seq, bs->l_seq);
-    while(enc.has_next_kmer()) {
-        if((kmer = enc.next_kmer()) == BF) ++ambig_count, taxa.push_back((tax_t)-1);
-        // If the kmer is ambiguous, ignore it and move on.
-        else {
-            if((ki = kh_get(c, c.db_, kmer)) == kh_end(c.db_)) ++missing_count, taxa.push_back(0);
-            //If the kmer is missing from our database, just say we don't know what it is.
-            else {
-                // Otherwise, increment the count.
-                taxa.push_back(kh_val(c.db_, ki));
-                hit_counts.add(kh_val(c.db_, ki));
-            }
+// Windowed databases only contain window minimizers, so we encode the way the
+// database was built and only look those up.
+// Windows without an unambiguous minimizer are counted as ambiguous.
+// Minimizers are stored as encode_seq stores k-mers, so that an all-T 32-mer is not taken for a run of ambiguous k-mers.
+template<typename ScoreType>
+INLINE void encode_minimizers(Encoder<ScoreType> &enc, const char *seq, int len, std::vector<u64> &kmers, u32 &ambig_count) {
+    std::int64_t nfound(0);
+    enc.for_each_seq([&](u64 min) {
+        kmers.push_back(min), ++nfound;
+        if(unlikely(min == BF)) kmers.push_back(1);
+    }, seq, len);
+    const std::int64_t nwindows(std::int64_t(len) - enc.sp_.w_ + 1);
+    if(nwindows > nfound) ambig_count += nwindows - nfound;
+}
+
+// Looks up every k-mer of kmers in order. Prefetching PREFETCH_DIST k-mers ahead
+// lets the cache misses of independent probes overlap instead of stalling on each one.
+// Bloom filter blocks are prefetched twice as far ahead, so they are in cache when we
+// decide whether to prefetch the table.
+// Repeats of the previous k-mer (i.e., consecutive windows sharing a minimizer) reuse its result.
+// With early_exit, every EXIT_INTERVAL lookups we check whether the k-mers left could still move the
+// read out of its leading clade, or below the confidence threshold, and stop if not. The call we make
+// is then the one a full scan would make or one of its ancestors.
+// Lookups go to the database of the cascade's stage. Only the first one's are cached.
+// Returns the number of k-mers left unprobed.
+template<typename ScoreType>
+INLINE u32 lookup_kmers(const ClassifierGeneric<ScoreType> &c, int tid, const FlatTaxonomy &taxonomy, const std::vector<u64> &kmers,
+                        std::vector<tax_t> &taxa, tax_counter &hit_counts, u32 &ambig_count, u32 &missing_count, const bool early_exit,
+                        const unsigned stage=0) {
+    constexpr size_t dist(ClassifierGeneric<ScoreType>::PREFETCH_DIST);
+    const db_tables_t &t(c.tables(tid, stage));
+    KmerCache *const cache(stage ? nullptr: c.cache(tid));
+    const size_t n(kmers.size());
+    u64 last(BF);
+    tax_t tax(0);
+    u32 remaining(0), next_check(ClassifierGeneric<ScoreType>::EXIT_INTERVAL);
+    if(early_exit)
+        for(size_t i(0); i < n; ++i)
+            if(kmers[i] == BF) ++i; // Skip the run length.
+            else               ++remaining;
+    if(t.bf_) for(size_t i(0), e(std::min(n, 2 * dist)); i < e; ++i) if(kmers[i] != BF) t.prefetch_filter(kmers[i]);
+    for(size_t i(0), e(std::min(n, dist)); i < e; ++i) if(kmers[i] != BF) t.prefetch(kmers[i], cache);
+    for(size_t i(0); i < n; ++i) {
+        if(t.bf_ && i + 2 * dist < n && kmers[i + 2 * dist] != BF) t.prefetch_filter(kmers[i + 2 * dist]);
+        if(i + dist < n && kmers[i + dist] != BF) t.prefetch(kmers[i + dist], cache);
+        if(kmers[i] == BF) {
+            const u64 nambig(kmers[++i]);
+            ambig_count += nambig, taxa.insert(taxa.end(), nambig, (tax_t)-1);
+            continue;
         }
-    }
-    if(is_paired) {
-        enc.assign((bs + 1)->seq, (bs + 1)->l_seq);
-        while(enc.has_next_kmer()) {
-            if((kmer = enc.next_kmer()) == BF) ++ambig_count, taxa.push_back((tax_t)-1);
-            // If the kmer is ambiguous, ignore it and move on.
-            else {
-                if((ki = kh_get(c, c.db_, kmer)) == kh_end(c.db_)) ++missing_count, taxa.push_back(0);
-                //If the kmer is missing from our database, just say we don't know what it is.
-                else {
-                    // Check map for presence of the hit.
-                    // If it's not there, insert it with a hint.
-                    // Otherwise, increment the count.
-                    taxa.push_back(kh_val(c.db_, ki));
-                    hit_counts.add(kh_val(c.db_, ki));
-                }
-            }
+        if(kmers[i] != last) tax = t.lookup(last = kmers[i], cache);
+        if(tax == 0) ++missing_count, taxa.push_back(0);
+        else         taxa.push_back(tax), hit_counts.add(tax);
+        if(early_exit && --remaining && --next_check == 0) {
+            next_check = ClassifierGeneric<ScoreType>::EXIT_INTERVAL;
+            const FlatTaxonomy::resolution_t res(taxonomy.resolve(hit_counts));
+            if(res.taxon_ && res.score_ > res.outside_ + remaining &&
+               res.clade_ >= c.confidence_ * (res.total_ + missing_count + remaining))
+                return remaining;
         }
     }
+    return 0;
+}
 
-    ++c.classified_[!(taxon = resolve_tree(hit_counts, taxmap))];
+// Unbatched: look up each k-mer as soon as it is encoded.
+template<typename ScoreType>
+INLINE void scan_seq(const ClassifierGeneric<ScoreType> &c, int tid, Encoder<ScoreType> &enc, const char *seq, int len,
+                     std::vector<tax_t> &taxa, tax_counter &hit_counts, u32 &ambig_count, u32 &missing_count, const unsigned stage=0) {
+    const db_tables_t &t(c.tables(tid, stage));
+    KmerCache *const cache(stage ? nullptr: c.cache(tid));
+    tax_t tax;
+    auto func = [&](u64 kmer) {
+        // If the kmer is ambiguous, ignore it and move on.
+        if(unlikely(kmer == BF)) ++ambig_count, taxa.push_back((tax_t)-1);
+        //If the kmer is missing from our database, just say we don't know what it is.
+        else if((tax = t.lookup(kmer, cache)) == 0) ++missing_count, taxa.push_back(0);
+        // Otherwise, increment the count.
+        else taxa.push_back(tax), hit_counts.add(tax);
+    };
+    auto skip = [&](u64 n) {ambig_count += n, taxa.insert(taxa.end(), n, (tax_t)-1);};
+    enc.assign(seq, len);
+    if(enc.canonicalize()) enc.template for_each_kmer<true>(func, skip);
+    else                   enc.template for_each_kmer<false>(func, skip);
+}
+
+// Looks up the k-mers of len bases at seq, then those of mate if set, the way c is set up to,
+// in the database of the cascade's stage.
+// Returns the number of k-mers left unprobed by early exit.
+template<typename ScoreType>
+INLINE u32 scan_read(const ClassifierGeneric<ScoreType> &c, int tid, Encoder<ScoreType> &enc, const FlatTaxonomy &tax,
+                     const char *seq, int len, const bseq1_t *mate, const bool early_exit, std::vector<tax_t> &taxa,
+                     std::vector<u64> &kmers, tax_counter &hit_counts, u32 &ambig_count, u32 &missing_count,
+                     const unsigned stage=0) {
+    if(!enc.sp_.unwindowed()) {
+        kmers.clear();
+        encode_minimizers(enc, seq, len, kmers, ambig_count);
+        if(mate) encode_minimizers(enc, mate->seq, mate->l_seq, kmers, ambig_count);
+        return lookup_kmers(c, tid, tax, kmers, taxa, hit_counts, ambig_count, missing_count, early_exit, stage);
+    }
+    if(c.batch_ || early_exit) { // Early exit needs to know how many k-mers are left.
+        kmers.clear();
+        encode_seq(enc, seq, len, kmers);
+        if(mate) encode_seq(enc, mate->seq, mate->l_seq, kmers);
+        return lookup_kmers(c, tid, tax, kmers, taxa, hit_counts, ambig_count, missing_count, early_exit, stage);
+    }
+    scan_seq(c, tid, enc, seq, len, taxa, hit_counts, ambig_count, missing_count, stage);
+    if(mate) scan_seq(c, tid, enc, mate->seq, mate->l_seq, taxa, hit_counts, ambig_count, missing_count, stage);
+    return 0;
+}
+
+// The call for a read's hits, moved up the tree to meet c's confidence threshold.
+template<typename ScoreType>
+INLINE tax_t call_read(const ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, const tax_counter &hit_counts, const u32 missing_count) {
+    tax_t taxon(tax.resolve_tree(hit_counts));
+    if(taxon && c.confidence_ > 0.) taxon = tax.confident_ancestor(hit_counts, taxon, c.confidence_, missing_count);
+    return taxon;
+}
+
+// Calls a read from its hits, counts the call and appends the read's output to out.
+// Returns the number of bytes appended.
+// segment_calls, if set, are the calls of the segments of a split read.
+// If c bins reads and bin_out is set, the read's bin entry, if any, is appended to bin_out.
+template<typename ScoreType>
+unsigned finish_read(ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, bseq1_t *bs, const int is_paired,
+                     const std::vector<tax_t> &taxa, const tax_counter &hit_counts,
+                     const u32 ambig_count, const u32 missing_count, const u32 skipped_count, int tid, kstring_t *out,
+                     const std::vector<tax_t> *segment_calls=nullptr, kstring_t *bin_out=nullptr) {
+    const size_t start(out->l);
+    const tax_t taxon(call_read(c, tax, hit_counts, missing_count));
+    ++c.classified_[!taxon];
+    if(c.report_) c.report_->add(tid, taxon);
+    if(c.bins_ && bin_out) {
+        const tax_t bin(c.bins_->bin(taxon));
+        if(bin != TaxonBins::NO_BIN) append_bin_entry(bin, bs, is_paired, bin_out);
+    }
     if(c.get_emit_all() || taxon) {
-        if(c.get_emit_fastq()) {
-            append_fastq_classification(hit_counts, taxa, taxon, ambig_count, missing_count, bs, kspp2ks(bks), c.get_emit_kraken(), is_paired);
+        if(c.get_emit_binary()) {
+            append_binary_classification(taxa, taxon, ambig_count, missing_count, skipped_count, bs, out, c.binout_flags(is_paired), segment_calls);
+        } else if(c.get_emit_fastq()) {
+            append_fastq_classification(hit_counts, taxa, taxon, ambig_count, missing_count, skipped_count, bs, out, c.get_emit_kraken(), is_paired, segment_calls);
         } else if(c.get_emit_kraken()) {
-            append_kraken_classification(hit_counts, taxa, taxon, ambig_count, missing_count, bs, kspp2ks(bks));
+            append_kraken_classification(hit_counts, taxa, taxon, ambig_count, missing_count, skipped_count, bs, out, segment_calls);
         }
     }
+    return out->l - start;
+}
+
+// Whether a read with these hits stops at stage of the cascade: it is classified with at least cascade_confidence_
+// there, or there is no later database. Counts the read for the stage's statistics.
+template<typename ScoreType>
+INLINE bool cascade_stops(ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, const tax_counter &hit_counts,
+                          const u32 missing_count, const unsigned stage) {
+    if(c.nstages() == 1) return true;
+    ++c.stage_reads_[stage];
+    const tax_t taxon(call_read(c, tax, hit_counts, missing_count));
+    if(taxon && (c.cascade_confidence_ <= 0. ||
+                 tax.confident_ancestor(hit_counts, taxon, c.cascade_confidence_, missing_count) == taxon)) {
+        ++c.stage_classified_[stage];
+        return true;
+    }
+    return stage + 1 == c.nstages();
+}
+
+// Appends the read's output to out if set. Otherwise, it replaces bs->sam, which the caller frees.
+// Bin entries go to bin_out, as finish_read.
+// With a cascade, the read is looked up in each database in turn until one classifies it with at least
+// cascade_confidence_, and its output is from the last one it was looked up in.
+template<typename ScoreType>
+unsigned classify_seq(ClassifierGeneric<ScoreType> &c,
+                      Encoder<ScoreType> &enc,
+                      const FlatTaxonomy &tax, bseq1_t *bs, const int is_paired, std::vector<tax_t> &taxa,
+                      std::vector<u64> &kmers, int tid=0, kstring_t *out=nullptr, kstring_t *bin_out=nullptr) {
+    tax_counter hit_counts;
+    u32 ambig_count, missing_count, skipped_count;
+    for(unsigned stage(0);; ++stage) {
+        ambig_count = missing_count = 0;
+        taxa.clear(), hit_counts.clear();
+        skipped_count = scan_read(c, tid, enc, tax, bs->seq, bs->l_seq, is_paired ? bs + 1: nullptr,
+                                  c.early_exit_, taxa, kmers, hit_counts, ambig_count, missing_count, stage);
+        if(cascade_stops(c, tax, hit_counts, missing_count, stage)) break;
+    }
+    if(out) return finish_read(c, tax, bs, is_paired, taxa, hit_counts, ambig_count, missing_count, skipped_count, tid, out, nullptr, bin_out);
+    ks::string bks(bs->sam, bs->l_sam);
+    bks.clear();
+    finish_read(c, tax, bs, is_paired, taxa, hit_counts, ambig_count, missing_count, skipped_count, tid, kspp2ks(bks));
+    bs->l_sam = bks.size(); // release() resets the length.
     bs->sam   = bks.release();
-    return bs->l_sam = bks.size();
+    return bs->l_sam;
+}
+
+// A slice of a long read. Consecutive segments overlap by a window less one base,
+// so that each k-mer (or window) of the read lies in exactly one of them.
+struct segment_t {
+    unsigned           read_;
+    int                start_, len_;
+    tax_counter        hit_counts_;
+    std::vector<tax_t> taxa_;
+    u32                ambig_count_, missing_count_;
+};
+
+// Early exit is off for segments, since it needs the whole read's hits.
+// Looks the segment up in the database of the cascade's stage, replacing the hits of any stage before.
+template<typename ScoreType>
+void classify_segment(ClassifierGeneric<ScoreType> &c, Encoder<ScoreType> &enc, const FlatTaxonomy &tax,
+                      const bseq1_t *bs, segment_t &seg, std::vector<u64> &kmers, int tid, const unsigned stage=0) {
+    seg.ambig_count_ = seg.missing_count_ = 0;
+    seg.taxa_.clear(), seg.hit_counts_.clear();
+    scan_read(c, tid, enc, tax, bs[seg.read_].seq + seg.start_, seg.len_, nullptr, false,
+              seg.taxa_, kmers, seg.hit_counts_, seg.ambig_count_, seg.missing_count_, stage);
 }
 
 namespace {
+template<typename ScoreType>
 struct kt_data {
-    ClassifierGeneric<score::Lex> &c_;
-    khash_t(p) *taxmap;
+    ClassifierGeneric<ScoreType> &c_;
+    const FlatTaxonomy &tax_;
     bseq1_t *bs_;
-    const unsigned per_set_;
-    const unsigned total_;
+    const std::vector<unsigned> &bounds_; // Group i is reads [bounds_[i], bounds_[i + 1]).
+    std::vector<segment_t> &segments_;    // Indices past the last group are segments.
+    const std::vector<unsigned> &segment_bounds_; // Split read i is segments [segment_bounds_[i], segment_bounds_[i + 1]).
     std::atomic<u64> &retstr_size_;
     const int is_paired_;
+    std::vector<unsigned> rescan_; // Segments to look up again in stage_ of the cascade
+    unsigned stage_;
 };
 }
+template<typename ScoreType>
 void kt_for_helper(void *data_, long index, int tid);
+template<typename ScoreType>
+void kt_rescan_helper(void *data_, long index, int tid);
+template<typename ScoreType>
+void kt_merge_helper(void *data_, long index, int tid);
 
-inline void classify_seqs(Classifier &c, khash_t(p) *taxmap, bseq1_t *bs,
-                          kstring_t *cks, const unsigned chunk_size, const unsigned per_set, const int is_paired) {
-    assert(per_set && ((per_set & (per_set - 1)) == 0));
+// Reads are split into about groups_per_thread groups per thread of roughly equal total length,
+// rather than of equal read counts, so that a few long reads do not leave one thread with most of the work.
+// kt_for hands out groups round-robin and lets threads which run out steal from the others.
+// Reads longer than c.segment_len_ are left out of the groups. Their segments are handed out
+// after the groups instead, and each read's segments merged and called once all are done.
+// With a cascade, split reads go down it together: a read whose merged hits do not stop it at a stage
+// has all of its segments looked up again in the next database, as classify_seq would the whole read.
+// Output is appended to each thread's arena, which is reset rather than freed between chunks,
+// and gathered into cks in read order at the end. Bin entries, if c bins reads, are gathered into bks the same way.
+// Returns the number of reads which produced output.
+template<typename ScoreType>
+inline u32 classify_seqs(ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, bseq1_t *bs,
+                          kstring_t *cks, const unsigned chunk_size, const unsigned groups_per_thread, const int is_paired,
+                          kstring_t *bks=nullptr) {
+    const int inc(!!is_paired + 1);
+    u64 total(0), bases(0);
+    std::vector<segment_t> segments;
+    std::vector<unsigned> segment_bounds{0};
+    for(unsigned i(0); i < chunk_size; ++i) {
+        if(!c.segmented(bs[i], is_paired)) {
+            total += bs[i].l_seq;
+            continue;
+        }
+        const int overlap(c.sp_.w_ - 1);
+        for(int start(0); start == 0 || start + overlap < bs[i].l_seq; start += c.segment_len_)
+            segments.push_back(segment_t{i, start, std::min(int(c.segment_len_) + overlap, bs[i].l_seq - start), {}, {}, 0, 0});
+        segment_bounds.push_back(segments.size());
+    }
+    const u64 target(std::max(total / (u64(c.nt_) * std::max(groups_per_thread, 1u)), u64(1)));
+    std::vector<unsigned> bounds{0};
+    for(unsigned i(0); i < chunk_size; i += inc)
+        if(!c.segmented(bs[i], is_paired) && (bases += bs[i].l_seq + (is_paired ? bs[i + 1].l_seq: 0)) >= target)
+            bounds.push_back(std::min(i + inc, chunk_size)), bases = 0;
+    if(bounds.back() < chunk_size) bounds.push_back(chunk_size);
 
+    c.make_workers();
+    for(auto &w: c.workers_) w.out_.clear(), w.bin_out_.clear();
+    c.out_refs_.resize(chunk_size);
     std::atomic<u64> retstr_size(0);
-    kt_data data{c, taxmap, bs, per_set, chunk_size, retstr_size, is_paired};
-    kt_for(c.nt_, &kt_for_helper, (void *)&data, chunk_size / per_set + 1);
-    ks_resize(cks, retstr_size.load());
-    const int inc(!!is_paired + 1);
-    for(unsigned i(0); i < chunk_size; i += inc) kputsn_(bs[i].sam, bs[i].l_sam, cks);
+    kt_data<ScoreType> data{c, tax, bs, bounds, segments, segment_bounds, retstr_size, is_paired, {}, 0};
+    kt_for(c.nt_, &kt_for_helper<ScoreType>, (void *)&data, bounds.size() - 1 + segments.size());
+    if(segments.size() && c.nstages() > 1) {
+        std::vector<unsigned> pending(segment_bounds.size() - 1); // Split reads still going down the cascade
+        std::iota(pending.begin(), pending.end(), 0u);
+        for(unsigned stage(0); pending.size(); ++stage) {
+            data.rescan_.clear();
+            pending.erase(std::remove_if(pending.begin(), pending.end(), [&](unsigned read) {
+                tax_counter hit_counts;
+                u32 missing_count(0);
+                for(unsigned i(segment_bounds[read]); i < segment_bounds[read + 1]; ++i)
+                    hit_counts.merge(segments[i].hit_counts_), missing_count += segments[i].missing_count_;
+                if(cascade_stops(c, tax, hit_counts, missing_count, stage)) return true;
+                for(unsigned i(segment_bounds[read]); i < segment_bounds[read + 1]; data.rescan_.push_back(i++));
+                return false;
+            }), pending.end());
+            data.stage_ = stage + 1;
+            if(data.rescan_.size()) kt_for(c.nt_, &kt_rescan_helper<ScoreType>, (void *)&data, data.rescan_.size());
+        }
+    }
+    if(segments.size()) kt_for(c.nt_, &kt_merge_helper<ScoreType>, (void *)&data, segment_bounds.size() - 1);
+    ks_resize(cks, cks->l + retstr_size.load() + 1);
+    u32 nout(0);
+    for(unsigned i(0); i < chunk_size; i += inc) {
+        const auto &ref(c.out_refs_[i]);
+        kputsn_(c.workers_[ref.tid_].out_.data() + ref.offset_, ref.len_, cks);
+        nout += ref.len_ != 0;
+        if(bks && ref.bin_len_) kputsn_(c.workers_[ref.tid_].bin_out_.data() + ref.bin_offset_, ref.bin_len_, bks);
+    }
     cks->s[cks->l] = 0;
+    return nout;
 }
 
-struct del_data {
-    bseq1_t *seqs_;
-    unsigned per_set_;
-    unsigned total_;
-};
-
-void kt_del_helper(void *data_, long index, int tid);
-
 #if !NDEBUG
 #define DBKS(ks) do {\
     LOG_DEBUG("String: %s. Max: %zu. Len: %zu.\n", (ks) ? (ks)->s ? (ks)->s: "Unset string": "nullptr", (ks)->m, (ks)->l);\
     } while(0)
 #endif
 
-inline void process_dataset(Classifier &c, khash_t(p) *taxmap, const char *fq1, const char *fq2,
-                     std::FILE *out, unsigned chunk_size,
-                     unsigned per_set) {
-    int nseq(0);
-    gzFile ifp1(gzopen(fq1, "rb")), ifp2(fq2 ? gzopen(fq2, "rb"): nullptr);
-    kseq_t *ks1(kseq_init(ifp1)), *ks2(ifp2 ? kseq_init(ifp2): nullptr);
-    del_data dd{nullptr, per_set, chunk_size};
-    ks::string cks(256u);
-    const int is_paired(fq2 != 0);
-    if((dd.seqs_ = bseq_read(chunk_size, &nseq, (void *)ks1, (void *)ks2)) == nullptr) {
-        LOG_WARNING("Could not get any sequences from file, fyi.\n");
-        goto fail; // Wheeeeee
-    }
-    while((dd.seqs_ = bseq_realloc_read(chunk_size, &nseq, (void *)ks1, (void *)ks2, dd.seqs_))) {
-        LOG_INFO("Read %i seqs with chunk size %u\n", nseq, chunk_size);
-        // Classify
-        classify_seqs(c, taxmap, dd.seqs_, kspp2ks(cks), nseq, per_set, is_paired);
-        // Write out
-        ::write(fileno(out), cks.data(), cks.size()); // Already buffered.
-        // Delete
-        cks.clear();
-    }
-    kt_for(c.nt_, &kt_del_helper, (void *)&dd, nseq / per_set + 1);
-    free(dd.seqs_);
-    fail:
-    // Clean up.
-    gzclose(ifp1); gzclose(ifp2);
-    kseq_destroy(ks1); kseq_destroy(ks2);
+// Chunks in flight at once when pipelining: one being read, one classified and one written.
+static constexpr int PIPELINE_DEPTH = 3;
+
+// One input of a run, single-end if fq2_ is empty.
+struct sample_t {
+    std::string name_, fq1_, fq2_, out_path_;
+    std::FILE  *out_;   // If null, out_path_ is opened when the sample is reached and closed after its last chunk.
+    bool        owned_; // Whether out_ was opened from out_path_.
+    int         in_fd_; // If set, single-end records are read from this descriptor instead of fq1_.
+    int         write_errno_; // Set if writing output failed. The rest of the sample's output is dropped.
+    std::string error_;       // Set if the sample's input or output could not be opened or its input is corrupt.
+    u64         nreads_, nclassified_, nchunks_;
+    u64         out_bytes_, out_records_; // Written so far, for binary output's index
+    std::vector<binout_index_t> out_blocks_;
+    std::unique_ptr<ParallelCompressor> zout_; // Compresses output for out_, if set
+    std::string bin_prefix_; // If set and the classifier bins reads, they are binned into files starting with this.
+    std::unique_ptr<ReadBinner> binner_;
+    sample_t(std::string name, std::string fq1, std::string fq2, std::string out_path, std::FILE *out=nullptr, int in_fd=-1):
+        name_(std::move(name)), fq1_(std::move(fq1)), fq2_(std::move(fq2)), out_path_(std::move(out_path)),
+        out_(out), owned_(false), in_fd_(in_fd), write_errno_(0), nreads_(0), nclassified_(0), nchunks_(0),
+        out_bytes_(0), out_records_(0) {}
+    bool is_paired() const {return !fq2_.empty();}
+    // Writes to zout_ if set, or else straight to out_'s descriptor, as output is already buffered.
+    // Does nothing once writing has failed, or if out_ could not be opened.
+    void write(const void *s, size_t l);
+};
+
+// One sample per line: <name> <output path> <r1.fq> [<r2.fq>], whitespace-separated.
+// Blank lines and lines starting with '#' are skipped.
+std::vector<sample_t> parse_manifest(const char *path);
+// Tab-separated name, reads, classified and unclassified reads per sample.
+void write_sample_summary(const std::vector<sample_t> &samples, std::FILE *fp);
+
+struct pipeline_chunk;
+
+template<typename ScoreType>
+struct pipeline_data {
+    ClassifierGeneric<ScoreType> &c_;
+    const FlatTaxonomy           &tax_;
+    std::vector<sample_t>        &samples_;
+    const u64                     chunk_size_; // Bases per chunk
+    const unsigned                groups_per_thread_, dthreads_;
+    size_t                        next_; // Sample being read
+    std::unique_ptr<ParallelDecompressor> in1_, in2_;
+    gzFile                        gz_; // For descriptor input
+    SeqScanner                    in1_scan_, in2_scan_; // Buffers are kept across samples.
+    std::vector<pipeline_chunk *> free_;      // Written chunks, kept for their buffers.
+    std::mutex                    free_lock_; // Reading and writing are on different threads.
+    const int                     compression_; // compression_format of each sample's output
+    const unsigned                cthreads_;    // Threads compressing it
+};
+
+// A chunk of one sample's reads. A chunk without reads marks the end of its sample.
+// Chunks are recycled, so that their read arena and output grow to the largest chunk and then stay put.
+struct pipeline_chunk {
+    bseq_batch_t batch_;
+    int          nseq_;
+    sample_t    *sample_;
+    ks::string   out_;
+    ks::string   bins_; // Bin entries
+    pipeline_chunk(): batch_{nullptr, 0, 0, nullptr, 0, 0}, nseq_(0), sample_(nullptr), out_(256u) {}
+    ~pipeline_chunk() {bseq_batch_destroy(&batch_);}
+};
+
+template<typename ScoreType>
+pipeline_chunk *get_chunk(pipeline_data<ScoreType> &data) {
+    std::lock_guard<std::mutex> lock(data.free_lock_);
+    if(data.free_.empty()) return new pipeline_chunk;
+    pipeline_chunk *ret(data.free_.back());
+    data.free_.pop_back();
+    return ret;
+}
+
+template<typename ScoreType>
+void put_chunk(pipeline_data<ScoreType> &data, pipeline_chunk *chunk) {
+    std::lock_guard<std::mutex> lock(data.free_lock_);
+    data.free_.push_back(chunk);
+}
+
+// Returns false, with sample.error_ set, if its input or output could not be opened.
+template<typename ScoreType>
+bool open_sample(pipeline_data<ScoreType> &data, sample_t &sample) {
+    if(sample.out_ == nullptr) {
+        if((sample.out_ = std::fopen(sample.out_path_.data(), "w")) == nullptr) {
+            sample.error_ = "could not open " + sample.out_path_ + " for writing: " + std::strerror(errno);
+            return false;
+        }
+        sample.owned_ = true;
+    }
+    if(sample.in_fd_ >= 0) {
+        // Decoded on the reading step. gzdopen passes uncompressed input through as is.
+        const int fd(::dup(sample.in_fd_));
+        if(fd < 0 || (data.gz_ = gzdopen(fd, "rb")) == nullptr) {
+            if(fd >= 0) ::close(fd);
+            sample.error_ = "could not read from descriptor " + std::to_string(sample.in_fd_);
+            return false;
+        }
+        data.in1_scan_.assign(data.gz_);
+    } else {
+        // dthreads_ decoding threads per input file. 0 decodes on the reading step itself.
+        try {
+            data.in1_.reset(new ParallelDecompressor(sample.fq1_.data(), data.dthreads_));
+            data.in2_.reset(new ParallelDecompressor(sample.is_paired() ? sample.fq2_.data(): nullptr, data.dthreads_));
+        } catch(const std::runtime_error &e) {
+            sample.error_ = e.what();
+            return false;
+        }
+        if(!*data.in1_ || (sample.is_paired() && !*data.in2_)) {
+            sample.error_ = "could not open input file " + (*data.in1_ ? sample.fq2_: sample.fq1_);
+            return false;
+        }
+        data.in1_scan_.assign(data.in1_->fp());
+        data.in2_scan_.assign(sample.is_paired() ? data.in2_->fp(): nullptr);
+    }
+    std::fflush(sample.out_);
+    if(data.compression_ != COMPRESS_NONE) sample.zout_.reset(new ParallelCompressor(fileno(sample.out_), data.compression_, data.cthreads_));
+    if(data.c_.bins_ && sample.bin_prefix_.size()) sample.binner_.reset(new ReadBinner(sample.bin_prefix_, data.c_.bins_->max_open_));
+    return true;
+}
+
+// Why reading or decoding the sample's input stopped short, if it did. Empty if it did not.
+template<typename ScoreType>
+std::string sample_input_error(const pipeline_data<ScoreType> &data, const sample_t &sample) {
+    for(const auto *in: {data.in1_.get(), data.in2_.get()})
+        if(in && in->error()) return in->error();
+    if(data.in1_scan_.error()) return "could not read " + sample.fq1_ + ": " + data.in1_scan_.error();
+    if(data.in2_scan_.error()) return "could not read " + sample.fq2_ + ": " + data.in2_scan_.error();
+    return std::string();
+}
+
+template<typename ScoreType>
+void close_sample_input(pipeline_data<ScoreType> &data) {
+    data.in1_scan_.assign(nullptr), data.in2_scan_.assign(nullptr);
+    data.in1_.reset(), data.in2_.reset();
+    if(data.gz_) gzclose(data.gz_), data.gz_ = nullptr;
+}
+
+// kt_pipeline step function: 0 reads a chunk, 1 classifies it, 2 writes and frees it.
+// kt_pipeline runs each step in chunk order, so output order is the same as for sequential processing,
+// and each sample's counts can be taken from the classifier's around its chunks' classification.
+// Samples are read back to back, so that the pipeline stays full across sample boundaries.
+// A sample which fails to open or decode ends there, with its error_ set, and the next one is read.
+template<typename ScoreType>
+void *pipeline_step(void *shared, int step, void *in) {
+    pipeline_data<ScoreType> &data(*static_cast<pipeline_data<ScoreType> *>(shared));
+    pipeline_chunk *chunk(static_cast<pipeline_chunk *>(in));
+    switch(step) {
+        case 0:
+            if(data.next_ == data.samples_.size()) return nullptr;
+            chunk = get_chunk(data);
+            chunk->sample_ = &data.samples_[data.next_];
+            chunk->out_.clear(), chunk->bins_.clear();
+            if(data.in1_scan_.fp() == nullptr && !open_sample(data, *chunk->sample_)) chunk->nseq_ = 0;
+            else chunk->nseq_ = bseq_batch_read(data.chunk_size_, &chunk->batch_, data.in1_scan_, data.in2_scan_.fp() ? &data.in2_scan_: nullptr);
+            if(chunk->nseq_ <= 0) {
+                // A chunk cut short by a read error is dropped along with the rest of the sample.
+                if(chunk->sample_->error_.empty()) chunk->sample_->error_ = sample_input_error(data, *chunk->sample_);
+                chunk->nseq_ = 0;
+                close_sample_input(data);
+                ++data.next_;
+                return static_cast<void *>(chunk);
+            }
+            LOG_DEBUG("Read %i seqs with chunk size %" PRIu64 "\n", chunk->nseq_, data.chunk_size_);
+            ++chunk->sample_->nchunks_;
+            return static_cast<void *>(chunk);
+        case 1:
+            if(chunk->nseq_) {
+                sample_t &sample(*chunk->sample_);
+                const u64 before(data.c_.n_classified());
+                // Binary output's block header goes in front, once we know what follows it.
+                binout_block_t block{0, 0, 0};
+                if(data.c_.get_emit_binary()) kputsn_(&block, sizeof(block), kspp2ks(chunk->out_));
+                block.nrecords_ = classify_seqs(data.c_, data.tax_, chunk->batch_.seqs, kspp2ks(chunk->out_), chunk->nseq_, data.groups_per_thread_, sample.is_paired(),
+                                                sample.binner_ ? kspp2ks(chunk->bins_): nullptr);
+                if(data.c_.get_emit_binary()) {
+                    block.nbytes_ = chunk->out_.size() - sizeof(block);
+                    std::memcpy(kspp2ks(chunk->out_)->s, &block, sizeof(block));
+                }
+                sample.nreads_      += sample.is_paired() ? chunk->nseq_ / 2: chunk->nseq_;
+                sample.nclassified_ += data.c_.n_classified() - before;
+            }
+            return static_cast<void *>(chunk);
+        case 2: {
+            sample_t &sample(*chunk->sample_);
+            const bool binary(data.c_.get_emit_binary());
+            if(binary && sample.out_bytes_ == 0) {
+                const binout_header_t h{BINOUT_MAGIC, BINOUT_VERSION, data.c_.binout_flags(sample.is_paired())};
+                sample.write(&h, sizeof(h));
+            }
+            if(chunk->nseq_) {
+                if(binary) {
+                    sample.out_blocks_.push_back(binout_index_t{sample.out_bytes_, sample.out_records_});
+                    sample.out_records_ += reinterpret_cast<const binout_block_t *>(chunk->out_.data())->nrecords_;
+                }
+                sample.write(chunk->out_.data(), chunk->out_.size());
+                if(sample.binner_) sample.binner_->add(chunk->bins_.data(), chunk->bins_.size());
+            } else {
+                if(binary) {
+                    const binout_trailer_t t{sample.out_bytes_, sample.out_blocks_.size(), BINOUT_INDEX_MAGIC};
+                    sample.write(sample.out_blocks_.data(), sample.out_blocks_.size() * sizeof(binout_index_t));
+                    sample.write(&t, sizeof(t));
+                }
+                if(sample.zout_) {
+                    if(!sample.zout_->close() && !sample.write_errno_) sample.write_errno_ = errno;
+                    sample.zout_.reset();
+                }
+                if(sample.binner_) {
+                    if(!sample.binner_->close() && !sample.write_errno_) sample.write_errno_ = errno;
+                    LOG_INFO("Binned %" PRIu64 " reads into %zu files under %s.\n", sample.binner_->nreads(), sample.binner_->size(), sample.bin_prefix_.data());
+                    sample.binner_.reset();
+                }
+                if(sample.error_.size())     LOG_WARNING("Sample %s: %s\n", sample.name_.data(), sample.error_.data());
+                else if(sample.nchunks_ == 0) LOG_WARNING("Could not get any sequences from file %s, fyi.\n", sample.fq1_.data());
+                if(sample.owned_) std::fclose(sample.out_), sample.out_ = nullptr, sample.owned_ = false;
+                LOG_DEBUG("Sample %s: %" PRIu64 " of %" PRIu64 " reads classified.\n", sample.name_.data(), sample.nclassified_, sample.nreads_);
+            }
+            put_chunk(data, chunk);
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
+
+// Classifies each sample in turn into its own output, with one classifier and database for all of them.
+// Failures to write a sample's output are left in its write_errno_, and failures to open, read or decode it in its error_.
+// Output is compressed as compression (a compression_format) says on cthreads threads, overlapped with classification.
+template<typename ScoreType>
+inline void process_samples(ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, std::vector<sample_t> &samples,
+                            u64 chunk_size, unsigned groups_per_thread, bool pipeline=true, unsigned dthreads=1,
+                            int compression=COMPRESS_NONE, unsigned cthreads=1) {
+    pipeline_data<ScoreType> data{c, tax, samples, chunk_size, groups_per_thread, dthreads, 0, nullptr, nullptr, nullptr, {}, {}, {}, {},
+                                  compression, cthreads};
+    if(pipeline) {
+        // Overlap reading chunk n + 1 and writing chunk n - 1 with classifying chunk n.
+        kt_pipeline(PIPELINE_DEPTH, &pipeline_step<ScoreType>, (void *)&data, 3);
+    } else {
+        void *chunk;
+        while((chunk = pipeline_step<ScoreType>((void *)&data, 0, nullptr)))
+            pipeline_step<ScoreType>((void *)&data, 2, pipeline_step<ScoreType>((void *)&data, 1, chunk));
+    }
+    for(pipeline_chunk *chunk: data.free_) delete chunk;
+}
+
+template<typename ScoreType>
+inline void process_dataset(ClassifierGeneric<ScoreType> &c, const FlatTaxonomy &tax, const char *fq1, const char *fq2,
+                     std::FILE *out, u64 chunk_size,
+                     unsigned groups_per_thread, bool pipeline=true, unsigned dthreads=1,
+                     int compression=COMPRESS_NONE, unsigned cthreads=1, std::string bin_prefix="") {
+    std::vector<sample_t> samples;
+    samples.emplace_back(fq1, fq1, fq2 ? fq2: "", "", out);
+    samples[0].bin_prefix_ = std::move(bin_prefix);
+    process_samples(c, tax, samples, chunk_size, groups_per_thread, pipeline, dthreads, compression, cthreads);
+    if(samples[0].error_.size()) LOG_EXIT("Failed to classify %s: %s\n", fq1, samples[0].error_.data());
+    if(samples[0].write_errno_) LOG_EXIT("Failed to write output: %s\n", std::strerror(samples[0].write_errno_));
 }
 
 
@@ -0,0 +1,76 @@
+#ifndef _COMPACT_H__
+#define _COMPACT_H__
+#include "flattax.h"
+#include "hash.h"
+#include "util.h"
+
+namespace emp {
+
+/*
+ * Compact hash table, along the lines of Kraken 2's.
+ * A key is hashed with wang_hash; the high 32 bits pick a partition, the low sbits_ bits a start cell,
+ * and we probe linearly inside the partition, so a lookup rarely leaves its first cache line.
+ * A 32-bit cell stores a fingerprint of the key in its high fbits_ bits and an index into taxa_ in its low vbits_ bits.
+ * Cell value 0 marks an empty cell, so taxa_[0] is never used.
+ * Only fingerprints are stored: a missing key collides with probability of about (probe length) / 2^fbits_.
+ */
+struct compact_meta_t {
+    u64 ncells_, nparts_, size_, ntaxa_;
+    u32 sbits_, vbits_, fbits_, pad_;
+};
+
+struct CompactTable {
+    static constexpr double DEFAULT_LOAD  = 0.8;
+    static constexpr u32    DEFAULT_SBITS = 16; // 256 KB partitions
+
+    u32   *cells_;
+    tax_t *taxa_;
+    compact_meta_t m_;
+    int    owns_;  // If not set, cells_ and taxa_ point into a mapped database.
+
+    CompactTable(): cells_(nullptr), taxa_(nullptr), m_{0, 0, 0, 0, 0, 0, 0, 0}, owns_(0) {}
+    // View of tables stored elsewhere (e.g., an mmap'd database).
+    CompactTable(const compact_meta_t &meta, u32 *cells, tax_t *taxa):
+        cells_(cells), taxa_(taxa), m_(meta), owns_(0) {}
+    // Build from a finished khash. K-mers whose fingerprints collide are assigned the lca in tax.
+    // extra_vbits leaves room for taxa which only appear as such lcas.
+    CompactTable(const khash_t(c) *map, const FlatTaxonomy &tax,
+                 double load=DEFAULT_LOAD, u32 extra_vbits=0, u32 sbits=DEFAULT_SBITS);
+    CompactTable(const CompactTable &other) = delete;
+    CompactTable &operator=(const CompactTable &other) = delete;
+    ~CompactTable() {
+        if(owns_) std::free(cells_), std::free(taxa_);
+    }
+
+    u64 size()        const {return m_.size_;}
+    u64 capacity()    const {return m_.ncells_;}
+    u64 bytes()       const {return m_.ncells_ * sizeof(*cells_) + m_.ntaxa_ * sizeof(*taxa_);}
+    u64 part_size()   const {return u64(1) << m_.sbits_;}
+    u32 vmask()       const {return (u32(1) << m_.vbits_) - 1;}
+
+    INLINE const u32 *partition(u64 hash) const {
+        return cells_ + ((((hash >> 32) * m_.nparts_) >> 32) << m_.sbits_);
+    }
+    INLINE u32 fingerprint(u64 hash) const {
+        return (hash * 0x9E3779B97F4A7C15ull) >> (64 - m_.fbits_);
+    }
+    INLINE void prefetch(u64 kmer) const {
+        const u64 hash(wang_hash(kmer));
+        __builtin_prefetch(partition(hash) + (hash & (part_size() - 1)));
+    }
+    // Returns 0 if the key is missing.
+    INLINE tax_t get(u64 kmer) const {
+        const u64 hash(wang_hash(kmer));
+        const u32 *part(partition(hash)), fp(fingerprint(hash)), smask(part_size() - 1);
+        for(u32 i(hash & smask), step(0); step <= smask; i = (i + 1) & smask, ++step) {
+            const u32 cell(part[i]);
+            if(cell == 0)                   return 0;
+            if((cell >> m_.vbits_) == fp)   return taxa_[cell & vmask()];
+        }
+        return 0;
+    }
+};
+
+} // namespace emp
+
+#endif // #ifndef _COMPACT_H__
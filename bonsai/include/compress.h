@@ -0,0 +1,83 @@
+#ifndef _COMPRESS_H__
+#define _COMPRESS_H__
+#include "util.h"
+#include <cerrno>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unistd.h>
+
+namespace emp {
+
+/*
+ * Writes output to a descriptor, compressing it on a pool of threads, the counterpart of ParallelDecompressor.
+ * Output is cut into BLOCK_SIZE blocks which are compressed independently: into BGZF members for gzip, so that
+ * gunzip, bgzip and ParallelDecompressor (in parallel) can all read it, or into one zstd frame each (_z build only).
+ * A writer thread writes blocks as soon as they and every block before them are done, so compression and
+ * I/O overlap with whatever fills the stream. write() only waits once about MAX_BLOCKS_PER_THREAD blocks per thread are in flight.
+ * Uncompressed output goes through the writer thread as well.
+ * write() and close() are for one thread at a time.
+ */
+enum compression_format: int {
+    COMPRESS_NONE = 0,
+    COMPRESS_GZIP = 1,
+    COMPRESS_ZSTD = 2
+};
+
+// "none", "gzip" or "zstd".
+int parse_compression(const char *s);
+
+// Returns false, with errno set, if fd stops taking output.
+INLINE bool write_all(int fd, const char *s, size_t l) {
+    for(ssize_t rc; l; s += rc, l -= rc)
+        if((rc = ::write(fd, s, l)) < 0) {
+            if(errno != EINTR) return false;
+            rc = 0;
+        }
+    return true;
+}
+
+class ParallelCompressor {
+public:
+    static constexpr size_t   BLOCK_SIZE            = 1 << 20;
+    static constexpr size_t   BGZF_BLOCK_SIZE       = 0xff00; // Input per BGZF member, as bgzip, so that members stay under 64 KB.
+    static constexpr unsigned MAX_BLOCKS_PER_THREAD = 4;
+private:
+    struct block_t {
+        std::vector<char> in_, out_;
+        bool done_;
+    };
+    int fd_, format_, level_;
+    block_t *cur_; // Being filled
+    std::deque<block_t *> pending_;  // Waiting for a compressing thread
+    std::deque<block_t *> inflight_; // In output order, until written
+    std::vector<std::unique_ptr<block_t>> blocks_; // All of the above, and free_
+    std::vector<block_t *> free_;
+    size_t max_blocks_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::vector<std::thread> compressors_;
+    std::thread writer_;
+    bool stop_, closed_;
+    int err_; // errno of the first failed write
+
+    void submit();
+    void compress_loop();
+    void write_loop();
+public:
+    // level < 0 uses the format's default.
+    ParallelCompressor(int fd, int format, unsigned nthreads, int level=-1);
+    ParallelCompressor(const ParallelCompressor &other) = delete;
+    ParallelCompressor &operator=(const ParallelCompressor &other) = delete;
+    ~ParallelCompressor();
+    void write(const void *s, size_t l);
+    // Writes everything (and, for gzip, the BGZF end-of-file marker) and stops the threads.
+    // Returns false, with errno set, if writing failed. Later writes are dropped.
+    bool close();
+};
+
+} // namespace emp
+
+#endif // #ifndef _COMPRESS_H__
@@ -1,17 +1,85 @@
 #ifndef _DATABASE_H__
 #define _DATABASE_H__
 
+#include "bloom.h"
+#include "compact.h"
 #include "encoder.h"
+#include "placement.h"
 #include "util.h"
+#include <cerrno>
 #include <cinttypes>
+#include <cstring>
 #include <forward_list>
 #include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #define __fr(item, fp) std::fread(&(item), 1, sizeof(item), fp)
 #define __fw(item, fp) std::fwrite(&(item), 1, sizeof(item), fp)
 
 namespace emp {
 
+/*
+ * Memory-mappable database layout.
+ * A single header page is followed by sections, each starting on a DB_ALIGNMENT boundary,
+ * so the file can be mmap'd read-only and the hash table queried in place.
+ * Legacy databases start with k (a small integer), so they can never match DB_MAGIC.
+ */
+static constexpr u64 DB_MAGIC        = 0x42444941534E4F42ull; // "BONSAIDB"
+static constexpr u32 DB_VERSION      = 1;
+static constexpr u64 DB_ALIGNMENT    = 4096;
+static constexpr u32 DB_MAX_SECTIONS = 16;
+static constexpr u32 DB_MAX_SPACING  = 64;
+static constexpr int SCHEME_UNKNOWN  = -1; // Legacy databases do not record their score scheme.
+
+enum db_section_type: u32 {
+    DB_SECTION_NONE  = 0,
+    DB_SECTION_FLAGS = 1,
+    DB_SECTION_KEYS  = 2,
+    DB_SECTION_VALS  = 3,
+    DB_SECTION_COMPACT_META  = 4,
+    DB_SECTION_COMPACT_CELLS = 5,
+    DB_SECTION_COMPACT_TAXA  = 6,
+    DB_SECTION_BLOOM_META    = 7,
+    DB_SECTION_BLOOM_WORDS   = 8,
+};
+
+struct db_section_t {
+    u32 type_;   // db_section_type
+    u32 elsz_;   // sizeof one element, checked at load time
+    u64 offset_; // from the start of the file, multiple of DB_ALIGNMENT
+    u64 size_;   // in bytes
+};
+
+struct db_header_t {
+    u64 magic_;
+    u32 version_;
+    u32 k_, w_, scheme_;
+    u64 n_buckets_, size_, n_occupied_, upper_bound_;
+    u32 nsections_, pad_;
+    db_section_t sections_[DB_MAX_SECTIONS];
+    u8  spacing_[DB_MAX_SPACING];
+
+    const db_section_t *find(u32 type) const {
+        for(u32 i(0); i < nsections_; ++i) if(sections_[i].type_ == type) return sections_ + i;
+        return nullptr;
+    }
+};
+static_assert(sizeof(db_header_t) <= DB_ALIGNMENT, "Database header must fit in its page.");
+
+INLINE u64 db_align(u64 offset) {return (offset + DB_ALIGNMENT - 1) & ~(DB_ALIGNMENT - 1);}
+
+inline bool db_is_mapped(const char *fn) {
+    u64 magic(0);
+    std::FILE *fp(std::fopen(fn, "rb"));
+    if(!fp) return false;
+    const bool ret(std::fread(&magic, sizeof(magic), 1, fp) == 1 && magic == DB_MAGIC);
+    std::fclose(fp);
+    return ret;
+}
+
 
 template <typename T>
 struct Database {
@@ -21,6 +89,21 @@ struct Database {
     int      owns_hash_;
     spvec_t  s_;
     Spacer  *sp_;
+    int      scheme_;   // score_scheme used to build the database, or SCHEME_UNKNOWN
+    CompactTable *ct_;  // If set, the database is a compact table instead of (or in addition to) db_.
+    BlockedBloom *bf_;  // Optional prefilter over the keys of db_ or ct_.
+    void    *map_;      // non-null if db_ points into a read-only mapping
+    size_t   map_size_;
+    size_t   map_len_;  // Length of map_: map_size_ rounded up to its page size.
+    // Copies of the tables on NUMA nodes 1, 2, ..., if the database was replicated. map_ is on node 0.
+    struct replica_t {
+        void         *map_;
+        size_t        len_;
+        T            *db_;
+        CompactTable *ct_;
+        BlockedBloom *bf_;
+    };
+    std::vector<replica_t> replicas_;
 
     Spacer *make_sp() {
         Spacer *ret(new Spacer(k_, (uint16_t)w_, s_));
@@ -28,7 +111,18 @@ struct Database {
         return ret;
     }
 
-    Database(const char *fn): owns_hash_(1), sp_(nullptr) {
+    // Prefilters are only loaded if load_bloom is set.
+    // Placements other than the default only apply to mapped databases.
+    Database(const char *fn, bool load_bloom=true, const placement_t &placement=placement_t()):
+        db_(nullptr), owns_hash_(1), sp_(nullptr), scheme_(score_scheme::LEX), ct_(nullptr), bf_(nullptr), map_(nullptr), map_size_(0), map_len_(0)
+    {
+        if(db_is_mapped(fn)) {
+            load_mapped(fn, load_bloom, placement);
+            sp_ = make_sp();
+            return;
+        }
+        if(placement.copies())
+            LOG_WARNING("%s is not in the mapped format, so it is loaded without huge pages or NUMA placement.\n", fn);
         std::FILE *fp(std::fopen(fn, "rb"));
         if (fp) {
             __fr(k_, fp);
@@ -41,6 +135,7 @@ struct Database {
             for(auto i: s_) fprintf(stderr, "Value in vector is %u\n", (unsigned)i);
     #endif
             db_ = khash_load_impl<T>(fp);
+            scheme_ = SCHEME_UNKNOWN;
         } else LOG_EXIT("Could not open %s for reading.\n", fn);
         sp_ = make_sp();
         assert(sp_);
@@ -48,7 +143,8 @@ struct Database {
         std::fclose(fp);
     }
     Database(unsigned k, unsigned w, const spvec_t &s, unsigned owns=1, T *db=nullptr):
-        k_(k), w_(w), db_(db), owns_hash_(owns), s_(s), sp_(make_sp())
+        k_(k), w_(w), db_(db), owns_hash_(owns), s_(s), sp_(make_sp()),
+        scheme_(score_scheme::LEX), ct_(nullptr), bf_(nullptr), map_(nullptr), map_size_(0), map_len_(0)
     {
     }
     Database(Spacer sp, unsigned owns=1, T *db=nullptr):
@@ -63,23 +159,200 @@ struct Database {
         db_(nullptr),
         owns_hash_(owns),
         s_(other.s_),
-        sp_(make_sp())
+        sp_(make_sp()),
+        scheme_(other.scheme_),
+        ct_(nullptr),
+        bf_(nullptr),
+        map_(nullptr),
+        map_size_(0),
+        map_len_(0)
     {
     }
 
     ~Database() {
-        if(owns_hash_) khash_destroy(db_);
+        delete ct_;
+        delete bf_;
+        for(auto &replica: replicas_) {
+            std::free(replica.db_);
+            delete replica.ct_;
+            delete replica.bf_;
+            ::munmap(replica.map_, replica.len_);
+        }
+        if(map_) {
+            std::free(db_); // Only the table struct is ours; its arrays live in the mapping.
+            ::munmap(map_, map_len_);
+        } else if(owns_hash_ && db_) khash_destroy(db_);
         if(sp_)        delete sp_;
     }
-    void write(const char *fn) {
+    // The window to classify with: w_ if the database holds minimizers classify can reproduce (lexicographic or
+    // entropy-scored ones), and otherwise k_, so that every k-mer is looked up.
+    unsigned lookup_window() const {
+        if(w_ <= k_) return k_;
+        if(scheme_ == score_scheme::LEX || scheme_ == score_scheme::ENTROPY) return w_;
+        if(scheme_ == SCHEME_UNKNOWN)
+            LOG_WARNING("Database is in the legacy format, which does not record how it was minimized. Looking up all k-mers.\n");
+        else
+            LOG_WARNING("Database was minimized with score scheme %i, which classify cannot reproduce. Looking up all k-mers.\n", scheme_);
+        return k_;
+    }
+    // Replace the khash with a compact table, which is all that gets written afterwards.
+    void make_compact(const FlatTaxonomy &tax, double load=CompactTable::DEFAULT_LOAD, u32 extra_vbits=0) {
+        if(map_) LOG_EXIT("Cannot convert a mapped database.\n");
+        delete ct_;
+        ct_ = new CompactTable(db_, tax, load, extra_vbits);
+        if(owns_hash_) khash_destroy(db_);
+        db_ = nullptr;
+    }
+    // Build a prefilter over the keys of db_. Call before make_compact, which discards them.
+    void make_bloom(double bits_per_key=BlockedBloom::DEFAULT_BITS_PER_KEY) {
+        if(db_ == nullptr) LOG_EXIT("Need the hash table to build a Bloom filter.\n");
+        delete bf_;
+        bf_ = new BlockedBloom(kh_size(db_), bits_per_key);
+        for(khiter_t ki(0); ki != kh_end(db_); ++ki)
+            if(kh_exist(db_, ki)) bf_->insert(kh_key(db_, ki));
+        LOG_INFO("Bloom filter: %zu bytes for %zu keys, %u hashes.\n", size_t(bf_->bytes()), size_t(kh_size(db_)), bf_->m_.nhashes_);
+    }
+    bool is_mapped() const {return map_ != nullptr;}
+    const db_header_t &header() const {return *static_cast<const db_header_t *>(map_);}
+
+    // Sections are found through the header at map_, but may be taken from a copy of the mapping at base.
+    template<typename P>
+    P *section(u32 type, u64 nelem, void *base=nullptr) const {
+        const db_section_t *sec(header().find(type));
+        if(sec == nullptr) LOG_EXIT("Database is missing section %u.\n", type);
+        if(sec->elsz_ != sizeof(P) || sec->size_ != nelem * sizeof(P) || sec->offset_ + sec->size_ > map_size_)
+            LOG_EXIT("Malformed section %u in database (elsz %u, size %" PRIu64 ", offset %" PRIu64 ", file size %zu).\n",
+                     type, sec->elsz_, sec->size_, sec->offset_, map_size_);
+        return reinterpret_cast<P *>(static_cast<char *>(base ? base: map_) + sec->offset_);
+    }
+
+    // The table is read-only: kh_put or kh_del on a mapped database will fault.
+    // Unless placement is the default, the file is read into anonymous memory laid out as placement says.
+    void load_mapped(const char *fn, bool load_bloom=true, const placement_t &placement=placement_t()) {
+        int fd(::open(fn, O_RDONLY));
+        if(fd < 0) LOG_EXIT("Could not open %s for reading.\n", fn);
+        struct stat st;
+        if(::fstat(fd, &st)) LOG_EXIT("Could not stat %s.\n", fn);
+        if((map_size_ = st.st_size) < sizeof(db_header_t)) LOG_EXIT("Database %s is truncated.\n", fn);
+        if(placement.copies()) {
+            place(fd, fn, placement);
+        } else {
+            if((map_ = ::mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED)
+                LOG_EXIT("Could not mmap %s (%zu bytes).\n", fn, map_size_);
+            map_len_ = map_size_;
+        }
+        ::close(fd);
+        const db_header_t &h(header());
+        if(h.version_ > DB_VERSION) LOG_EXIT("Database %s has version %u, but only versions <= %u are supported.\n", fn, h.version_, DB_VERSION);
+        if(h.k_ - 1 > DB_MAX_SPACING) LOG_EXIT("Invalid k (%u) in database header.\n", h.k_);
+        k_ = h.k_; w_ = h.w_; scheme_ = h.scheme_;
+        s_ = spvec_t(h.spacing_, h.spacing_ + k_ - 1);
+        attach(map_, load_bloom, db_, ct_, bf_);
+        for(auto &replica: replicas_) attach(replica.map_, load_bloom, replica.db_, replica.ct_, replica.bf_);
+        if(!db_ && !ct_) LOG_EXIT("Database %s contains no table.\n", fn);
+        LOG_DEBUG("Mapped database %s of %zu bytes with %zu entries.\n", fn, map_size_, size_t(h.size_));
+    }
+    // Points tables at the sections of the mapping (or copy of it) at base.
+    void attach(void *base, bool load_bloom, T *&db, CompactTable *&ct, BlockedBloom *&bf) {
+        const db_header_t &h(header());
+        if(h.find(DB_SECTION_FLAGS)) {
+            using keytype_t = std::remove_pointer_t<decltype(db->keys)>;
+            using valtype_t = std::remove_pointer_t<decltype(db->vals)>;
+            db = static_cast<T *>(std::calloc(1, sizeof(T)));
+            db->n_buckets   = h.n_buckets_;
+            db->size        = h.size_;
+            db->n_occupied  = h.n_occupied_;
+            db->upper_bound = h.upper_bound_;
+            db->flags = section<khint32_t>(DB_SECTION_FLAGS, __ac_fsize(h.n_buckets_), base);
+            db->keys  = section<keytype_t>(DB_SECTION_KEYS, h.n_buckets_, base);
+            db->vals  = section<valtype_t>(DB_SECTION_VALS, h.n_buckets_, base);
+        }
+        if(h.find(DB_SECTION_COMPACT_META)) {
+            const compact_meta_t &meta(*section<compact_meta_t>(DB_SECTION_COMPACT_META, 1, base));
+            ct = new CompactTable(meta, section<u32>(DB_SECTION_COMPACT_CELLS, meta.ncells_, base),
+                                        section<tax_t>(DB_SECTION_COMPACT_TAXA, meta.ntaxa_, base));
+        }
+        if(load_bloom && h.find(DB_SECTION_BLOOM_META)) {
+            const bloom_meta_t &meta(*section<bloom_meta_t>(DB_SECTION_BLOOM_META, 1, base));
+            bf = new BlockedBloom(meta, section<u64>(DB_SECTION_BLOOM_WORDS, meta.nblocks_ * BlockedBloom::BLOCK_WORDS, base));
+        }
+    }
+    // Reads the file into placed memory, then copies it to each further node if replicating.
+    void place(int fd, const char *fn, const placement_t &placement) {
+        const bool replicate(placement.numa_ == NUMA_REPLICATE);
+        map_ = map_placed(map_size_, placement, replicate ? 0: -1, map_len_);
+        for(size_t off(0); off < map_size_;) {
+            const ssize_t rc(::pread(fd, static_cast<char *>(map_) + off, map_size_ - off, off));
+            if(rc < 0 && errno == EINTR) continue;
+            if(rc <= 0) LOG_EXIT("Could not read %s: %s\n", fn, rc ? std::strerror(errno): "unexpected end of file");
+            off += rc;
+        }
+        if(replicate) {
+            for(unsigned node(1); node < numa_nodes(); ++node) {
+                size_t len;
+                void *copy(map_placed(map_size_, placement, node, len));
+                std::memcpy(copy, map_, map_size_);
+                ::mprotect(copy, len, PROT_READ);
+                replicas_.push_back(replica_t{copy, len, nullptr, nullptr, nullptr});
+            }
+            LOG_INFO("Replicated %zu-byte database on %u NUMA nodes.\n", map_size_, numa_nodes());
+        }
+        ::mprotect(map_, map_len_, PROT_READ);
+    }
+
+    void write_mapped(const char *fn) {
+        static const char zeros[DB_ALIGNMENT] {};
+        if(db_)
+            for(khiter_t ki(0); ki != kh_end(db_); ++ki)
+                if(!kh_exist(db_, ki))
+                    kh_key(db_, ki) = 0, kh_val(db_, ki) = 0;
+        if(s_.size() > DB_MAX_SPACING) LOG_EXIT("Spacing of length %zu is too long for the mapped format.\n", s_.size());
+        db_header_t h;
+        std::memset(&h, 0, sizeof(h));
+        h.magic_ = DB_MAGIC, h.version_ = DB_VERSION;
+        h.k_ = k_, h.w_ = w_, h.scheme_ = scheme_;
+        if(db_) h.n_buckets_ = db_->n_buckets, h.size_ = db_->size, h.n_occupied_ = db_->n_occupied, h.upper_bound_ = db_->upper_bound;
+        std::copy(s_.begin(), s_.end(), h.spacing_);
+        const void *data[DB_MAX_SECTIONS];
+        u64 offset(DB_ALIGNMENT);
+        auto add_section = [&](u32 type, u32 elsz, u64 nelem, const void *ptr) {
+            data[h.nsections_] = ptr;
+            h.sections_[h.nsections_++] = db_section_t{type, elsz, offset, elsz * nelem};
+            offset = db_align(offset + elsz * nelem);
+        };
+        if(db_) {
+            add_section(DB_SECTION_FLAGS, sizeof(*db_->flags), __ac_fsize(db_->n_buckets), db_->flags);
+            add_section(DB_SECTION_KEYS,  sizeof(*db_->keys),  db_->n_buckets, db_->keys);
+            add_section(DB_SECTION_VALS,  sizeof(*db_->vals),  db_->n_buckets, db_->vals);
+        }
+        if(ct_) {
+            add_section(DB_SECTION_COMPACT_META,  sizeof(ct_->m_),      1,               &ct_->m_);
+            add_section(DB_SECTION_COMPACT_CELLS, sizeof(*ct_->cells_), ct_->m_.ncells_, ct_->cells_);
+            add_section(DB_SECTION_COMPACT_TAXA,  sizeof(*ct_->taxa_),  ct_->m_.ntaxa_,  ct_->taxa_);
+        }
+        if(bf_) {
+            add_section(DB_SECTION_BLOOM_META,  sizeof(bf_->m_),      1,              &bf_->m_);
+            add_section(DB_SECTION_BLOOM_WORDS, sizeof(*bf_->words_), bf_->nwords(), bf_->words_);
+        }
         std::FILE *ofp(std::fopen(fn, "wb"));
-        if(!ofp) LOG_EXIT("Could not open %s for reading.\n", fn);
-        __fw(k_, ofp);
-        __fw(w_, ofp);
-        std::fwrite(s_.data(), s_.size(), sizeof(uint8_t), ofp);
-        khash_write_impl<T>(db_, ofp);
+        if(!ofp) LOG_EXIT("Could not open %s for writing.\n", fn);
+        std::fwrite(&h, 1, sizeof(h), ofp);
+        u64 written(sizeof(h));
+        for(u32 i(0); i < h.nsections_; ++i) {
+            const db_section_t &sec(h.sections_[i]);
+            std::fwrite(zeros, 1, sec.offset_ - written, ofp);
+            if(std::fwrite(data[i], 1, sec.size_, ofp) != sec.size_) LOG_EXIT("Failed to write section %u to %s.\n", sec.type_, fn);
+            written = sec.offset_ + sec.size_;
+        }
         std::fclose(ofp);
+    }
+
+    // Compact tables and Bloom filters can only be stored in the mapped format.
+    void write(const char *fn, bool mapped=false) {
+        if(mapped || ct_ || bf_) write_mapped(fn);
+        else              write_legacy(fn);
 #if !NDEBUG
+        if(!db_) return;
         Database<T> test(fn);
         assert(kh_size(test.db_) == kh_size(db_));
         size_t ndiff(0);
@@ -95,6 +368,15 @@ struct Database {
         }
 #endif
     }
+    void write_legacy(const char *fn) {
+        std::FILE *ofp(std::fopen(fn, "wb"));
+        if(!ofp) LOG_EXIT("Could not open %s for reading.\n", fn);
+        __fw(k_, ofp);
+        __fw(w_, ofp);
+        std::fwrite(s_.data(), s_.size(), sizeof(uint8_t), ofp);
+        khash_write_impl<T>(db_, ofp);
+        std::fclose(ofp);
+    }
 
     template<typename Q=T>
     typename std::enable_if_t<std::is_same_v<khash_t(c), Q>, u32>
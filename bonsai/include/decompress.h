@@ -0,0 +1,53 @@
+#ifndef _DECOMPRESS_H__
+#define _DECOMPRESS_H__
+#include "util.h"
+#include <atomic>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace emp {
+
+/*
+ * Decodes an input file off the parsing thread and hands the result to the kseq-based parsers.
+ * BGZF files (and, in the _z build, multi-frame zstd files) are split at member/frame boundaries
+ * and inflated by nthreads threads in batches. Everything else (plain gzip, uncompressed, pipes)
+ * is decoded by a single thread reading ahead of the parser.
+ * Decoded data is written to a pipe whose read end is gzdopen'd, and gzread passes it through untouched,
+ * so fp() can be used wherever a gzFile from gzopen could.
+ * With nthreads == 0, fp() is just gzopen(path) and no threads are started. A null path opens nothing.
+ * If the input turns out to be corrupt, decoding stops there: fp() reaches EOF early and error() says why.
+ * The constructor throws std::runtime_error if it cannot set up the pipe, e.g. when out of file descriptors.
+ */
+class ParallelDecompressor {
+    static constexpr size_t BATCH_BYTES_PER_THREAD = 1 << 20;
+    static constexpr int    PIPE_SIZE              = 1 << 20;
+
+    std::string       path_;
+    unsigned          nthreads_;
+    gzFile            fp_;
+    int               wfd_;
+    std::atomic<bool> stop_;
+    std::atomic<bool> failed_;
+    std::string       error_; // Set by the producer before failed_
+    std::thread       producer_;
+
+    void produce();
+    void stream_from(size_t offset);
+    bool write_all(const char *s, size_t l);
+    void fail(std::string msg);
+public:
+    ParallelDecompressor(const char *path, unsigned nthreads);
+    ParallelDecompressor(const ParallelDecompressor &other) = delete;
+    ParallelDecompressor &operator=(const ParallelDecompressor &other) = delete;
+    ~ParallelDecompressor();
+    // nullptr if the file could not be opened, as with gzopen.
+    gzFile fp() const {return fp_;}
+    operator bool() const {return fp_ != nullptr;}
+    // Why decoding stopped short, or nullptr if it has not. Only final once fp() has reached EOF.
+    const char *error() const {return failed_ ? error_.data(): nullptr;}
+};
+
+} // namespace emp
+
+#endif // #ifndef _DECOMPRESS_H__
@@ -6,6 +6,7 @@
 #include "database.h"
 #include "bitmap.h"
 #include "setcmp.h"
+#include "compress.h"
 #include "klib/kthread.h"
 #include <sstream>
 
@@ -8,9 +8,13 @@
 #include "klib/kstring.h"
 #include "hash.h"
 #include "hll/hll.h"
+#include "decompress.h"
 #include "entropy.h"
 #include "kseq_declare.h"
+#include "pack.h"
 #include "qmap.h"
+#include "rolling.h"
+#include "seqscan.h"
 #include "spacer.h"
 #include "util.h"
 #include "klib/kthread.h"
@@ -84,6 +88,10 @@ private:
     qmap_t     qmap_; // queue of max scores and std::map which keeps kmers, scores, and counts so that we can select the top kmer for a window.
     const ScoreType  scorer_; // scoring struct
     bool canonicalize_;
+    PackedSeq packed_; // s_, 2 bits per base, with a mask of ambiguous bases.
+    u64        rpos_; // Next base to add to the rolling windows.
+    RollingKmer<u64>         roll64_;  // For combs of up to 32 bases
+    RollingKmer<__uint128_t> roll128_; // and up to 64 bases.
 
 public:
     Encoder(char *s, u64 l, const Spacer &sp, void *data=nullptr,
@@ -95,24 +103,34 @@ public:
       data_(data),
       qmap_(sp_.w_ - sp_.c_ + 1),
       scorer_{},
-      canonicalize_(canonicalize) {
+      canonicalize_(canonicalize),
+      rpos_(0),
+      roll64_(sp_),
+      roll128_(sp_) {
         LOG_DEBUG("Canonicalizing: %s\n", canonicalize_ ? "True": "False");
-        if(std::is_same_v<ScoreType, score::Entropy> && sp_.unspaced() && !sp_.unwindowed()) {
+        if(owns_data(sp_)) {
             if(data_) throw std::runtime_error("No data pointer must be provided for lex::Entropy minimization.");
             data_ = static_cast<void *>(new CircusEnt(sp_.k_));
         }
+        if(s_) packed_.assign(s_, l_);
     }
     Encoder(const Spacer &sp, void *data, bool canonicalize=true): Encoder(nullptr, 0, sp, data, canonicalize) {}
     Encoder(const Spacer &sp, bool canonicalize=true): Encoder(sp, nullptr, canonicalize) {}
-    Encoder(const Encoder &other): Encoder(other.sp_, other.data_) {}
+    // The windowed, unspaced entropy encoder owns its CircusEnt, so a copy needs its own.
+    Encoder(const Encoder &other): Encoder(other.sp_, owns_data(other.sp_) ? nullptr: other.data_, other.canonicalize_) {}
+    static bool owns_data(const Spacer &sp) {
+        return std::is_same_v<ScoreType, score::Entropy> && sp.unspaced() && !sp.unwindowed();
+    }
     Encoder(unsigned k, bool canonicalize=true): Encoder(nullptr, 0, Spacer(k), nullptr, canonicalize) {}
 
     // Assign functions: These tell the encoder to fetch kmers from this string.
     // kstring and kseq are overloads which call assign(char *s, u64 l) on
     // the correct portions of the structs.
     INLINE void assign(const char *s, u64 l) {
-        s_ = s; l_ = l; pos_ = 0;
+        s_ = s; l_ = l; pos_ = rpos_ = 0;
+        packed_.assign(s, l);
         qmap_.reset();
+        roll64_.reset(), roll128_.reset();
         assert((l_ >= sp_.c_ || (!has_next_kmer())) || std::fprintf(stderr, "l: %zu. c: %zu. pos: %zu\n", size_t(l), size_t(sp_.c_), size_t(pos_)) == 0);
     }
     INLINE void assign(kstring_t *ks) {assign(ks->s, ks->l);}
@@ -121,6 +139,12 @@ public:
     template<typename Functor>
     INLINE void for_each_canon_windowed(const Functor &func) {
         u64 min(BF);
+        if(sp_.w_ == sp_.c_) {
+            // A window of one k-mer (e.g., a spaced seed without a window) needs no queue.
+            // Ambiguous k-mers come out as 0, as they did through the queue.
+            while(likely(has_next_kmer())) func((min = rolling_kmer<true>()) == BF ? 0: min);
+            return;
+        }
         while(likely(has_next_kmer()))
             if((min = next_canonicalized_minimizer()) != BF)
                 func(min);
@@ -128,19 +152,45 @@ public:
     template<typename Functor>
     INLINE void for_each_canon_unwindowed(const Functor &func) {
         if(sp_.unspaced()) {
-            for_each_uncanon_unspaced_unwindowed([&](u64 min) {
-                return func(canonical_representation(min, sp_.k_));
-            });
+            for_each_canon_unspaced_unwindowed(func);
         } else {
             u64 min;
             while(likely(has_next_kmer()))
-                if((min = next_kmer()) != BF)
-                    func(canonical_representation(min, sp_.k_));
+                if((min = next_canonical_kmer()) != BF)
+                    func(min);
+        }
+    }
+    template<typename Functor>
+    INLINE void for_each_canon_unspaced_unwindowed(const Functor &func) {
+        // for_each_uncanon_unspaced_unwindowed, rolling the reverse complement along instead of recomputing it.
+        const u64 mask((UINT64_C(-1)) >> (64 - (sp_.k_ << 1)));
+        const unsigned rshift((sp_.k_ - 1) << 1);
+        u64 min, rev, base;
+        while(likely(pos_ < l_)) {
+            // Unambiguous bases run up to end, so only count how many are in the k-mer.
+            const u64 end(packed_.next_ambiguous(pos_));
+            min = rev = 0;
+            for(unsigned filled(0); pos_ < end; ++pos_) {
+                base = packed_.base(pos_);
+                min = (min << 2) | base;
+                rev = (rev >> 2) | ((3 - base) << rshift);
+                if(++filled >= sp_.k_) {
+                    min &= mask;
+                    func(min < rev ? min: rev);
+                }
+            }
+            pos_ = packed_.next_unambiguous(end);
         }
     }
     template<typename Functor>
     INLINE void for_each_uncanon_spaced(const Functor &func) {
         u64 min;
+        if(sp_.w_ == sp_.c_) {
+            while(likely(has_next_kmer()))
+                if((min = rolling_kmer<false>()) != BF)
+                    func(min);
+            return;
+        }
         while(likely(has_next_kmer()))
             if((min = next_minimizer()) != BF)
                 func(min);
@@ -148,48 +198,33 @@ public:
     template<typename Functor>
     INLINE void for_each_uncanon_unspaced_unwindowed(const Functor &func) {
         const u64 mask((UINT64_C(-1)) >> (64 - (sp_.k_ << 1)));
-        u64 min = 0;
-        unsigned filled = 0;
-        loop_start:
+        u64 min;
         while(likely(pos_ < l_)) {
-            while(filled < sp_.k_ && likely(pos_ < l_)) {
-                min <<= 2;
-                //std::fprintf(stderr, "Encoding character %c with value %u at last position.\n", s_[pos_], (unsigned)cstr_lut[s_[pos_]]);
-                if(unlikely((min |= cstr_lut[s_[pos_++]]) == BF) && (sp_.k_ < 31 || cstr_lut[s_[pos_ - 1]] != 'T')) {
-                    filled = min = 0;
-                    goto loop_start;
-                }
-                ++filled;
-            }
-            if(likely(filled == sp_.k_)) {
-                min &= mask;
-                func(min);
-                --filled;
+            // Encode the stretch up to the next ambiguous base, then jump over the whole run of them.
+            const u64 end(packed_.next_ambiguous(pos_));
+            min = 0;
+            for(unsigned filled(0); pos_ < end; ++pos_) {
+                min = (min << 2) | packed_.base(pos_);
+                if(++filled >= sp_.k_) func(min & mask);
             }
+            pos_ = packed_.next_unambiguous(end);
         }
     }
     template<typename Functor>
     INLINE void for_each_uncanon_unspaced_windowed(const Functor &func) {
         const u64 mask((UINT64_C(-1)) >> (64 - (sp_.k_ << 1)));
-        u64 min = 0;
-        unsigned filled = 0;
-        u64 kmer, score;
-        windowed_loop_start:
+        u64 min, kmer, score;
         while(likely(pos_ < l_)) {
-            while(filled < sp_.k_ && likely(pos_ < l_)) {
-                min <<= 2;
-                if(unlikely((min |= cstr_lut[s_[pos_++]]) == BF) && likely(sp_.k_ < 31 || cstr_lut[s_[pos_ - 1]] != 'T')) {
-                    filled = min = 0;
-                    goto windowed_loop_start;
+            const u64 end(packed_.next_ambiguous(pos_));
+            min = 0;
+            for(unsigned filled(0); pos_ < end; ++pos_) {
+                min = ((min << 2) | packed_.base(pos_)) & mask;
+                if(++filled >= sp_.k_) {
+                    score = scorer_(min, data_);
+                    if((kmer = qmap_.next_value(min, score)) != BF) func(kmer);
                 }
-                ++filled;
-            }
-            if(likely(filled == sp_.k_)) {
-                min &= mask;
-                score = scorer_(min, data_);
-                if((kmer = qmap_.next_value(min, score)) != BF) func(kmer);
-                --filled;
             }
+            pos_ = packed_.next_unambiguous(end);
         }
     }
     template<typename Functor>
@@ -205,11 +240,12 @@ public:
         while(likely(pos_ < l_)) {
             while(filled < sp_.k_ && likely(pos_ < l_)) {
                 min <<= 2;
-                if(unlikely((min |= cstr_lut[s_[pos_]]) == BF) && likely(sp_.k_ < 31 || cstr_lut[s_[pos_]] != 'T')) {
+                if(unlikely(cstr_lut[s_[pos_]] < 0)) {
                     ++pos_;
                     filled = min = 0;
                     goto windowed_loop_start;
                 }
+                min |= cstr_lut[s_[pos_]];
                 ent.push(s_[pos_]);
                 ++pos_;
                 ++filled;
@@ -256,6 +292,20 @@ public:
             } else for_each_uncanon_spaced(func);
         }
     }
+    // The stream for_each_canon/for_each_uncanon produce for a single sequence, as databases are built with them
+    // (add() through for_each(func, path)). Unlike for_each(func, str, l), this never takes the entropy-only
+    // *_unspaced_windowed_entropy_ paths, so it picks the minimizers a database was built with for either score.
+    template<typename Functor>
+    INLINE void for_each_seq(const Functor &func, const char *str, u64 l) {
+        assign(str, l);
+        if(canonicalize_) {
+            if(sp_.unwindowed()) for_each_canon_unwindowed(func);
+            else                 for_each_canon_windowed(func);
+        } else if(sp_.unspaced()) {
+            if(sp_.unwindowed()) for_each_uncanon_unspaced_unwindowed(func);
+            else                 for_each_uncanon_unspaced_windowed(func);
+        } else for_each_uncanon_spaced(func);
+    }
     template<typename Functor>
     INLINE void for_each(const Functor &func, kseq_t *ks) {
         while(kseq_read(ks) >= 0) assign(ks), for_each<Functor>(func, ks->seq.s, ks->seq.l);
@@ -275,94 +325,106 @@ public:
         } else while(kseq_read(ks) >= 0) assign(ks), for_each_uncanon_spaced(func);
     }
     template<typename Functor>
-    void for_each_canon(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
-        bool destroy;
-        if(ks == nullptr) {
-            ks = kseq_init(fp);
-            destroy = true;
-        } else {
-            kseq_assign(ks, fp);
-            destroy = false;
-        }
-        LOG_DEBUG("Destroy is %s. I have just assigned kseq's f->f field to the pointer %p\n", destroy ? "true": "false", fp);
-        for_each_canon<Functor>(func, ks);
-        if(destroy) kseq_destroy(ks);
+    INLINE void for_each_canon(const Functor &func, SeqScanner &ss) {
+        seq_record_t rec;
+        if(sp_.unwindowed())
+            while(ss.next(rec)) assign(rec.seq_, rec.l_seq_), for_each_canon_unwindowed<Functor>(func);
+        else
+            while(ss.next(rec)) assign(rec.seq_, rec.l_seq_), for_each_canon_windowed<Functor>(func);
     }
     template<typename Functor>
-    void for_each_uncanon(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
-        bool destroy;
-        if(ks == nullptr) {
-            ks = kseq_init(fp);
-            destroy = true;
-        } else {
-            kseq_assign(ks, fp);
-            destroy = false;
-        }
-        for_each_uncanon<Functor>(func, ks);
-        if(destroy) kseq_destroy(ks);
+    INLINE void for_each_uncanon(const Functor &func, SeqScanner &ss) {
+        seq_record_t rec;
+        if(sp_.unspaced()) {
+            if(sp_.unwindowed()) while(ss.next(rec)) assign(rec.seq_, rec.l_seq_), for_each_uncanon_unspaced_unwindowed(func);
+            else                 while(ss.next(rec)) assign(rec.seq_, rec.l_seq_), for_each_uncanon_unspaced_windowed(func);
+        } else while(ss.next(rec)) assign(rec.seq_, rec.l_seq_), for_each_uncanon_spaced(func);
     }
     template<typename Functor>
-    void for_each_canon(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        for_each_canon<Functor>(func, fp, ks);
-        gzclose(fp);
+    INLINE void for_each(const Functor &func, SeqScanner &ss) {
+        if(canonicalize_) for_each_canon<Functor>(func, ss);
+        else              for_each_uncanon<Functor>(func, ss);
     }
+    // Files are parsed by SeqScanner. Passing one in reuses its buffer.
+    // Input which fails to read or decode throws rather than passing for the end of the file.
     template<typename Functor>
-    void for_each_uncanon(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        for_each_uncanon<Functor>(func, fp, ks);
-        gzclose(fp);
+    void for_each_canon(const Functor &func, gzFile fp, SeqScanner *ss=nullptr) {
+        SeqScanner local;
+        if(ss == nullptr) ss = &local;
+        ss->assign(fp);
+        for_each_canon<Functor>(func, *ss);
+        check_read(*ss);
     }
     template<typename Functor>
-    void for_each(const Functor &func, gzFile fp, kseq_t *ks=nullptr) {
-        bool destroy;
-        if(ks == nullptr) {
-            ks = kseq_init(fp);
-            destroy = true;
-        } else {
-            kseq_assign(ks, fp);
-            destroy = false;
-        }
-        if(canonicalize_) for_each_canon<Functor>(func, ks);
-        else              for_each_uncanon<Functor>(func, ks);
-        if(destroy) kseq_destroy(ks);
+    void for_each_uncanon(const Functor &func, gzFile fp, SeqScanner *ss=nullptr) {
+        SeqScanner local;
+        if(ss == nullptr) ss = &local;
+        ss->assign(fp);
+        for_each_uncanon<Functor>(func, *ss);
+        check_read(*ss);
+    }
+    static void check_read(SeqScanner &ss) {
+        const std::string err(ss.error() ? ss.error(): "");
+        ss.assign(nullptr);
+        if(err.size()) throw std::runtime_error(ks::sprintf("Could not read input: %s. Abort!\n", err.data()).data());
+    }
+    static void check_read(const ParallelDecompressor &in) {
+        if(in.error()) throw std::runtime_error(ks::sprintf("%s. Abort!\n", in.error()).data());
+    }
+    template<typename Functor>
+    void for_each_canon(const Functor &func, const char *path, SeqScanner *ss=nullptr, unsigned dthreads=0) {
+        ParallelDecompressor in(path, dthreads);
+        if(!in) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
+        for_each_canon<Functor>(func, in.fp(), ss);
+        check_read(in);
+    }
+    template<typename Functor>
+    void for_each_uncanon(const Functor &func, const char *path, SeqScanner *ss=nullptr, unsigned dthreads=0) {
+        ParallelDecompressor in(path, dthreads);
+        if(!in) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
+        for_each_uncanon<Functor>(func, in.fp(), ss);
+        check_read(in);
     }
     template<typename Functor>
-    void for_each(const Functor &func, const char *path, kseq_t *ks=nullptr) {
-        gzFile fp(gzopen(path, "rb"));
-        if(!fp) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
-        if(canonicalize_) for_each_canon<Functor>(func, fp, ks);
-        else              for_each_uncanon<Functor>(func, fp, ks);
-        gzclose(fp);
+    void for_each(const Functor &func, gzFile fp, SeqScanner *ss=nullptr) {
+        if(canonicalize_) for_each_canon<Functor>(func, fp, ss);
+        else              for_each_uncanon<Functor>(func, fp, ss);
+    }
+    // dthreads > 0 decodes the file in other threads (see ParallelDecompressor).
+    template<typename Functor>
+    void for_each(const Functor &func, const char *path, SeqScanner *ss=nullptr, unsigned dthreads=0) {
+        ParallelDecompressor in(path, dthreads);
+        if(!in) throw std::runtime_error(ks::sprintf("Could not open file at %s. Abort!\n", path).data());
+        if(canonicalize_) for_each_canon<Functor>(func, in.fp(), ss);
+        else              for_each_uncanon<Functor>(func, in.fp(), ss);
+        check_read(in);
     }
     template<typename Functor, typename ContainerType,
              typename=std::enable_if_t<std::is_same_v<typename ContainerType::value_type::value_type, char> ||
                                        std::is_same_v<std::decay_t<typename ContainerType::value_type>, char *>
                                       >
             >
-    void for_each(const Functor &func, const ContainerType &strcon, kseq_t *ks=nullptr) {
+    void for_each(const Functor &func, const ContainerType &strcon, SeqScanner *ss=nullptr) {
         for(const auto &el: strcon) {
             LOG_DEBUG("Loading from file %s\n", get_cstr(el));
-            for_each<Functor>(func, get_cstr(el), ks);
+            for_each<Functor>(func, get_cstr(el), ss);
         }
     }
 
     template<typename Target>
-    void add(hll::hll_t &hll, const Target &target, kseq_t *ks=nullptr) {
-        this->for_each([&](u64 min) {hll.addh(min);}, target, ks);
+    void add(hll::hll_t &hll, const Target &target, SeqScanner *ss=nullptr) {
+        this->for_each([&](u64 min) {hll.addh(min);}, target, ss);
     }
 
     template<typename Target>
-    void add(khash_t(all) *set, const Target &target, kseq_t *ks=nullptr) {
+    void add(khash_t(all) *set, const Target &target, SeqScanner *ss=nullptr) {
         int khr;
-        this->for_each([&] (u64 min) {kh_put(all, set, min, &khr);}, target, ks);
+        this->for_each([&] (u64 min) {kh_put(all, set, min, &khr);}, target, ss);
     }
 
     template<typename ContainerType>
-    void add(ContainerType &con, ContainerType &strcon, kseq_t *ks=nullptr) {
-        for(const auto &el: strcon) add(get_cstr(con, get_cstr(el), ks));
+    void add(ContainerType &con, ContainerType &strcon, SeqScanner *ss=nullptr) {
+        for(const auto &el: strcon) add(get_cstr(con, get_cstr(el), ss));
     }
 
     // Encodes a kmer starting at `start` within string `s_`.
@@ -388,19 +450,77 @@ public:
     // kmer in the window.
     INLINE u64 next_kmer() {
         assert(has_next_kmer());
-        return kmer(pos_++);
+        return rolling_kmer<false>();
+    }
+    // As next_kmer, but the lesser of the k-mer and its reverse complement.
+    INLINE u64 next_canonical_kmer() {
+        assert(has_next_kmer());
+        return rolling_kmer<true>();
+    }
+    // Rolls the windows forward to the end of the k-mer starting at pos_, so each base is only encoded once.
+    // Returns BF for ambiguous k-mers.
+    template<bool canon, typename Roller>
+    INLINE u64 roll(Roller &r) {
+        for(const u64 end(pos_++ + sp_.c_); rpos_ < end; ++rpos_) r.push(packed_.base(rpos_), packed_.ambiguous(rpos_));
+        if(!r.valid()) return BF;
+        const u64 fwd(r.forward());
+        if constexpr(canon) {
+            const u64 rev(r.reverse());
+            if(fwd != BF) return fwd < rev ? fwd: rev;
+        }
+        return fwd;
+    }
+    template<bool canon>
+    INLINE u64 rolling_kmer() {
+        if(likely(roll64_.supported())) return roll<canon>(roll64_);
+        if(roll128_.supported())        return roll<canon>(roll128_);
+        // Wider combs are encoded from scratch.
+        const u64 ret(kmer(pos_++));
+        return canon && ret != BF ? canonical_representation(ret, sp_.k_): ret;
+    }
+    // Calls func(kmer) for each unambiguous k-mer and skip(n) in place of each run of n ambiguous ones, in order.
+    // Contiguous seeds jump over runs of Ns without looking at the k-mers in them.
+    template<bool canon, typename Functor, typename SkipFunctor>
+    INLINE void for_each_kmer(const Functor &func, const SkipFunctor &skip) {
+        if(!has_next_kmer()) return;
+        const u64 nkmers(l_ - sp_.c_ + 1);
+        if(sp_.unspaced()) {
+            while(pos_ < nkmers) {
+                const u64 amb(packed_.next_ambiguous(pos_));
+                if(amb < pos_ + sp_.c_) {
+                    const u64 next(std::min(u64(packed_.next_unambiguous(amb)), nkmers));
+                    skip(next - pos_);
+                    pos_ = rpos_ = next;
+                    continue;
+                }
+                for(const u64 end(std::min(amb - sp_.c_ + 1, nkmers)); pos_ < end; func(rolling_kmer<canon>()));
+            }
+            return;
+        }
+        u64 kmer, nskip(0);
+        while(pos_ < nkmers) {
+            if((kmer = rolling_kmer<canon>()) == BF) ++nskip;
+            else {
+                if(nskip) skip(nskip), nskip = 0;
+                func(kmer);
+            }
+        }
+        if(nskip) skip(nskip);
     }
     // This is the actual point of entry for fetching our minimizers.
     // It wraps encoding and scoring a kmer, updates qmap, and returns the minimizer
     // for the next window.
     INLINE u64 next_minimizer() {
         //if(unlikely(!has_next_kmer())) return BF;
-        const u64 k(kmer(pos_++)), kscore(scorer_(k, data_));
+        const u64 k(rolling_kmer<false>()), kscore(scorer_(k, data_));
         return qmap_.next_value(k, kscore);
     }
     INLINE u64 next_canonicalized_minimizer() {
         assert(has_next_kmer());
-        const u64 k(canonical_representation(kmer(pos_++), sp_.k_)), kscore(scorer_(k, data_));
+        // Ambiguous k-mers have always entered the window as 0, which is what canonical_representation(BF) gives.
+        u64 k(rolling_kmer<true>());
+        if(k == BF) k = 0;
+        const u64 kscore(scorer_(k, data_));
         return qmap_.next_value(k, kscore);
     }
     elscore_t max_in_queue() const {
@@ -411,7 +531,7 @@ public:
     auto pos() const {return pos_;}
     uint32_t k() const {return sp_.k_;}
     ~Encoder() {
-        if(std::is_same_v<ScoreType, score::Entropy> && sp_.unspaced() && !sp_.unwindowed()) {
+        if(owns_data(sp_)) {
             delete static_cast<CircusEnt *>(data_);
         }
     }
@@ -489,11 +609,11 @@ void add_to_hll(hll::hll_t &hll, kseq_t *ks, Encoder<ScoreType> &enc) {
 
 template<typename ScoreType>
 void hll_fill_lmers(hll::hll_t &hll, const std::string &path, const Spacer &space, bool canonicalize=true,
-                    void *data=nullptr, kseq_t *ks=nullptr) {
+                    void *data=nullptr, SeqScanner *ss=nullptr) {
     LOG_DEBUG("Canonicalizing: %s\n", canonicalize ? "true": "false");
     hll.not_ready();
     Encoder<ScoreType> enc(nullptr, 0, space, data, canonicalize);
-    enc.for_each([&](u64 min) {hll.addh(min);}, path.data(), ks);
+    enc.for_each([&](u64 min) {hll.addh(min);}, path.data(), ss);
 }
 
 #define SUB_CALL \
@@ -553,19 +673,19 @@ struct est_helper {
     const bool                      canon_;
     void                            *data_;
     hll::hll_t                    &master_;
-    kseq_t                            *ks_;
+    SeqScanner                        *ss_;
 };
 
 template<typename ScoreType=score::Lex>
 void est_helper_fn(void *data_, long index, int tid) {
     est_helper &h(*(est_helper *)(data_));
-    hll_fill_lmers<ScoreType>(h.master_, h.paths_[index], h.sp_, h.canon_, h.data_, h.ks_);
+    hll_fill_lmers<ScoreType>(h.master_, h.paths_[index], h.sp_, h.canon_, h.data_, h.ss_);
 }
 
 template<typename ScoreType=score::Lex>
 void fill_hll(hll::hll_t &ret, const std::vector<std::string> &paths,
               unsigned k, uint16_t w, const spvec_t &spaces, bool canon=true,
-              void *data=nullptr, int num_threads=1, u64 np=23, kseq_t *ks=nullptr) {
+              void *data=nullptr, int num_threads=1, u64 np=23, SeqScanner *ss=nullptr) {
     // Default to using all available threads if num_threads is negative.
 #if 0
     LOG_DEBUG("Filling hll of %zu/%zu size, %zu paths, k%u, w%u, data %p, nt %u, sketch size %zu",
@@ -579,11 +699,11 @@ void fill_hll(hll::hll_t &ret, const std::vector<std::string> &paths,
     const Spacer space(k, w, spaces);
     if(num_threads <= 1) {
         LOG_DEBUG("Starting serial\n");
-        for(u64 i(0); i < paths.size(); hll_fill_lmers<ScoreType>(ret, paths[i++], space, canon, data, ks));
+        for(u64 i(0); i < paths.size(); hll_fill_lmers<ScoreType>(ret, paths[i++], space, canon, data, ss));
     } else {
         LOG_DEBUG("Starting parallel\n");
         std::mutex m;
-        est_helper helper{space, paths, m, np, canon, data, ret, ks};
+        est_helper helper{space, paths, m, np, canon, data, ret, ss};
         kt_for(num_threads, &est_helper_fn<ScoreType>, &helper, paths.size());
     }
     
@@ -603,17 +723,17 @@ void hll_from_khash(hll::hll_t &ret, const T *kh, bool clear=true) {
 template<typename ScoreType=score::Lex>
 hll::hll_t make_hll(const std::vector<std::string> &paths,
                 unsigned k, uint16_t w, spvec_t spaces, bool canon=true,
-                void *data=nullptr, int num_threads=1, u64 np=23, kseq_t *ks=false, hll::EstimationMethod estim=hll::EstimationMethod::ERTL_MLE) {
+                void *data=nullptr, int num_threads=1, u64 np=23, SeqScanner *ss=nullptr, hll::EstimationMethod estim=hll::EstimationMethod::ERTL_MLE) {
     hll::hll_t master(np, estim);
-    fill_hll(master, paths, k, w, spaces, canon, data, num_threads, np, ks);
+    fill_hll(master, paths, k, w, spaces, canon, data, num_threads, np, ss);
     return master;
 }
 
 template<typename ScoreType=score::Lex>
 u64 estimate_cardinality(const std::vector<std::string> &paths,
                             unsigned k, uint16_t w, spvec_t spaces, bool canon,
-                            void *data=nullptr, int num_threads=-1, u64 np=23, kseq_t *ks=nullptr, hll::EstimationMethod estim=hll::EstimationMethod::ERTL_MLE) {
-    auto tmp(make_hll<ScoreType>(paths, k, w, spaces, canon, data, num_threads, np, ks, estim));
+                            void *data=nullptr, int num_threads=-1, u64 np=23, SeqScanner *ss=nullptr, hll::EstimationMethod estim=hll::EstimationMethod::ERTL_MLE) {
+    auto tmp(make_hll<ScoreType>(paths, k, w, spaces, canon, data, num_threads, np, ss, estim));
     return tmp.report();
 }
 
@@ -4,6 +4,7 @@
 #include "encoder.h"
 #include "spacer.h"
 #include "khash64.h"
+#include "flattax.h"
 #include "util.h"
 #include "klib/kthread.h"
 #include <set>
@@ -25,60 +26,60 @@ namespace emp {
 
 
 template<typename ScoreType>
-khash_t(c) *make_depth_hash(khash_t(c) *lca_map, khash_t(p) *tax_map);
-void lca2depth(khash_t(c) *lca_map, khash_t(p) *tax_map);
+khash_t(c) *make_depth_hash(khash_t(c) *lca_map, const FlatTaxonomy *tax_map);
+void lca2depth(khash_t(c) *lca_map, const FlatTaxonomy *tax_map);
 
-khash_t(64) *make_taxdepth_hash(khash_t(c) *kc, const khash_t(p) *tax);
+khash_t(64) *make_taxdepth_hash(khash_t(c) *kc, const FlatTaxonomy *tax);
 
 
-void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const khash_t(p) *tax, tax_t taxid);
-void update_td_map(khash_t(64) *kc, const khash_t(all) *set, const khash_t(p) *tax, tax_t taxid);
-void update_feature_counter(khash_t(64) *kc, const khash_t(all) *set, const khash_t(p) *tax, tax_t taxid);
+void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, tax_t taxid);
+void update_td_map(khash_t(64) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, tax_t taxid);
+void update_feature_counter(khash_t(64) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, tax_t taxid);
 void update_minimized_map(const khash_t(all) *set, const khash_t(64) *full_map, khash_t(c) *ret);
 
 // Wrap these in structs so that downstream code can be managed as a set, not updated one-by-one.
 struct LcaMap {
     using ReturnType = khash_t(c) *;
     static constexpr size_t ValSize = sizeof(*(ReturnType{0})->vals);
-    static void update(const khash_t(p) *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
+    static void update(const FlatTaxonomy *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
         update_lca_map(r32, set, tax, taxid);
     }
 };
 struct TdMap {
     using ReturnType = khash_t(64) *;
     static constexpr size_t ValSize = sizeof(*(ReturnType{0})->vals);
-    static void update(const khash_t(p) *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
+    static void update(const FlatTaxonomy *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
         update_td_map(r64, set, tax, taxid);
     }
 };
 struct FcMap {
     using ReturnType = khash_t(64) *;
     static constexpr size_t ValSize = sizeof(*(ReturnType{0})->vals);
-    static void update(const khash_t(p) *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
+    static void update(const FlatTaxonomy *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
         update_feature_counter(r64, set, tax, taxid);
     }
 };
 struct MinMap {
     using ReturnType = khash_t(c) *;
     static constexpr size_t ValSize = sizeof(*(ReturnType{0})->vals);
-    static void update(const khash_t(p) *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
+    static void update(const FlatTaxonomy *tax, const khash_t(all) *set, const khash_t(64) *d64, khash_t(c) *r32, khash_t(64) *r64, tax_t taxid) {
         update_minimized_map(set, d64, r32);
     }
 };
 
 template<typename ScoreType>
-size_t fill_set_genome(const char *path, const Spacer &sp, khash_t(all) *ret, size_t index, void *data, bool canon, kseq_t *ks=nullptr) {
+size_t fill_set_genome(const char *path, const Spacer &sp, khash_t(all) *ret, size_t index, void *data, bool canon, SeqScanner *ss=nullptr) {
     LOG_ASSERT(ret);
     LOG_DEBUG("Filling from genome at path %s\n", path);
 
     Encoder<ScoreType> enc(0, 0, sp, data, canon);
-    enc.add(ret, path, ks);
+    enc.add(ret, path, ss);
     LOG_DEBUG("Set of size %lu filled from genome at path %s\n", kh_size(ret), path);
     return index;
 }
 
 template<typename Container, typename ScoreType>
-size_t fill_set_genome_container(Container &container, const Spacer &sp, khash_t(all) *ret, void *data, bool canon, kseq_t *ks=nullptr) {
+size_t fill_set_genome_container(Container &container, const Spacer &sp, khash_t(all) *ret, void *data, bool canon, SeqScanner *ss=nullptr) {
     bool destroy;
     size_t sz(0);
     for(std::string &str: container)
@@ -89,7 +90,7 @@ size_t fill_set_genome_container(Container &container, const Spacer &sp, khash_t
 
 template<typename ScoreType, typename MapUpdater>
 typename MapUpdater::ReturnType
-make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size, const khash_t(64) *data) {
+make_map(const std::vector<std::string> fns, const FlatTaxonomy *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size, const khash_t(64) *data) {
     MapUpdater mu;
 
     khash_t(c) *r32 = nullptr;
@@ -106,17 +107,17 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
     }
     khash_t(name) *name_hash(build_name_hash(seq2tax_path));
     std::vector<std::future<size_t>> futures;
-    // Mkae the future return the kseq pointer and then use it for resubmission.
+    // Each job slot keeps its scanner, so that parsing buffers are reused across genomes.
     // TODO: Also use a fixed st of kh_all sets to reduce memory allocations.
-    std::vector<kseq_t> kseqs;
+    std::vector<SeqScanner> scanners;
     std::vector<uint32_t> counter_map;
-    while(kseqs.size() < (unsigned)num_threads) kseqs.emplace_back(kseq_init_stack());
+    while(scanners.size() < (unsigned)num_threads) scanners.emplace_back();
 
     // Submit the first set of jobs
     std::set<size_t> used;
     for(size_t i(0); i < (unsigned)num_threads && i < todo; ++i) {
         futures.emplace_back(std::async(
-          std::launch::async, fill_set_genome<ScoreType>, fns[i].data(), sp, counters.data() + i, i, (void *)data, canon, &kseqs[submitted]));
+          std::launch::async, fill_set_genome<ScoreType>, fns[i].data(), sp, counters.data() + i, i, (void *)data, canon, &scanners[submitted]));
         counter_map.emplace_back(submitted);
         LOG_DEBUG("Submitted for %zu.\n", submitted);
         ++submitted;
@@ -132,10 +133,10 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
             used.insert(index);
             const auto coffset = counter_map.at(index);
             khash_t(all) *counter = counters.data() + coffset; // Pointer to the counter to use
-            kseq_t *ks_to_submit = kseqs.data() + coffset;
+            SeqScanner *ss_to_submit = scanners.data() + coffset;
             f = std::async(
               std::launch::async, fill_set_genome<ScoreType>, fns[submitted].data(),
-              sp, counter, submitted, (void *)data, canon, ks_to_submit);
+              sp, counter, submitted, (void *)data, canon, ss_to_submit);
             counter_map.emplace_back(coffset);
             ++submitted, ++completed;
             const tax_t taxid(get_taxid(fns[index].data(), name_hash));
@@ -152,7 +153,6 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
     }
 
     // Clean up
-    for(auto &ks: kseqs) kseq_destroy_stack(ks);
     for(auto &counter: counters) {
         std::free(counter.flags);
         std::free(counter.keys);
@@ -164,12 +164,12 @@ make_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const ch
         return r32;
 }
 template<typename ScoreType>
-auto feature_count_map(const std::vector<std::string> fns, const khash_t(p) *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size) {
+auto feature_count_map(const std::vector<std::string> fns, const FlatTaxonomy *tax_map, const char *seq2tax_path, const Spacer &sp, int num_threads, bool canon, size_t start_size) {
     return make_map<ScoreType, FcMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, nullptr);
 }
 
 template<typename ScoreType>
-khash_t(c) *lca_map(const std::vector<std::string> &fns, const khash_t(p) *tax_map,
+khash_t(c) *lca_map(const std::vector<std::string> &fns, const FlatTaxonomy *tax_map,
                     const char *seq2tax_path,
                     const Spacer &sp, int num_threads, bool canon, size_t start_size) {
     return make_map<ScoreType, LcaMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, nullptr);
@@ -177,19 +177,19 @@ khash_t(c) *lca_map(const std::vector<std::string> &fns, const khash_t(p) *tax_m
 
 template<typename ScoreType>
 khash_t(c) *minimized_map(std::vector<std::string> fns,
-                          const khash_t(64) *full_map, const char *seq2tax_path, const khash_t(p) *tax_map,
+                          const khash_t(64) *full_map, const char *seq2tax_path, const FlatTaxonomy *tax_map,
                           const Spacer &sp, int num_threads, size_t start_size, bool canon) {
     return make_map<ScoreType, MinMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, full_map);
 }
 
 template<typename ScoreType>
-khash_t(64) *ftct_map(const std::vector<std::string> &fns, const khash_t(p) *tax_map,
+khash_t(64) *ftct_map(const std::vector<std::string> &fns, const FlatTaxonomy *tax_map,
                       const char *seq2tax_path,
                       const Spacer &sp, int num_threads, bool canon, size_t start_size) {
     return feature_count_map<ScoreType>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size);
 }
 template<typename ScoreType>
-khash_t(64) *taxdepth_map(const std::vector<std::string> &fns, const khash_t(p) *tax_map,
+khash_t(64) *taxdepth_map(const std::vector<std::string> &fns, const FlatTaxonomy *tax_map,
                           const char *seq2tax_path, const Spacer &sp,
                           int num_threads, bool canon, size_t start_size=1<<10) {
     return make_map<ScoreType, TdMap>(fns, tax_map, seq2tax_path, sp, num_threads, canon, start_size, nullptr);
@@ -0,0 +1,163 @@
+#ifndef _FLATTAX_H__
+#define _FLATTAX_H__
+#include "util.h"
+
+namespace emp {
+
+// Hits per taxon for one read. Reads hit few distinct taxa, so a flat map does.
+// Counts are 64-bit, so that long reads cannot overflow them.
+class tax_counter {
+    std::vector<tax_t> keys_;
+    std::vector<u64>   values_;
+public:
+    INLINE void add(tax_t key, u64 n=1) {
+        const auto it(std::find(keys_.begin(), keys_.end(), key));
+        if(it == keys_.end()) keys_.push_back(key), values_.push_back(n);
+        else                  values_[it - keys_.begin()] += n;
+    }
+    void merge(const tax_counter &other) {
+        for(size_t i(0); i < other.size(); ++i) add(other.keys_[i], other.values_[i]);
+    }
+    void clear() {keys_.clear(), values_.clear();}
+    size_t size() const {return keys_.size();}
+    const std::vector<tax_t> &keys()   const {return keys_;}
+    const std::vector<u64>   &values() const {return values_;}
+};
+
+/*
+ * Compiled taxonomy.
+ * Taxa are renumbered densely in preorder (children in taxid order) under a virtual root, dense id 0,
+ * which stands for taxid 0. Then parent_[i] < i for i > 0, and for dense ids a < b,
+ *     lca(a, b) = min(parent_[a + 1 .. b]),
+ * since the shallowest node in that preorder range is a child of the lca, and every other node
+ * in it descends from that lca. That minimum is an O(1) range-minimum query: a sparse table
+ * over 64-node blocks, plus per-node bitmasks of the suffix minima seen so far within its block.
+ * depth_ and end_ (one past the last descendant in preorder) make depth queries and
+ * ancestor tests single loads, and resolve_tree one sort and one pass over the hits.
+ *
+ * The tables live in one buffer behind a small header, which write() dumps as is and which
+ * a compiled file is mmap'd back into.
+ */
+static constexpr u64 TAX_MAGIC   = 0x58544941534E4F42ull; // "BONSAITX"
+static constexpr u32 TAX_VERSION = 1;
+
+struct flattax_header_t {
+    u64 magic_;
+    u32 version_;
+    u32 n_;       // Nodes, including the virtual root
+    u32 maxid_;   // Largest taxid
+    u32 nblocks_; // 64-node blocks
+    u32 nlevels_; // Sparse table levels
+    u32 pad_;
+    u64 words_;   // Size of the tables which follow, in u64s
+    u64 reserved_[3];
+};
+static_assert(sizeof(flattax_header_t) == 64, "Keep the tables 64-byte aligned.");
+
+class FlatTaxonomy {
+public:
+    static constexpr u32 NONE = u32(-1);
+private:
+    flattax_header_t h_;
+    std::vector<u64> data_;
+    void  *map_;
+    size_t map_size_;
+    const u64 *masks_;
+    const u32 *ids_, *parent_, *depth_, *end_, *index_, *sparse_;
+
+    struct path_hit_t {
+        u32 dense_;
+        u64 score_, count_;
+    };
+
+    void set_pointers(const u64 *data);
+    u32 score_paths(const tax_counter &hit_counts, std::vector<path_hit_t> &hits, u64 &max_score) const;
+    void build(const khash_t(p) *map);
+    void load_mapped(const char *path);
+
+    INLINE u32 block_min(u32 l, u32 r) const {
+        const u64 m(masks_[r] & (UINT64_C(-1) << (l & 63)));
+        return parent_[(r & ~u32(63)) + __builtin_ctzll(m)];
+    }
+    // Min of parent_[l..r], 0 < l <= r < n
+    INLINE u32 rmq(u32 l, u32 r) const {
+        const u32 bl(l >> 6), br(r >> 6);
+        if(bl == br) return block_min(l, r);
+        u32 ret(std::min(block_min(l, (bl << 6) | 63), block_min(br << 6, r)));
+        if(bl + 1 < br) {
+            const u32 lev(31 - __builtin_clz(br - bl - 1)), *row(sparse_ + size_t(lev) * h_.nblocks_);
+            ret = std::min(ret, std::min(row[bl + 1], row[br - (1u << lev)]));
+        }
+        return ret;
+    }
+public:
+    FlatTaxonomy(const khash_t(p) *map);
+    // Either a file written by write() or a taxonomy in the format build_parent_map reads.
+    FlatTaxonomy(const char *path);
+    FlatTaxonomy(const FlatTaxonomy &other) = delete;
+    FlatTaxonomy &operator=(const FlatTaxonomy &other) = delete;
+    ~FlatTaxonomy();
+
+    void write(const char *path) const;
+    bool is_mapped() const {return map_ != nullptr;}
+    // Taxa, not counting the virtual root.
+    size_t size() const {return h_.n_ - 1;}
+
+    // Dense ids. NONE for taxa not in the taxonomy.
+    INLINE u32 dense(tax_t a) const {return a <= h_.maxid_ ? index_[a]: NONE;}
+    INLINE tax_t id(u32 d)    const {return ids_[d];}
+    INLINE u32 lca_dense(u32 a, u32 b) const {
+        if(a == b) return a;
+        if(a > b) std::swap(a, b);
+        return rmq(a + 1, b);
+    }
+    INLINE bool is_ancestor_dense(u32 a, u32 d) const {return a <= d && d < end_[a];}
+    // Dense ids run from 0 (the virtual root) to nodes() - 1, each after its parent.
+    u32 nodes() const {return h_.n_;}
+    INLINE u32 parent_dense(u32 d) const {return parent_[d];}
+    INLINE u32 depth_dense(u32 d)  const {return depth_[d];}
+
+    bool  has(tax_t a)    const {return a && dense(a) != NONE;}
+    // Same conventions as lca(const khash_t(p) *, ...): 0 is ignored, and unknown taxa
+    // (or taxa from different trees) give tax_t(-1).
+    INLINE tax_t lca(tax_t a, tax_t b) const {
+        if(a == b || b == 0) return a;
+        if(a == 0) return b;
+        const u32 da(dense(a)), db(dense(b));
+        if(da == NONE || db == NONE) return tax_t(-1);
+        const u32 ret(lca_dense(da, db));
+        return ret ? ids_[ret]: tax_t(-1);
+    }
+    // Number of nodes on the path from a to the root, as node_depth.
+    unsigned depth(tax_t a) const {
+        const u32 d(dense(a));
+        if(d == NONE) LOG_EXIT("Tax ID %u missing. Abort!\n", a);
+        return depth_[d];
+    }
+    tax_t parent(tax_t a) const {
+        const u32 d(dense(a));
+        return d == NONE ? tax_t(-1): ids_[parent_[d]];
+    }
+    // Leaf of the highest-weighted root-to-leaf path over hit taxa, or the lca of tied leaves,
+    // as resolve_tree(const linear::counter<tax_t, u16> &, const khash_t(p) *). Unknown taxa are ignored.
+    tax_t resolve_tree(const tax_counter &hit_counts) const;
+
+    struct resolution_t {
+        tax_t taxon_;  // As resolve_tree
+        u64 score_;    // Score of the leading path
+        u64 outside_;  // Best score of a path leaving taxon_'s subtree, 0 for none
+        u64 clade_;    // Hits to taxon_ and its descendants
+        u64 total_;    // All hits
+    };
+    // resolve_tree, along with what it takes to bound the effect of further hits:
+    // r more hits can only move the result out of taxon_'s subtree if outside_ + r >= score_.
+    resolution_t resolve(const tax_counter &hit_counts) const;
+    // The deepest of taxon and its ancestors whose clade holds at least confidence of all
+    // hits plus nmissing, or 0 if there is none.
+    tax_t confident_ancestor(const tax_counter &hit_counts, tax_t taxon,
+                             double confidence, u64 nmissing) const;
+};
+
+} // namespace emp
+
+#endif // #ifndef _FLATTAX_H__
@@ -0,0 +1,50 @@
+#ifndef _KMERCACHE_H__
+#define _KMERCACHE_H__
+#include "kmerutil.h"
+#include "util.h"
+
+namespace emp {
+
+/*
+ * Direct-mapped cache of database lookups for one thread, misses included.
+ * Sized to sit in L2/L3, it saves the DRAM miss of a database probe for k-mers which recur
+ * across reads, as in amplicon, host-heavy or deeply sequenced samples.
+ * Entries hold the full k-mer, so a hit always returns what the database would.
+ * BF marks an empty slot: it is never looked up, since it stands for ambiguous k-mers.
+ */
+class alignas(64) KmerCache { // Keep threads' counters on separate cache lines.
+    struct entry_t {
+        u64   kmer_;
+        tax_t tax_;
+    };
+    std::vector<entry_t> entries_;
+    unsigned shift_;
+    u64 hits_, misses_;
+
+    INLINE size_t slot(u64 kmer) const {return (kmer * UINT64_C(0x9E3779B97F4A7C15)) >> shift_;}
+public:
+    // 2^lg entries, 16 bytes each.
+    KmerCache(unsigned lg): entries_(size_t(1) << lg, entry_t{BF, 0}), shift_(64 - lg), hits_(0), misses_(0) {
+        assert(lg && lg <= 32);
+    }
+    INLINE bool contains(u64 kmer) const {return entries_[slot(kmer)].kmer_ == kmer;}
+    // Returns the cached taxon for kmer, or calls fill(kmer) and caches its result.
+    template<typename Func>
+    INLINE tax_t get(u64 kmer, const Func &fill) {
+        entry_t &e(entries_[slot(kmer)]);
+        if(e.kmer_ == kmer) {
+            ++hits_;
+            return e.tax_;
+        }
+        ++misses_;
+        e.kmer_ = kmer;
+        return e.tax_ = fill(kmer);
+    }
+    u64 hits()   const {return hits_;}
+    u64 misses() const {return misses_;}
+    size_t bytes() const {return entries_.size() * sizeof(entry_t);}
+};
+
+} // namespace emp
+
+#endif // #ifndef _KMERCACHE_H__
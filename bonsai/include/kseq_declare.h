@@ -103,8 +103,27 @@ static inline void bseq_destroy(bseq1_t *bs) {
     free(bs->sam);
 }
 
-bseq1_t *bseq_read(int chunk_size, int *n_, void *ks1_, void *ks2_);
-bseq1_t *bseq_realloc_read(int chunk_size, int *n_, void *ks1_, void *ks2_, bseq1_t *ret);
+bseq1_t *bseq_read(int64_t chunk_size, int *n_, void *ks1_, void *ks2_);
+bseq1_t *bseq_realloc_read(int64_t chunk_size, int *n_, void *ks1_, void *ks2_, bseq1_t *ret);
+
+// A chunk of records whose text lives in one arena, as name\0[comment\0]seq\0[qual\0] per record.
+// Records are laid out by offset while reading, since the arena may move as it grows,
+// and pointed into it once the chunk is complete.
+// Reading into a batch again reuses both its records and its arena, so that a batch
+// recycled across chunks stops allocating once it has seen the largest one.
+// Filled by bseq_batch_read in seqscan.h.
+typedef struct {
+    bseq1_t *seqs;
+    int n, m;
+    char *buf;
+    size_t l, cap;
+} bseq_batch_t;
+
+static inline void bseq_batch_destroy(bseq_batch_t *b) {
+    free(b->seqs);
+    free(b->buf);
+    memset(b, 0, sizeof(*b));
+}
 
 #ifdef __cplusplus
 }
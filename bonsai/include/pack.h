@@ -0,0 +1,65 @@
+#ifndef _PACK_H__
+#define _PACK_H__
+#include "util.h"
+
+namespace emp {
+
+/*
+ * A read packed 2 bits per base, 32 bases per word, with the first base in the highest bits of its word,
+ * so a word reads like a forward-encoded 32-mer. Alongside it, a bitmask of ambiguous (non-ACGT) bases,
+ * 64 bases per word with base i in bit i % 64. Ambiguous bases are stored as 0 (A).
+ * Both are built in one pass by a kernel picked at runtime (AVX2, SSSE3 or scalar).
+ * Positions past the end of the read are marked ambiguous.
+ */
+using pack_fn = void (*)(const char *s, size_t l, u64 *bases, u64 *ambig);
+namespace pack {
+void scalar(const char *s, size_t l, u64 *bases, u64 *ambig);
+void ssse3(const char *s, size_t l, u64 *bases, u64 *ambig);
+void avx2(const char *s, size_t l, u64 *bases, u64 *ambig);
+// The fastest kernel this CPU supports.
+pack_fn best();
+const char *best_name();
+} // namespace pack
+
+class PackedSeq {
+    std::vector<u64> bases_, ambig_;
+    size_t l_;
+public:
+    PackedSeq(): l_(0) {}
+    void assign(const char *s, size_t l) {
+        static const pack_fn fn(pack::best());
+        l_ = l;
+        // One extra word each so window reads and scans can always look at the next word.
+        bases_.resize((l + 31) / 32 + 1);
+        ambig_.resize((l + 63) / 64 + 1);
+        fn(s, l, bases_.data(), ambig_.data());
+        bases_.back() = 0, ambig_.back() = UINT64_C(-1);
+    }
+    size_t size() const {return l_;}
+    INLINE u64  base(size_t i)      const {return (bases_[i >> 5] >> (62 - ((i & 31) << 1))) & 3;}
+    INLINE bool ambiguous(size_t i) const {return (ambig_[i >> 6] >> (i & 63)) & 1;}
+    // The first position at or after i with an ambiguous base, or size() if none.
+    INLINE size_t next_ambiguous(size_t i) const {
+        if(i >= l_) return l_;
+        size_t w(i >> 6);
+        u64 bits(ambig_[w] & (UINT64_C(-1) << (i & 63)));
+        while(bits == 0) bits = ambig_[++w];
+        return std::min(l_, (w << 6) + __builtin_ctzll(bits));
+    }
+    // The first position at or after i with an unambiguous base, or size() if none.
+    INLINE size_t next_unambiguous(size_t i) const {
+        if(i >= l_) return l_;
+        const size_t nwords((l_ + 63) >> 6);
+        size_t w(i >> 6);
+        u64 bits(~ambig_[w] & (UINT64_C(-1) << (i & 63)));
+        while(bits == 0) {
+            if(++w == nwords) return l_;
+            bits = ~ambig_[w];
+        }
+        return std::min(l_, (w << 6) + __builtin_ctzll(bits));
+    }
+};
+
+} // namespace emp
+
+#endif // #ifndef _PACK_H__
@@ -0,0 +1,64 @@
+#ifndef _PLACEMENT_H__
+#define _PLACEMENT_H__
+#include "util.h"
+
+namespace emp {
+
+/*
+ * Memory placement for the classification database.
+ * By default, a mapped database is read from the page cache in 4 KB pages, on whichever NUMA node
+ * faulted each page in. Lookups are random, so that costs a dTLB miss and, on multi-socket machines,
+ * often a remote access per probe. A placement copies the database into anonymous memory instead:
+ *     huge pages:  transparent (madvise(MADV_HUGEPAGE)) or explicit (MAP_HUGETLB, from the reserved pool),
+ *     NUMA:        interleaved page by page across nodes, or replicated with one copy bound to each node,
+ * and can pin classification threads to cores, spread round-robin over the nodes, so that each thread
+ * looks up its own node's replica. Copies are private, so concurrent processes no longer share pages.
+ * NUMA policies are set with the mbind system call directly, so we need no libnuma.
+ */
+enum huge_page_mode: int {
+    HUGE_NONE        = 0,
+    HUGE_TRANSPARENT = 1,
+    HUGE_EXPLICIT    = 2
+};
+
+enum numa_mode: int {
+    NUMA_LOCAL      = 0, // First touch
+    NUMA_INTERLEAVE = 1,
+    NUMA_REPLICATE  = 2
+};
+
+struct placement_t {
+    int  huge_; // huge_page_mode
+    int  numa_; // numa_mode
+    bool pin_;  // Pin classification threads to cores.
+    placement_t(): huge_(HUGE_NONE), numa_(NUMA_LOCAL), pin_(false) {}
+    // Whether the database has to be copied out of the page cache.
+    bool copies() const {return huge_ != HUGE_NONE || numa_ != NUMA_LOCAL;}
+    std::string str() const;
+};
+
+// "none", "thp" or "hugetlb".
+int parse_huge_pages(const char *s);
+// "local", "interleave" or "replicate".
+int parse_numa(const char *s);
+
+// Cores of each online NUMA node, from sysfs. One node with every core if sysfs does not say.
+// Nodes are numbered by their index here, which need not be the kernel's node number.
+const std::vector<std::vector<int>> &numa_cpus();
+INLINE unsigned numa_nodes() {return numa_cpus().size();}
+int numa_node_id(unsigned index);
+
+// Anonymous mapping of len bytes, rounded up to the page size into maplen, laid out as p says.
+// It is bound to node (an index, as above) if node >= 0, else interleaved if p says so.
+// Explicit huge pages fall back to transparent ones if the pool cannot hold the mapping.
+void *map_placed(size_t len, const placement_t &p, int node, size_t &maplen);
+
+// Thread tid goes to node tid % numa_nodes(), on that node's cores in turn.
+INLINE int thread_node(int tid) {return tid % numa_nodes();}
+int thread_cpu(int tid);
+// Pins the calling thread.
+void pin_thread(int cpu);
+
+} // namespace emp
+
+#endif // #ifndef _PLACEMENT_H__
@@ -0,0 +1,35 @@
+#ifndef _REPORT_H__
+#define _REPORT_H__
+#include "flattax.h"
+
+namespace emp {
+
+/*
+ * Per-run abundance report.
+ * Each classifying thread counts reads per call in its own row of a dense array indexed by
+ * FlatTaxonomy dense ids (rows padded to whole cache lines), so counting is a single
+ * uncontended increment. write() sums the rows and, since a dense id follows its parent,
+ * accumulates clade counts in one backwards pass. Unclassified reads are counted at the
+ * virtual root.
+ */
+class AbundanceReport {
+    const FlatTaxonomy &tax_;
+    const unsigned nthreads_;
+    const size_t stride_;
+    std::vector<u64> counts_;
+public:
+    AbundanceReport(const FlatTaxonomy &tax, unsigned nthreads);
+    // tid as given by kt_for, taxon as called (0 for unclassified).
+    INLINE void add(int tid, tax_t taxon) {++counts_[tid * stride_ + tax_.dense(taxon)];}
+    // Reads counted so far at each dense id, then with their descendants'.
+    void merge(std::vector<u64> &direct, std::vector<u64> &clade) const;
+    // Kraken-report-style table: percentage of reads in the clade, reads in the clade, reads assigned
+    // directly, rank code ('-': we do not keep ranks), taxid and taxid indented by depth.
+    // Taxa without reads are omitted.
+    void write(std::FILE *fp) const;
+    void write(const char *path) const;
+};
+
+} // namespace emp
+
+#endif // #ifndef _REPORT_H__
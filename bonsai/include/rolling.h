@@ -0,0 +1,90 @@
+#ifndef _ROLLING_H__
+#define _ROLLING_H__
+#include "kmerutil.h"
+#include "spacer.h"
+#if __BMI2__
+#  include <immintrin.h>
+#endif
+
+namespace emp {
+
+/*
+ * Rolling 2-bit encoder for (spaced) seeds.
+ * Keeps the last c bases of a sequence packed both forwards and reverse-complemented,
+ * so adding a base is a couple of shifts. With BMI2, a seed is pulled out of the window
+ * with one pext per 64 bits of window; otherwise with one shift-and-mask per contiguous
+ * run of seed positions (one for unspaced seeds).
+ * Spans wider than half the bits of WordType are not supported: check supported().
+ */
+template<typename WordType>
+class RollingKmer {
+    struct run_t {
+        u32 fshift_, rshift_; // Where the run starts in the forward/reverse windows
+        u32 fout_,   rout_;   // and where it goes in the forward/reverse k-mers.
+        u64 mask_;
+    };
+    std::vector<run_t> runs_;
+    u64 fpext_[2], rpext_[2]; // pext masks for the low and high words of the forward/reverse windows
+    u32 flow_, rlow_;         // and how many k-mer bits the low words hold.
+    WordType fwd_, rev_;
+    u64   nmask_;    // Bit i is set if the base i positions back is ambiguous.
+    u64   seedmask_; // Bit i is set if the base i positions back is part of the seed.
+    u32   c_;
+public:
+    static constexpr u32 MAX_SPAN = sizeof(WordType) * 4;
+
+    RollingKmer(const Spacer &sp): fpext_{0, 0}, rpext_{0, 0}, flow_(0), rlow_(0), fwd_(0), rev_(0), nmask_(0), seedmask_(0), c_(sp.c_) {
+        if(c_ > MAX_SPAN) return;
+        std::vector<u32> pos{0};
+        for(const auto s: sp.s_) pos.push_back(pos.back() + s);
+        for(size_t i(0), j; i < pos.size(); i = j) {
+            for(j = i + 1; j < pos.size() && pos[j] == pos[j - 1] + 1; ++j);
+            const u32 len(j - i);
+            runs_.push_back(run_t{2 * (c_ - pos[i] - len), 2 * pos[i], u32(2 * (pos.size() - j)), u32(2 * i),
+                                  BF >> (64 - 2 * len)});
+        }
+        for(const auto p: pos) {
+            seedmask_ |= u64(1) << (c_ - 1 - p);
+            const u32 fbit(2 * (c_ - 1 - p)), rbit(2 * p);
+            fpext_[fbit >> 6] |= u64(3) << (fbit & 63);
+            rpext_[rbit >> 6] |= u64(3) << (rbit & 63);
+        }
+        flow_ = __builtin_popcountll(fpext_[0]), rlow_ = __builtin_popcountll(rpext_[0]);
+    }
+    bool supported() const {return !runs_.empty();}
+    INLINE void reset() {fwd_ = rev_ = 0; nmask_ = 0;}
+    // base is a 2-bit code, as from PackedSeq.
+    INLINE void push(u64 base, bool ambiguous) {
+        fwd_   = (fwd_ << 2) | base;
+        rev_   = (rev_ >> 2) | (WordType(3 - base) << (2 * (c_ - 1)));
+        nmask_ = (nmask_ << 1) | ambiguous;
+    }
+    // Whether the seed in the current window has no ambiguous bases.
+    INLINE bool valid() const {return (nmask_ & seedmask_) == 0;}
+#if __BMI2__
+    static INLINE u64 extract(WordType w, const u64 *mask, u32 low) {
+        if constexpr(sizeof(WordType) == sizeof(u64)) return _pext_u64(w, mask[0]);
+        else {
+            const u64 ret(_pext_u64(u64(w), mask[0]));
+            return mask[1] ? ret | (_pext_u64(u64(w >> 64), mask[1]) << low): ret;
+        }
+    }
+    INLINE u64 forward() const {return extract(fwd_, fpext_, flow_);}
+    INLINE u64 reverse() const {return extract(rev_, rpext_, rlow_);}
+#else
+    INLINE u64 forward() const {
+        u64 ret(0);
+        for(const auto &r: runs_) ret |= (u64(fwd_ >> r.fshift_) & r.mask_) << r.fout_;
+        return ret;
+    }
+    INLINE u64 reverse() const {
+        u64 ret(0);
+        for(const auto &r: runs_) ret |= (u64(rev_ >> r.rshift_) & r.mask_) << r.rout_;
+        return ret;
+    }
+#endif
+};
+
+} // namespace emp
+
+#endif // #ifndef _ROLLING_H__
@@ -0,0 +1,75 @@
+#ifndef _SEQSCAN_H__
+#define _SEQSCAN_H__
+#include "kseq_declare.h"
+#include "util.h"
+
+namespace emp {
+
+/*
+ * FASTA/FASTQ records straight out of large decoded blocks.
+ * kseq_read goes through its input a byte at a time in ks_getuntil and copies each field into its own kstring.
+ * SeqScanner instead reads a few MB at a time through gzread (so any gzFile does, ParallelDecompressor's included),
+ * finds newlines and record starts 32 bytes at a time, and hands out records as views into its buffer.
+ * Multi-line sequences and qualities are joined in place, so a record costs at most a memmove per extra line.
+ * Each field is NUL-terminated in place. Views are valid until the next call to next() or assign().
+ * As with kseq, the name ends at the first space or tab and the rest of the header line is the comment,
+ * a FASTQ quality runs until it is as long as the sequence, and a trailing '\r' is dropped from every line.
+ */
+struct seq_record_t {
+    char  *name_, *comment_, *seq_, *qual_; // comment_ and qual_ are null if absent.
+    size_t l_name_, l_comment_, l_seq_, l_qual_;
+};
+
+namespace scan {
+// First newline in [p, end), or null.
+using newline_fn = const char *(*)(const char *p, const char *end);
+// First newline in [p, end - 1) which is followed by c, or null.
+using record_fn  = const char *(*)(const char *p, const char *end, char c);
+const char *newline_scalar(const char *p, const char *end);
+const char *newline_avx2(const char *p, const char *end);
+const char *record_scalar(const char *p, const char *end, char c);
+const char *record_avx2(const char *p, const char *end, char c);
+// The fastest kernels this CPU supports.
+newline_fn best_newline();
+record_fn  best_record();
+const char *best_name();
+} // namespace scan
+
+class SeqScanner {
+    gzFile fp_;
+    char  *buf_;   // One byte longer than cap_, so that a record at the end of the input can be NUL-terminated.
+    size_t cap_;
+    size_t begin_, end_; // Unparsed input is buf_[begin_, end_).
+    bool   eof_;
+    std::string error_; // Why reading the input failed, if it did
+    std::vector<std::pair<size_t, size_t>> lines_; // Sequence and quality lines of a FASTQ record, as offsets from begin_.
+
+    bool refill();
+    bool next_fasta(seq_record_t &rec);
+    int  next_fastq(seq_record_t &rec);
+    void parse_header(seq_record_t &rec, size_t start, size_t end);
+    size_t join(size_t first, size_t last);
+public:
+    static constexpr size_t DEFAULT_BUFFER_SIZE = 1 << 22;
+    SeqScanner(gzFile fp=nullptr, size_t bufsize=DEFAULT_BUFFER_SIZE);
+    SeqScanner(const SeqScanner &other) = delete;
+    SeqScanner &operator=(const SeqScanner &other) = delete;
+    SeqScanner(SeqScanner &&other) noexcept;
+    ~SeqScanner();
+    // Starts over on fp, keeping the buffer.
+    void assign(gzFile fp);
+    gzFile fp() const {return fp_;}
+    // Returns false once the input is exhausted, or once it fails to read, which error() then says why.
+    bool next(seq_record_t &rec);
+    const char *error() const {return error_.size() ? error_.data(): nullptr;}
+};
+
+// Reads records into b until they hold chunk_size bases, as bseq_read does, and returns how many it read.
+// s2, if set, holds the mates of s1's records, which are interleaved with them.
+// Read names lose a trailing /1 or /2.
+// Returns -1 if either input fails to read, as its error() says.
+int bseq_batch_read(int64_t chunk_size, bseq_batch_t *b, SeqScanner &s1, SeqScanner *s2=nullptr);
+
+} // namespace emp
+
+#endif // #ifndef _SEQSCAN_H__
@@ -0,0 +1,177 @@
+#ifndef _SERVE_H__
+#define _SERVE_H__
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "classifier.h"
+
+namespace emp {
+
+/*
+ * Classification daemon.
+ * A Server holds a database and taxonomy in memory and answers requests over a Unix domain socket,
+ * so that short jobs skip loading, taxonomy parsing and page-cache warmup.
+ * A request is one line, answered with classify's output for its reads, after which the server
+ * closes the connection:
+ *     CLASSIFY [-o <out>] <r1.fq> [<r2.fq>]   Paths are opened by the server, which writes output to <out> if given.
+ *     STREAM                                  Single-end records follow on the socket until the client shuts down writing.
+ *     QUIT                                    Stops the server once queued requests are done.
+ * Errors are answered with a line starting with "ERR ", which is the last line sent. Input found to be corrupt
+ * part of the way through is reported after the output for the reads before it.
+ * A request which fails only fails itself: the server goes on to the next one.
+ * Accepted connections wait in a bounded queue for one of the request workers, each of which has its
+ * own classifier (and so its own classification threads) over the shared database. Connections
+ * arriving when the queue is full are turned away.
+ */
+
+int unix_listen(const char *path);
+int unix_connect(const char *path);
+// Reads up to and including the next newline, one byte at a time, so that nothing past it is consumed.
+// Returns false on EOF, error or lines longer than maxlen.
+bool read_line(int fd, std::string &line, size_t maxlen=1 << 16);
+void send_error(int fd, const char *msg);
+
+struct request_stats_t {
+    u64    nreads_, nclassified_;
+    double seconds_, queued_seconds_;
+};
+void log_request(u64 id, const char *what, const request_stats_t &stats);
+
+template<typename ScoreType>
+class Server {
+    using clock = std::chrono::steady_clock;
+    struct request_t {
+        int fd_;
+        u64 id_;
+        clock::time_point accepted_;
+    };
+    std::vector<std::unique_ptr<ClassifierGeneric<ScoreType>>> cs_; // One per request worker
+    const FlatTaxonomy &tax_;
+    const std::string path_;
+    const size_t queue_size_;
+    const u64 chunk_size_;
+    const unsigned groups_per_thread_;
+    int lfd_;
+    std::deque<request_t> queue_;
+    std::mutex m_;
+    std::condition_variable cv_;
+    std::atomic<bool> stop_;
+    u64 nrequests_;
+
+    void handle(ClassifierGeneric<ScoreType> &c, const request_t &req) {
+        std::string line;
+        if(!read_line(req.fd_, line)) return send_error(req.fd_, "could not read request");
+        std::istringstream iss(line);
+        std::vector<std::string> fields;
+        for(std::string field; iss >> field; fields.push_back(std::move(field)));
+        if(fields.empty()) return send_error(req.fd_, "empty request");
+        std::vector<sample_t> samples;
+        if(fields[0] == "QUIT") {
+            stop();
+            return;
+        } else if(fields[0] == "CLASSIFY") {
+            const size_t first(fields.size() > 2 && fields[1] == "-o" ? 3: 1), ninputs(fields.size() - first);
+            if(ninputs != 1 && ninputs != 2) return send_error(req.fd_, ("malformed request: " + line).data());
+            samples.emplace_back(fields[first], fields[first], ninputs == 2 ? fields[first + 1]: std::string(),
+                                 first == 3 ? fields[2]: std::string());
+        } else if(fields[0] == "STREAM" && fields.size() == 1) {
+            samples.emplace_back("stream", "stream", std::string(), std::string(), nullptr, req.fd_);
+        } else return send_error(req.fd_, ("malformed request: " + line).data());
+        sample_t &sample(samples[0]);
+        if(sample.out_path_.empty()) {
+            const int ofd(::dup(req.fd_));
+            if(ofd < 0 || (sample.out_ = ::fdopen(ofd, "w")) == nullptr) return send_error(req.fd_, "could not open output");
+        }
+        const auto start(clock::now());
+        process_samples(c, tax_, samples, chunk_size_, groups_per_thread_, true, 1);
+        if(sample.out_) std::fclose(sample.out_); // The socket's. An output file is closed after its last chunk.
+        const auto end(clock::now());
+        if(sample.error_.size()) {
+            LOG_WARNING("Request %" PRIu64 " failed: %s\n", req.id_, sample.error_.data());
+            return send_error(req.fd_, sample.error_.data());
+        }
+        if(sample.write_errno_) {
+            LOG_WARNING("Request %" PRIu64 ": could not write output: %s\n", req.id_, std::strerror(sample.write_errno_));
+            if(sample.out_path_.size()) return send_error(req.fd_, (std::string("could not write output: ") + std::strerror(sample.write_errno_)).data());
+        }
+        log_request(req.id_, fields[0].data(), request_stats_t{sample.nreads_, sample.nclassified_,
+                    std::chrono::duration<double>(end - start).count(), std::chrono::duration<double>(start - req.accepted_).count()});
+    }
+    void work(size_t i) {
+        for(;;) {
+            std::unique_lock<std::mutex> lock(m_);
+            cv_.wait(lock, [this]() {return stop_ || queue_.size();});
+            if(queue_.empty()) return; // Stopped and drained.
+            const request_t req(queue_.front());
+            queue_.pop_front();
+            lock.unlock();
+            handle(*cs_[i], req);
+            ::close(req.fd_);
+        }
+    }
+public:
+    Server(std::vector<std::unique_ptr<ClassifierGeneric<ScoreType>>> &&cs, const FlatTaxonomy &tax,
+           const char *path, size_t queue_size, u64 chunk_size, unsigned groups_per_thread):
+        cs_(std::move(cs)), tax_(tax), path_(path), queue_size_(std::max(queue_size, size_t(1))),
+        chunk_size_(chunk_size), groups_per_thread_(groups_per_thread), lfd_(unix_listen(path)),
+        stop_(false), nrequests_(0)
+    {
+        if(cs_.empty()) LOG_EXIT("A server needs at least one classifier.\n");
+    }
+    Server(const Server &other) = delete;
+    ~Server() {
+        ::close(lfd_);
+        ::unlink(path_.data());
+    }
+    // Accepts connections until stop() or a QUIT request, then waits for queued requests to finish.
+    void run() {
+        std::vector<std::thread> workers;
+        for(size_t i(0); i < cs_.size(); ++i) workers.emplace_back(&Server::work, this, i);
+        LOG_INFO("Listening on %s with %zu request workers.\n", path_.data(), cs_.size());
+        for(;;) {
+            const int fd(::accept(lfd_, nullptr, nullptr));
+            if(stop_) {
+                if(fd >= 0) send_error(fd, "server stopping"), ::close(fd);
+                break;
+            }
+            if(fd < 0) {
+                if(errno == EINTR || errno == ECONNABORTED) continue;
+                LOG_EXIT("Could not accept connection: %s\n", std::strerror(errno));
+            }
+            std::unique_lock<std::mutex> lock(m_);
+            if(queue_.size() >= queue_size_) {
+                lock.unlock();
+                send_error(fd, "server busy");
+                ::close(fd);
+                continue;
+            }
+            queue_.push_back(request_t{fd, ++nrequests_, clock::now()});
+            lock.unlock();
+            cv_.notify_one();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_); // So that no worker misses the wakeup.
+        }
+        cv_.notify_all();
+        for(auto &worker: workers) worker.join();
+        LOG_INFO("Served %" PRIu64 " requests.\n", nrequests_);
+    }
+    // Wakes accept() by shutting the listening socket down.
+    void stop() {
+        stop_ = true;
+        ::shutdown(lfd_, SHUT_RDWR);
+    }
+};
+
+// Client side: sends header, then the contents of stream_path if set, and copies the response to out.
+// Returns false if the server answered with an error, which goes to stderr instead.
+bool submit_request(const char *socket_path, const std::string &header, const char *stream_path, std::FILE *out);
+
+} // namespace emp
+
+#endif // #ifndef _SERVE_H__
@@ -0,0 +1,141 @@
+#include "binning.h"
+#include "compress.h"
+#include "sample_gen.h"
+#include <fcntl.h>
+#include <fstream>
+
+namespace emp {
+
+TaxonBins::TaxonBins(const FlatTaxonomy &tax, bool classified, bool unclassified, unsigned max_open):
+    tax_(tax), classified_(classified), unclassified_(unclassified), max_open_(std::max(max_open, 1u)) {}
+
+// Preorder puts each node after its parent, so one pass gives each node the deepest selected node above it.
+void TaxonBins::select(const std::vector<bool> &selected) {
+    bin_.assign(tax_.nodes(), FlatTaxonomy::NONE);
+    for(u32 d(1); d < tax_.nodes(); ++d)
+        bin_[d] = selected[d] ? d: bin_[tax_.parent_dense(d)];
+}
+
+void TaxonBins::set_clades(const std::vector<tax_t> &clades) {
+    std::vector<bool> selected(tax_.nodes());
+    for(const tax_t clade: clades) {
+        if(!tax_.has(clade)) LOG_EXIT("Clade %u is not in the taxonomy.\n", clade);
+        selected[tax_.dense(clade)] = true;
+    }
+    select(selected);
+}
+
+void TaxonBins::set_rank(const char *rank, const char *nodes_path) {
+    if(classlvl_map.find(rank) == classlvl_map.end()) LOG_EXIT("Unknown rank %s.\n", rank);
+    std::ifstream ifs(nodes_path);
+    if(!ifs.good()) LOG_EXIT("Could not open %s to read ranks.\n", nodes_path);
+    std::vector<bool> selected(tax_.nodes());
+    size_t nranked(0), nlines(0);
+    for(std::string line; std::getline(ifs, line);) {
+        // taxid | parent | rank | ...
+        const char *p(std::strchr(line.data(), '|'));
+        if(p == nullptr || (p = std::strchr(p + 1, '|')) == nullptr) continue;
+        ++nlines;
+        while(*++p == ' ' || *p == '\t');
+        const char *q(p);
+        while(*q && *q != '\t' && *q != '|') ++q;
+        const tax_t taxon(std::strtoul(line.data(), nullptr, 10));
+        if(size_t(q - p) == std::strlen(rank) && std::memcmp(p, rank, q - p) == 0 && tax_.has(taxon))
+            selected[tax_.dense(taxon)] = true, ++nranked;
+    }
+    if(nlines == 0) LOG_EXIT("%s has no ranks. Pass a taxonomy in nodes.dmp format.\n", nodes_path);
+    LOG_INFO("Binning reads under %zu taxa of rank %s.\n", nranked, rank);
+    select(selected);
+}
+
+static void append_bin_record(const bseq1_t *bs, kstring_t *bks) {
+    kputc_('@', bks);
+    kputs(bs->name, bks);
+    if(bs->comment) kputc_(' ', bks), kputs(bs->comment, bks);
+    kputc_('\n', bks);
+    kputsn_(bs->seq, bs->l_seq, bks);
+    kputsn_("\n+\n", 3, bks);
+    if(bs->qual) kputsn_(bs->qual, bs->l_seq, bks);
+    else {
+        ks_resize(bks, bks->l + bs->l_seq + 1);
+        std::memset(bks->s + bks->l, TaxonBins::PLACEHOLDER_QUAL, bs->l_seq);
+        bks->l += bs->l_seq;
+    }
+    kputc_('\n', bks);
+}
+
+void append_bin_entry(tax_t bin, const bseq1_t *bs, const int is_paired, kstring_t *bks) {
+    const size_t start(bks->l);
+    const u32 header[2] {bin, 0};
+    kputsn_(header, sizeof(header), bks);
+    append_bin_record(bs, bks);
+    if(is_paired) append_bin_record(bs + 1, bks);
+    const u32 len(bks->l - start - sizeof(header));
+    std::memcpy(bks->s + start + sizeof(u32), &len, sizeof(len));
+}
+
+ReadBinner::ReadBinner(std::string prefix, unsigned max_open):
+    prefix_(std::move(prefix)), max_open_(std::max(max_open, 1u)), buffered_(0), clock_(0), nreads_(0), err_(0), closed_(false) {}
+
+ReadBinner::~ReadBinner() {
+    if(!closed_ && !close()) LOG_WARNING("Could not write read bins under %s: %s\n", prefix_.data(), std::strerror(errno));
+}
+
+std::string ReadBinner::path(tax_t taxon) const {
+    return prefix_ + (taxon ? std::to_string(taxon): std::string("unclassified")) + ".fq";
+}
+
+void ReadBinner::add(const char *s, size_t l) {
+    for(const char *end(s + l); s < end;) {
+        u32 header[2];
+        std::memcpy(header, s, sizeof(header));
+        s += sizeof(header);
+        bin_t &bin(bins_[header[0]]);
+        bin.buf_.putsn_(s, header[1]);
+        s += header[1], buffered_ += header[1], ++nreads_;
+        if(bin.buf_.size() >= FLUSH_SIZE) flush(header[0], bin);
+    }
+    if(buffered_ > MAX_BUFFERED)
+        for(auto &pair: bins_) flush(pair.first, pair.second);
+}
+
+// Opens the bin's file if need be, closing the least recently used one if max_open_ are open.
+void ReadBinner::flush(tax_t taxon, bin_t &bin) {
+    if(bin.buf_.size() == 0) return;
+    if(bin.fd_ < 0 && !err_) {
+        if(open_.size() >= max_open_) {
+            auto lru(std::min_element(open_.begin(), open_.end(), [this](tax_t a, tax_t b) {
+                return bins_[a].used_ < bins_[b].used_;
+            }));
+            bin_t &victim(bins_[*lru]);
+            ::close(victim.fd_), victim.fd_ = -1;
+            *lru = open_.back(), open_.pop_back();
+        }
+        const std::string fpath(path(taxon));
+        if((bin.fd_ = ::open(fpath.data(), O_WRONLY | O_CREAT | (bin.created_ ? O_APPEND: O_TRUNC), 0644)) < 0) err_ = errno;
+        else open_.push_back(taxon), bin.created_ = true;
+    }
+    if(!err_ && !write_all(bin.fd_, bin.buf_.data(), bin.buf_.size())) err_ = errno;
+    bin.used_ = ++clock_;
+    buffered_ -= bin.buf_.size();
+    bin.buf_.clear();
+}
+
+bool ReadBinner::close() {
+    if(closed_) {
+        errno = err_;
+        return err_ == 0;
+    }
+    closed_ = true;
+    for(auto &pair: bins_) flush(pair.first, pair.second);
+    for(const tax_t taxon: open_) {
+        bin_t &bin(bins_[taxon]);
+        if(::close(bin.fd_) && !err_) err_ = errno;
+        bin.fd_ = -1;
+    }
+    open_.clear();
+    errno = err_;
+    return err_ == 0;
+}
+
+} // namespace emp
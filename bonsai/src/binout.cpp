@@ -0,0 +1,219 @@
+#include "binout.h"
+#include "classifier.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+namespace emp {
+
+// Blocks formatted per thread in each batch of write_text.
+static constexpr size_t VIEW_BLOCKS_PER_THREAD = 4;
+
+static void append_read(const bseq1_t *bs, kstring_t *bks) {
+    const size_t l_name(std::strlen(bs->name));
+    kputvarint(l_name, bks);
+    kputsn_(bs->name, l_name + 1, bks);
+}
+
+static void append_seq(const bseq1_t *bs, kstring_t *bks) {
+    kputsn_(bs->seq, bs->l_seq, bks);
+    kputc_(bs->qual != nullptr, bks);
+    if(bs->qual) kputsn_(bs->qual, bs->l_seq, bks);
+}
+
+void append_binary_classification(const std::vector<tax_t> &taxa,
+                                  const tax_t taxon, const u32 ambig_count, const u32 missing_count,
+                                  const u32 skipped_count, const bseq1_t *bs, kstring_t *bks, const u32 flags,
+                                  const std::vector<tax_t> *segment_calls) {
+    append_read(bs, bks);
+    kputvarint(taxon, bks);
+    kputvarint(bs->l_seq, bks);
+    kputvarint(taxa.size() - missing_count - ambig_count, bks);
+    kputvarint(missing_count, bks);
+    kputvarint(ambig_count, bks);
+    kputvarint(skipped_count, bks);
+    kputvarint(segment_calls ? segment_calls->size(): 0, bks);
+    if(segment_calls) for(const tax_t call: *segment_calls) kputvarint(call, bks);
+    if((flags & BINOUT_RUNS) && taxon) {
+        size_t nruns(1);
+        for(size_t i(1); i < taxa.size(); ++i) nruns += taxa[i] != taxa[i - 1];
+        kputvarint(nruns, bks);
+        for(size_t i(0), end(taxa.size()), start; i < end;) {
+            for(start = i++; i < end && taxa[i] == taxa[start]; ++i);
+            kputvarint(u32(taxa[start] + 1), bks);
+            kputvarint(i - start, bks);
+        }
+    }
+    if(flags & BINOUT_SEQS) {
+        append_seq(bs, bks);
+        if(flags & BINOUT_PAIRED) {
+            append_read(bs + 1, bks);
+            kputvarint(bs[1].l_seq, bks);
+            append_seq(bs + 1, bks);
+        }
+    }
+}
+
+namespace {
+
+struct record_decoder {
+    const uint8_t *p_, *end_;
+    bool ok_;
+    u32 get() {
+        u64 v(0);
+        if(ok_ && (p_ = get_varint(p_, end_, v)) == nullptr) ok_ = false, p_ = end_;
+        return v;
+    }
+    const char *bytes(size_t n) {
+        if(!ok_ || size_t(end_ - p_) < n) {ok_ = false; return nullptr;}
+        const char *ret(reinterpret_cast<const char *>(p_));
+        p_ += n;
+        return ret;
+    }
+    void name(binout_read_t &r) {
+        r.l_name_ = get();
+        if((r.name_ = bytes(r.l_name_ + 1)) && r.name_[r.l_name_]) ok_ = false;
+    }
+    void seq(binout_read_t &r) {
+        r.seq_ = bytes(r.l_seq_);
+        const char *has_qual(bytes(1));
+        r.qual_ = has_qual && *has_qual ? bytes(r.l_seq_): nullptr;
+    }
+};
+
+struct view_data_t {
+    const BinaryCalls                &calls_;
+    size_t                            first_; // First block of the batch
+    std::vector<ks::string>          &out_;   // Per block of the batch
+    std::vector<std::vector<tax_t>>  &taxa_;  // Per thread
+    std::vector<binout_record_t>     &recs_;  // Per thread
+};
+
+void view_helper(void *data_, long index, int tid) {
+    view_data_t &data(*static_cast<view_data_t *>(data_));
+    data.out_[index].clear();
+    kstring_t *out(kspp2ks(data.out_[index]));
+    data.calls_.for_each(data.first_ + index, [&](const binout_record_t &rec) {
+        append_binary_as_text(rec, data.calls_.flags(), data.taxa_[tid], out);
+    }, data.recs_[tid]);
+}
+
+} // anonymous namespace
+
+const uint8_t *decode_binary_record(const uint8_t *p, const uint8_t *end, const u32 flags, binout_record_t &rec) {
+    record_decoder d{p, end, true};
+    d.name(rec.read_[0]);
+    rec.taxon_ = d.get();
+    rec.read_[0].l_seq_ = d.get();
+    rec.hits_ = d.get(), rec.missing_ = d.get(), rec.ambig_ = d.get(), rec.skipped_ = d.get();
+    rec.segment_calls_.clear();
+    for(u32 n(d.get()); d.ok_ && n; --n) rec.segment_calls_.push_back(d.get());
+    rec.runs_.clear();
+    if((flags & BINOUT_RUNS) && rec.taxon_)
+        for(u32 n(d.get()); d.ok_ && n; --n) {
+            const tax_t taxon(d.get() - 1);
+            rec.runs_.emplace_back(taxon, d.get());
+        }
+    rec.read_[0].seq_ = rec.read_[0].qual_ = nullptr;
+    rec.read_[1] = binout_read_t{nullptr, nullptr, nullptr, 0, 0};
+    if(flags & BINOUT_SEQS) {
+        d.seq(rec.read_[0]);
+        if(flags & BINOUT_PAIRED) {
+            d.name(rec.read_[1]);
+            rec.read_[1].l_seq_ = d.get();
+            d.seq(rec.read_[1]);
+        }
+    }
+    return d.ok_ ? d.p_: nullptr;
+}
+
+void append_binary_as_text(const binout_record_t &rec, const u32 flags, std::vector<tax_t> &taxa, kstring_t *ks) {
+    static const tax_counter no_hits; // Neither formatter reads them.
+    taxa.clear();
+    for(const auto &run: rec.runs_) taxa.insert(taxa.end(), run.second, run.first);
+    bseq1_t bs[2];
+    for(unsigned i(0); i < 2; ++i) {
+        const binout_read_t &r(rec.read_[i]);
+        bs[i] = bseq1_t{int(r.l_seq_), 0, 0, const_cast<char *>(r.name_), nullptr,
+                        const_cast<char *>(r.seq_), const_cast<char *>(r.qual_), nullptr};
+    }
+    if(flags & BINOUT_SEQS)
+        append_fastq_classification(no_hits, taxa, rec.taxon_, rec.ambig_, rec.missing_, rec.skipped_, bs, ks,
+                                    flags & BINOUT_RUNS, !!(flags & BINOUT_PAIRED), &rec.segment_calls_);
+    else
+        append_kraken_classification(no_hits, taxa, rec.taxon_, rec.ambig_, rec.missing_, rec.skipped_, bs, ks, &rec.segment_calls_);
+}
+
+BinaryCalls::BinaryCalls(const char *path): map_(nullptr), size_(0), nrecords_(0) {
+    const int fd(::open(path, O_RDONLY));
+    if(fd < 0) LOG_EXIT("Could not open %s for reading.\n", path);
+    struct stat st;
+    if(::fstat(fd, &st)) LOG_EXIT("Could not stat %s.\n", path);
+    if((size_ = st.st_size) < sizeof(h_)) LOG_EXIT("%s is not binary classify output.\n", path);
+    void *map(::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0));
+    if(map == MAP_FAILED) LOG_EXIT("Could not mmap %s (%zu bytes).\n", path, size_);
+    ::close(fd);
+    map_ = static_cast<const uint8_t *>(map);
+    std::memcpy(&h_, map_, sizeof(h_));
+    if(h_.magic_ != BINOUT_MAGIC) LOG_EXIT("%s is not binary classify output.\n", path);
+    if(h_.version_ > BINOUT_VERSION)
+        LOG_EXIT("%s has version %u, but only versions <= %u are supported.\n", path, h_.version_, BINOUT_VERSION);
+    binout_trailer_t t{0, 0, 0};
+    if(size_ >= sizeof(h_) + sizeof(t)) std::memcpy(&t, map_ + size_ - sizeof(t), sizeof(t));
+    const u64 data_end(t.index_offset_);
+    if(t.magic_ == BINOUT_INDEX_MAGIC && data_end >= sizeof(h_) && data_end <= size_ - sizeof(t) &&
+       t.nblocks_ == (size_ - sizeof(t) - data_end) / sizeof(binout_index_t) &&
+       (size_ - sizeof(t) - data_end) % sizeof(binout_index_t) == 0) {
+        index_.resize(t.nblocks_);
+        std::memcpy(index_.data(), map_ + data_end, t.nblocks_ * sizeof(binout_index_t));
+        for(size_t i(0); i < index_.size(); ++i) {
+            if(index_[i].offset_ < sizeof(h_) || index_[i].offset_ > data_end - sizeof(binout_block_t) ||
+               block(i).nbytes_ > data_end - sizeof(binout_block_t) - index_[i].offset_)
+                LOG_EXIT("Block %zu of %s lies outside of the file.\n", i, path);
+        }
+    } else {
+        binout_block_t b;
+        for(u64 offset(sizeof(h_)), first(0); offset + sizeof(b) <= size_; offset += sizeof(b) + b.nbytes_, first += b.nrecords_) {
+            std::memcpy(&b, map_ + offset, sizeof(b));
+            if(b.nbytes_ > size_ - offset - sizeof(b)) break;
+            index_.push_back(binout_index_t{offset, first});
+        }
+        LOG_WARNING("%s has no index, so it may be truncated. Read %zu complete blocks.\n", path, index_.size());
+    }
+    if(index_.size()) nrecords_ = index_.back().first_ + block(index_.size() - 1).nrecords_;
+}
+
+BinaryCalls::~BinaryCalls() {
+    ::munmap(const_cast<uint8_t *>(map_), size_);
+}
+
+// Formats a batch of blocks while the previous one is written, as ParallelDecompressor decodes.
+bool BinaryCalls::write_text(int fd, int nthreads) const {
+    nthreads = std::max(nthreads, 1);
+    const size_t batch(VIEW_BLOCKS_PER_THREAD * nthreads);
+    std::vector<ks::string> bufs[2];
+    std::vector<std::vector<tax_t>> taxa(nthreads);
+    std::vector<binout_record_t> recs(nthreads);
+    std::thread writer;
+    int err(0);
+    unsigned cur(0);
+    for(size_t first(0); first < nblocks(); first += batch, cur ^= 1) {
+        const size_t n(std::min(batch, nblocks() - first));
+        bufs[cur].resize(batch);
+        view_data_t data{*this, first, bufs[cur], taxa, recs};
+        kt_for(nthreads, &view_helper, (void *)&data, n);
+        if(writer.joinable()) writer.join();
+        if(err) break;
+        writer = std::thread([fd, n, &err, &out=bufs[cur]]() {
+            for(size_t i(0); i < n && !err; ++i)
+                if(!write_all(fd, out[i].data(), out[i].size())) err = errno;
+        });
+    }
+    if(writer.joinable()) writer.join();
+    errno = err;
+    return err == 0;
+}
+
+} // namespace emp
@@ -0,0 +1,17 @@
+#include "bloom.h"
+
+namespace emp {
+
+BlockedBloom::BlockedBloom(u64 nkeys, double bits_per_key): words_(nullptr), m_{0, 0, 0}, owns_(1) {
+    if(bits_per_key < 1.) LOG_EXIT("Bloom filter needs at least 1 bit per key. (Got %lf)\n", bits_per_key);
+    const u64 nbits(std::max(u64(nkeys * bits_per_key), u64(512)));
+    m_.nblocks_ = (nbits + 511) / 512;
+    if(m_.nblocks_ >> 32) LOG_EXIT("Bloom filter of %" PRIu64 " bits is too large.\n", nbits);
+    // ln 2 * bits_per_key hashes is optimal for a flat filter; blocked filters do best with a few less.
+    // 7 9-bit fields fit in the 64-bit remix.
+    m_.nhashes_ = std::min(7u, std::max(1u, unsigned(bits_per_key * 0.6)));
+    if((words_ = static_cast<u64 *>(std::calloc(nwords(), sizeof(*words_)))) == nullptr)
+        LOG_EXIT("Could not allocate %zu bytes for Bloom filter.\n", size_t(bytes()));
+}
+
+} // namespace emp
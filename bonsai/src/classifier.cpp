@@ -1,29 +1,81 @@
 #include "classifier.h"
+#include <sstream>
 
 namespace emp {
 
 
+template<typename ScoreType>
 void kt_for_helper(void *data_, long index, int tid) {
-    kt_data *data((kt_data *)data_);
+    kt_data<ScoreType> *data((kt_data<ScoreType> *)data_);
     size_t retstr_size(0);
     const int inc(!!data->is_paired_ + 1);
-    Encoder<score::Lex> enc(data->c_.enc_);
-    std::vector<tax_t> taxa;
-    for(unsigned i(index * data->per_set_),end(std::min(i + data->per_set_, data->total_));
-        i < end;
-        i += inc)
-            retstr_size += classify_seq(data->c_, enc, data->taxmap, data->bs_ + i, data->is_paired_, taxa);
+    const long ngroups(data->bounds_.size() - 1);
+    auto &w(data->c_.worker(tid));
+    data->c_.pin(tid);
+    if(index >= ngroups) {
+        classify_segment(data->c_, w.enc_, data->tax_, data->bs_, data->segments_[index - ngroups], w.kmers_, tid);
+        return;
+    }
+    for(unsigned i(data->bounds_[index]), end(data->bounds_[index + 1]); i < end; i += inc) {
+        if(data->c_.segmented(data->bs_[i], data->is_paired_)) continue;
+        auto &ref(data->c_.out_refs_[i]);
+        ref.tid_ = tid, ref.offset_ = w.out_.size(), ref.bin_offset_ = w.bin_out_.size();
+        retstr_size += (ref.len_ = classify_seq(data->c_, w.enc_, data->tax_, data->bs_ + i, data->is_paired_, w.taxa_, w.kmers_, tid, kspp2ks(w.out_), kspp2ks(w.bin_out_)));
+        ref.bin_len_ = w.bin_out_.size() - ref.bin_offset_;
+    }
     data->retstr_size_ += retstr_size;
 }
+template void kt_for_helper<score::Lex>(void *data_, long index, int tid);
+template void kt_for_helper<score::Entropy>(void *data_, long index, int tid);
+
+// Looks up segment rescan_[index] again in the next stage of the cascade.
+template<typename ScoreType>
+void kt_rescan_helper(void *data_, long index, int tid) {
+    kt_data<ScoreType> *data((kt_data<ScoreType> *)data_);
+    auto &w(data->c_.worker(tid));
+    data->c_.pin(tid);
+    classify_segment(data->c_, w.enc_, data->tax_, data->bs_, data->segments_[data->rescan_[index]], w.kmers_, tid, data->stage_);
+}
+template void kt_rescan_helper<score::Lex>(void *data_, long index, int tid);
+template void kt_rescan_helper<score::Entropy>(void *data_, long index, int tid);
+
+// Merges the hits of split read index's segments and calls it.
+template<typename ScoreType>
+void kt_merge_helper(void *data_, long index, int tid) {
+    kt_data<ScoreType> *data((kt_data<ScoreType> *)data_);
+    auto &w(data->c_.worker(tid));
+    data->c_.pin(tid);
+    tax_counter hit_counts;
+    std::vector<tax_t> calls;
+    u32 ambig_count(0), missing_count(0);
+    const unsigned first(data->segment_bounds_[index]), end(data->segment_bounds_[index + 1]);
+    w.taxa_.clear();
+    for(unsigned i(first); i < end; ++i) {
+        const segment_t &seg(data->segments_[i]);
+        hit_counts.merge(seg.hit_counts_);
+        w.taxa_.insert(w.taxa_.end(), seg.taxa_.begin(), seg.taxa_.end());
+        ambig_count += seg.ambig_count_, missing_count += seg.missing_count_;
+        if(data->c_.emit_segments_) calls.push_back(data->tax_.resolve_tree(seg.hit_counts_));
+    }
+    auto &ref(data->c_.out_refs_[data->segments_[first].read_]);
+    ref.tid_ = tid, ref.offset_ = w.out_.size(), ref.bin_offset_ = w.bin_out_.size();
+    data->retstr_size_ += (ref.len_ = finish_read(data->c_, data->tax_, data->bs_ + data->segments_[first].read_, 0, w.taxa_, hit_counts,
+                                                  ambig_count, missing_count, 0, tid, kspp2ks(w.out_), data->c_.emit_segments_ ? &calls: nullptr,
+                                                  kspp2ks(w.bin_out_)));
+    ref.bin_len_ = w.bin_out_.size() - ref.bin_offset_;
+}
+template void kt_merge_helper<score::Lex>(void *data_, long index, int tid);
+template void kt_merge_helper<score::Entropy>(void *data_, long index, int tid);
 
 void append_fastq_classification(const tax_counter &hit_counts,
                                  const std::vector<tax_t> &taxa,
                                  const tax_t taxon, const u32 ambig_count, const u32 missing_count,
-                                 bseq1_t *bs, kstring_t *bks, const int verbose, const int is_paired) {
-    char *cms, *cme; // comment start, comment end -- used for using comment in both output reads.
+                                 const u32 skipped_count, bseq1_t *bs, kstring_t *bks, const int verbose, const int is_paired,
+                                 const std::vector<tax_t> *segment_calls) {
+    size_t cms, cme; // comment start, comment end -- used for using comment in both output reads. Offsets, as bks may move.
     kputs(bs->name, bks);
     kputc_(' ', bks);
-    cms = bks->s + bks->l;
+    cms = bks->l;
     static const char lut[] {'C', 'U'};
     kputc_(lut[taxon == 0], bks);
     kputc_('\t', bks);
@@ -33,9 +85,11 @@ void append_fastq_classification(const tax_counter &hit_counts,
     kputc_('\t', bks);
     append_counts(missing_count, 'M', bks);
     append_counts(ambig_count,   'A', bks);
+    append_counts(skipped_count, 'S', bks); // Left unprobed by early exit
+    append_segment_calls(segment_calls, bks);
     if(verbose) append_taxa_runs(taxon, taxa, bks);
     else        bks->s[bks->l - 1] = '\n';
-    cme = bks->s + bks->l;
+    cme = bks->l;
     // And now add the rest of the fastq record
     kputsn_(bs->seq, bs->l_seq, bks);
     kputsn_("\n+\n", 3, bks);
@@ -44,7 +98,8 @@ void append_fastq_classification(const tax_counter &hit_counts,
     if(is_paired) {
         kputs((bs + 1)->name, bks);
         kputc_(' ', bks);
-        kputsn_(cms, (int)(cme - cms), bks); // Add comment section in.
+        ks_resize(bks, bks->l + (cme - cms) + 1);
+        kputsn_(bks->s + cms, cme - cms, bks); // Add comment section in.
         kputc_('\n', bks);
         kputsn_((bs + 1)->seq, (bs + 1)->l_seq, bks);
         kputsn_("\n+\n", 3, bks);
@@ -57,7 +112,8 @@ void append_fastq_classification(const tax_counter &hit_counts,
 void append_kraken_classification(const tax_counter &hit_counts,
                                   const std::vector<tax_t> &taxa,
                                   const tax_t taxon, const u32 ambig_count, const u32 missing_count,
-                                  bseq1_t *bs, kstring_t *bks) {
+                                  const u32 skipped_count, bseq1_t *bs, kstring_t *bks,
+                                  const std::vector<tax_t> *segment_calls) {
     static const char tbl[]{'C', 'U'};
     kputc_(tbl[!taxon], bks);
     kputc_('\t', bks);
@@ -69,12 +125,14 @@ void append_kraken_classification(const tax_counter &hit_counts,
     kputc_('\t', bks);
     append_counts(missing_count, 'M', bks);
     append_counts(ambig_count,   'A', bks);
+    append_counts(skipped_count, 'S', bks); // Left unprobed by early exit
+    append_segment_calls(segment_calls, bks);
     append_taxa_runs(taxon, taxa, bks);
     bks->s[bks->l] = '\0';
 }
 
 void append_taxa_runs(tax_t taxon, const std::vector<tax_t> &taxa, kstring_t *bks) {
-    if(taxon) {
+    if(taxon && taxa.size()) {
         tax_t last_taxa(taxa[0]);
         unsigned taxa_run(1);
         for(unsigned i(1), end(taxa.size()); i != end; ++i) {
@@ -91,11 +149,35 @@ void append_taxa_runs(tax_t taxon, const std::vector<tax_t> &taxa, kstring_t *bk
     } else kputsn("0:0\n", 4, bks);
 }
 
-void kt_del_helper(void *data_, long index, int tid) {
-    del_data *data((del_data *)data_);
-    for(unsigned i(index * data->per_set_), end(std::min(i + data->per_set_, data->total_));
-        i < end; ++i)
-            bseq_destroy(data->seqs_ + i);
+std::vector<sample_t> parse_manifest(const char *path) {
+    std::ifstream ifs(path);
+    if(!ifs.good()) LOG_EXIT("Could not open manifest %s.\n", path);
+    std::vector<sample_t> ret;
+    std::string line;
+    for(size_t lineno(1); std::getline(ifs, line); ++lineno) {
+        std::istringstream iss(line);
+        std::vector<std::string> fields;
+        for(std::string field; iss >> field; fields.push_back(std::move(field)));
+        if(fields.empty() || fields[0][0] == '#') continue;
+        if(fields.size() < 3 || fields.size() > 4)
+            LOG_EXIT("Line %zu of manifest %s should be <name> <output> <r1.fq> [<r2.fq>].\n", lineno, path);
+        ret.emplace_back(fields[0], fields[2], fields.size() == 4 ? fields[3]: std::string(), fields[1]);
+    }
+    if(ret.empty()) LOG_EXIT("Manifest %s lists no samples.\n", path);
+    return ret;
+}
+
+void sample_t::write(const void *s, size_t l) {
+    if(zout_) zout_->write(s, l);
+    else if(out_ && !write_errno_ && !write_all(fileno(out_), static_cast<const char *>(s), l)) write_errno_ = errno;
+    out_bytes_ += l;
+}
+
+void write_sample_summary(const std::vector<sample_t> &samples, std::FILE *fp) {
+    std::fputs("#Sample\tReads\tClassified\tUnclassified\n", fp);
+    for(const auto &sample: samples)
+        std::fprintf(fp, "%s\t%" PRIu64 "\t%" PRIu64 "\t%" PRIu64 "\n", sample.name_.data(),
+                     sample.nreads_, sample.nclassified_, sample.nreads_ - sample.nclassified_);
 }
 
 } // namespace emp
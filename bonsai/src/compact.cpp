@@ -0,0 +1,73 @@
+#include "compact.h"
+
+namespace emp {
+
+CompactTable::CompactTable(const khash_t(c) *map, const FlatTaxonomy &tax, double load, u32 extra_vbits, u32 sbits):
+    CompactTable()
+{
+    if(load <= 0. || load >= 1.) LOG_EXIT("Load factor must be in (0, 1). (Got %lf)\n", load);
+    // Dense taxon indices, starting at 1.
+    std::unordered_map<tax_t, u32> index;
+    std::vector<tax_t> taxa{0};
+    for(khiter_t ki(0); ki != kh_end(map); ++ki)
+        if(kh_exist(map, ki) && index.find(kh_val(map, ki)) == index.end())
+            index.emplace(kh_val(map, ki), taxa.size()), taxa.push_back(kh_val(map, ki));
+    m_.vbits_ = std::max(1, 64 - __builtin_clzll(taxa.size())) + extra_vbits;
+    if(m_.vbits_ > 28) LOG_EXIT("Too many taxa (%zu) for a compact table.\n", taxa.size());
+    m_.fbits_ = 32 - m_.vbits_;
+    if(m_.fbits_ < 12) LOG_WARNING("Only %u fingerprint bits are left with %zu taxa. Expect false positives.\n", m_.fbits_, taxa.size());
+    // Taxa which only appear as lcas of colliding keys take the rest of the value space.
+    const u64 max_taxa(u64(1) << m_.vbits_);
+
+    const u64 needed(std::max(u64(kh_size(map) / load) + 1, u64(2)));
+    // Small tables get smaller partitions so that rounding up to a whole partition wastes little space,
+    // but partitions need to stay large enough that none of them overflows. Tiny tables are a single partition.
+    while(sbits > 10 && (u64(1) << sbits) * 64 > needed) --sbits;
+    while(sbits > 1 && (u64(1) << (sbits - 1)) >= needed) --sbits;
+    m_.sbits_  = sbits;
+    m_.nparts_ = (needed + (u64(1) << sbits) - 1) >> sbits;
+    m_.ncells_ = m_.nparts_ << sbits;
+    if((cells_ = static_cast<u32 *>(std::calloc(m_.ncells_, sizeof(*cells_)))) == nullptr)
+        LOG_EXIT("Could not allocate %zu bytes for compact table.\n", size_t(m_.ncells_ * sizeof(*cells_)));
+    owns_ = 1;
+
+    const u32 smask(part_size() - 1);
+    u64 ncollisions(0);
+    for(khiter_t ki(0); ki != kh_end(map); ++ki) {
+        if(!kh_exist(map, ki)) continue;
+        const u64 hash(wang_hash(kh_key(map, ki)));
+        u32 *part(const_cast<u32 *>(partition(hash)));
+        const u32 fp(fingerprint(hash));
+        u32 i(hash & smask), step(0);
+        while(part[i] && (part[i] >> m_.vbits_) != fp) {
+            i = (i + 1) & smask;
+            if(++step > smask) LOG_EXIT("Compact table partition is full. Try a lower load factor.\n");
+        }
+        if(part[i] == 0) {
+            part[i] = (fp << m_.vbits_) | index[kh_val(map, ki)];
+            ++m_.size_;
+            continue;
+        }
+        // Two keys share a fingerprint in this partition: only one cell can represent them.
+        ++ncollisions;
+        const tax_t prev(taxa[part[i] & vmask()]), merged(tax.lca(prev, kh_val(map, ki)));
+        if(merged == tax_t(-1))
+            LOG_EXIT("Taxa %u and %u have no common ancestor. Was the database built with this taxonomy?\n", prev, kh_val(map, ki));
+        auto it(index.find(merged));
+        if(it == index.end()) {
+            if(taxa.size() == max_taxa)
+                LOG_EXIT("Ran out of the %u value bits for the lcas of colliding keys (%zu taxa). Rebuild with more value bits.\n",
+                         m_.vbits_, taxa.size());
+            it = index.emplace(merged, taxa.size()).first;
+            taxa.push_back(merged);
+        }
+        part[i] = (fp << m_.vbits_) | it->second;
+    }
+    m_.ntaxa_ = taxa.size();
+    taxa_ = static_cast<tax_t *>(std::malloc(sizeof(tax_t) * taxa.size()));
+    std::memcpy(taxa_, taxa.data(), sizeof(tax_t) * taxa.size());
+    LOG_INFO("Compact table: %zu cells in %zu partitions for %zu keys (%zu fingerprint collisions). %zu bytes, %u fingerprint bits.\n",
+             size_t(m_.ncells_), size_t(m_.nparts_), size_t(kh_size(map)), size_t(ncollisions), size_t(bytes()), m_.fbits_);
+}
+
+} // namespace emp
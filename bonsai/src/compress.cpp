@@ -0,0 +1,190 @@
+#include "compress.h"
+#include <cstring>
+#if ZWRAP_USE_ZSTD
+#  define ZSTD_STATIC_LINKING_ONLY
+#  include "zstd.h"
+#endif
+
+namespace emp {
+
+namespace {
+
+// The empty member bgzip ends files with.
+const unsigned char BGZF_EOF[28] {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0, 27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+
+INLINE void put16(char *p, u32 v) {p[0] = v, p[1] = v >> 8;}
+INLINE void put32(char *p, u32 v) {put16(p, v), put16(p + 2, v >> 16);}
+
+// Appends in[0, n) to out as one BGZF member: a gzip member with its total size in a 'BC' extra subfield.
+void append_bgzf_member(z_stream &zs, const char *in, size_t n, std::vector<char> &out) {
+    static const unsigned char header[16] {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0};
+    const size_t start(out.size());
+    out.resize(start + 18 + deflateBound(&zs, n) + 8);
+    char *p(out.data() + start);
+    std::memcpy(p, header, sizeof(header));
+    if(deflateReset(&zs) != Z_OK) LOG_EXIT("Could not reset deflate stream.\n");
+    zs.next_in   = (Bytef *)in;
+    zs.avail_in  = n;
+    zs.next_out  = (Bytef *)(p + 18);
+    zs.avail_out = out.size() - start - 26;
+    if(deflate(&zs, Z_FINISH) != Z_STREAM_END) LOG_EXIT("Could not compress a block of output.\n");
+    const size_t size(18 + zs.total_out + 8);
+    put16(p + 16, size - 1);
+    put32(p + size - 8, crc32(crc32(0, nullptr, 0), (const Bytef *)in, n));
+    put32(p + size - 4, n);
+    out.resize(start + size);
+}
+
+} // anonymous namespace
+
+int parse_compression(const char *s) {
+    if(std::strcmp(s, "none") == 0) return COMPRESS_NONE;
+    if(std::strcmp(s, "gzip") == 0) return COMPRESS_GZIP;
+    if(std::strcmp(s, "zstd") == 0) return COMPRESS_ZSTD;
+    LOG_EXIT("Unknown compression format %s. Options: none, gzip, zstd.\n", s);
+    return COMPRESS_NONE;
+}
+
+ParallelCompressor::ParallelCompressor(int fd, int format, unsigned nthreads, int level):
+    fd_(fd), format_(format), level_(level), cur_(nullptr),
+    max_blocks_(MAX_BLOCKS_PER_THREAD * std::max(nthreads, 1u) + 1), stop_(false), closed_(false), err_(0)
+{
+#if !ZWRAP_USE_ZSTD
+    if(format_ == COMPRESS_ZSTD) LOG_EXIT("zstd output needs the _z build.\n");
+#endif
+    blocks_.emplace_back(new block_t());
+    cur_ = blocks_.back().get();
+    cur_->in_.reserve(BLOCK_SIZE);
+    if(format_ != COMPRESS_NONE)
+        for(unsigned i(0); i < std::max(nthreads, 1u); ++i) compressors_.emplace_back(&ParallelCompressor::compress_loop, this);
+    writer_ = std::thread(&ParallelCompressor::write_loop, this);
+}
+
+ParallelCompressor::~ParallelCompressor() {
+    if(!closed_ && !close()) LOG_WARNING("Could not write output: %s\n", std::strerror(errno));
+}
+
+void ParallelCompressor::write(const void *s, size_t l) {
+    if(closed_) return;
+    for(const char *p(static_cast<const char *>(s)); l;) {
+        const size_t n(std::min(l, BLOCK_SIZE - cur_->in_.size()));
+        cur_->in_.insert(cur_->in_.end(), p, p + n);
+        p += n, l -= n;
+        if(cur_->in_.size() == BLOCK_SIZE) submit();
+    }
+}
+
+// Hands cur_ on and takes a free block in its place, waiting for one if max_blocks_ are in use.
+void ParallelCompressor::submit() {
+    std::unique_lock<std::mutex> lock(lock_);
+    cur_->done_ = format_ == COMPRESS_NONE;
+    inflight_.push_back(cur_);
+    if(!cur_->done_) pending_.push_back(cur_);
+    cv_.notify_all();
+    cv_.wait(lock, [this]() {return free_.size() || blocks_.size() < max_blocks_;});
+    if(free_.empty()) {
+        blocks_.emplace_back(new block_t());
+        cur_ = blocks_.back().get();
+        cur_->in_.reserve(BLOCK_SIZE);
+    } else cur_ = free_.back(), free_.pop_back();
+    cur_->in_.clear();
+}
+
+void ParallelCompressor::compress_loop() {
+    z_stream zs;
+    std::memset(&zs, 0, sizeof(zs));
+    if(format_ == COMPRESS_GZIP) {
+        int rc;
+#if ZWRAP_USE_ZSTD
+        {
+            // The zlib wrapper would make zstd frames of streams set up while it is switched on.
+            static std::mutex wrapper_lock;
+            std::lock_guard<std::mutex> guard(wrapper_lock);
+            const int prev(ZWRAP_isUsingZSTDcompression());
+            ZWRAP_useZSTDcompression(0);
+            rc = deflateInit2(&zs, level_ < 0 ? Z_DEFAULT_COMPRESSION: level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+            ZWRAP_useZSTDcompression(prev);
+        }
+#else
+        rc = deflateInit2(&zs, level_ < 0 ? Z_DEFAULT_COMPRESSION: level_, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+#endif
+        if(rc != Z_OK) LOG_EXIT("Could not set up deflate stream (level %i).\n", level_);
+    }
+#if ZWRAP_USE_ZSTD
+    ZSTD_CCtx *cctx(format_ == COMPRESS_ZSTD ? ZSTD_createCCtx(): nullptr);
+#endif
+    for(;;) {
+        block_t *b;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            cv_.wait(lock, [this]() {return stop_ || pending_.size();});
+            if(pending_.empty()) break;
+            b = pending_.front();
+            pending_.pop_front();
+        }
+        b->out_.clear();
+        if(format_ == COMPRESS_GZIP) {
+            for(size_t i(0); i < b->in_.size(); i += BGZF_BLOCK_SIZE)
+                append_bgzf_member(zs, b->in_.data() + i, std::min(BGZF_BLOCK_SIZE, b->in_.size() - i), b->out_);
+        }
+#if ZWRAP_USE_ZSTD
+        else {
+            // The frame records its decoded size, which ParallelDecompressor needs to decode it in place.
+            b->out_.resize(ZSTD_compressBound(b->in_.size()));
+            const size_t rc(ZSTD_compressCCtx(cctx, b->out_.data(), b->out_.size(), b->in_.data(), b->in_.size(),
+                                              level_ < 0 ? ZSTD_CLEVEL_DEFAULT: level_));
+            if(ZSTD_isError(rc)) LOG_EXIT("Could not compress a block of output: %s\n", ZSTD_getErrorName(rc));
+            b->out_.resize(rc);
+        }
+#endif
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            b->done_ = true;
+        }
+        cv_.notify_all();
+    }
+    if(format_ == COMPRESS_GZIP) deflateEnd(&zs);
+#if ZWRAP_USE_ZSTD
+    ZSTD_freeCCtx(cctx);
+#endif
+}
+
+void ParallelCompressor::write_loop() {
+    for(;;) {
+        block_t *b;
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            cv_.wait(lock, [this]() {return (inflight_.size() && inflight_.front()->done_) || (stop_ && inflight_.empty());});
+            if(inflight_.empty()) break;
+            b = inflight_.front();
+        }
+        const std::vector<char> &out(format_ == COMPRESS_NONE ? b->in_: b->out_);
+        if(!err_ && !write_all(fd_, out.data(), out.size())) err_ = errno;
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            inflight_.pop_front();
+            free_.push_back(b);
+        }
+        cv_.notify_all();
+    }
+}
+
+bool ParallelCompressor::close() {
+    if(!closed_) {
+        closed_ = true;
+        if(cur_->in_.size()) submit();
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for(auto &t: compressors_) t.join();
+        writer_.join();
+        if(!err_ && format_ == COMPRESS_GZIP && !write_all(fd_, reinterpret_cast<const char *>(BGZF_EOF), sizeof(BGZF_EOF)))
+            err_ = errno;
+    }
+    errno = err_;
+    return err_ == 0;
+}
+
+} // namespace emp
@@ -0,0 +1,233 @@
+#include "decompress.h"
+#include "klib/kthread.h"
+#include <csignal>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if ZWRAP_USE_ZSTD
+#  define ZSTD_STATIC_LINKING_ONLY
+#  include "zstd.h"
+#endif
+
+namespace emp {
+
+namespace {
+
+enum block_format {
+    UNKNOWN,
+    BGZF,
+    ZSTD
+};
+
+struct block_t {
+    size_t offset_, size_, out_offset_, out_size_;
+};
+
+// BGZF members carry their total size in a 'BC' extra subfield and their decoded size in the trailer.
+// Returns 0 if p does not start with a complete BGZF member.
+size_t bgzf_block(const u8 *p, size_t avail, size_t &usize) {
+    if(avail < 28 || p[0] != 31 || p[1] != 139 || p[2] != 8 || (p[3] & 4) == 0) return 0;
+    const size_t xlen(p[10] | (p[11] << 8));
+    if(avail < 12 + xlen) return 0;
+    for(const u8 *x(p + 12), *end(p + 12 + xlen); x + 4 <= end; x += 4 + (x[2] | (x[3] << 8))) {
+        if(x[0] != 'B' || x[1] != 'C' || (x[2] | (x[3] << 8)) != 2 || x + 6 > end) continue;
+        const size_t bsize((x[4] | (x[5] << 8)) + 1);
+        if(bsize > avail || bsize < 12 + xlen + 8) return 0;
+        const u8 *t(p + bsize - 4);
+        usize = u32(t[0]) | (u32(t[1]) << 8) | (u32(t[2]) << 16) | (u32(t[3]) << 24);
+        return bsize;
+    }
+    return 0;
+}
+
+#if ZWRAP_USE_ZSTD
+// Only frames which record their decoded size can be decoded in place.
+size_t zstd_block(const u8 *p, size_t avail, size_t &usize) {
+    if(avail < 4 || ZSTD_isFrame(p, avail) == 0) return 0;
+    const size_t csize(ZSTD_findFrameCompressedSize(p, avail));
+    if(ZSTD_isError(csize)) return 0;
+    const unsigned long long fsize(ZSTD_getFrameContentSize(p, csize));
+    if(fsize == ZSTD_CONTENTSIZE_UNKNOWN || fsize == ZSTD_CONTENTSIZE_ERROR) return 0;
+    usize = fsize;
+    return csize;
+}
+#endif
+
+size_t next_block(block_format fmt, const u8 *p, size_t avail, size_t &usize) {
+    switch(fmt) {
+        case BGZF: return bgzf_block(p, avail, usize);
+#if ZWRAP_USE_ZSTD
+        case ZSTD: return zstd_block(p, avail, usize);
+#endif
+        default: return 0;
+    }
+}
+
+struct decode_data_t {
+    block_format fmt_;
+    const u8 *in_;
+    const std::vector<block_t> &blocks_;
+    char *out_;
+    std::atomic<long> bad_; // Index of a block which could not be decoded, or -1
+};
+
+void decode_helper(void *data_, long index, int tid) {
+    decode_data_t &data(*(decode_data_t *)data_);
+    const block_t &b(data.blocks_[index]);
+    if(b.out_size_ == 0) return;
+    bool ok;
+#if ZWRAP_USE_ZSTD
+    if(data.fmt_ == ZSTD) {
+        const size_t rc(ZSTD_decompress(data.out_ + b.out_offset_, b.out_size_, data.in_ + b.offset_, b.size_));
+        ok = !ZSTD_isError(rc) && rc == b.out_size_;
+    } else
+#endif
+    {
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        zs.next_in   = (Bytef *)(data.in_ + b.offset_);
+        zs.avail_in  = b.size_;
+        zs.next_out  = (Bytef *)(data.out_ + b.out_offset_);
+        zs.avail_out = b.out_size_;
+        ok = inflateInit2(&zs, 15 + 16) == Z_OK;
+        ok = ok && inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == b.out_size_;
+        inflateEnd(&zs);
+    }
+    if(!ok) data.bad_ = index;
+}
+
+} // anonymous namespace
+
+ParallelDecompressor::ParallelDecompressor(const char *path, unsigned nthreads):
+    path_(path ? path: ""), nthreads_(nthreads), fp_(nullptr), wfd_(-1), stop_(false), failed_(false)
+{
+    if(path == nullptr) return;
+    if(nthreads_ == 0) {
+        fp_ = gzopen(path, "rb");
+        return;
+    }
+    if(::access(path, R_OK)) return;
+    int fds[2];
+    if(::pipe(fds)) throw std::runtime_error(std::string("Could not create pipe for ") + path + ": " + std::strerror(errno));
+#ifdef F_SETPIPE_SZ
+    ::fcntl(fds[1], F_SETPIPE_SZ, PIPE_SIZE); // Only a hint: small pipes just mean more context switches.
+#endif
+    if((fp_ = gzdopen(fds[0], "rb")) == nullptr) {
+        ::close(fds[0]), ::close(fds[1]);
+        throw std::runtime_error(std::string("Could not gzdopen pipe for ") + path);
+    }
+    wfd_ = fds[1];
+    producer_ = std::thread(&ParallelDecompressor::produce, this);
+}
+
+ParallelDecompressor::~ParallelDecompressor() {
+    stop_ = true;
+    // Closing the read end first unblocks the producer if the parser stopped early.
+    if(fp_) gzclose(fp_);
+    if(producer_.joinable()) producer_.join();
+}
+
+bool ParallelDecompressor::write_all(const char *s, size_t l) {
+    while(l && !stop_) {
+        const ssize_t rc(::write(wfd_, s, l));
+        if(rc < 0) {
+            if(errno == EINTR) continue;
+            if(errno != EPIPE) LOG_WARNING("Could not write decoded data for %s: %s\n", path_.data(), std::strerror(errno));
+            stop_ = true;
+            break;
+        }
+        s += rc, l -= rc;
+    }
+    return !stop_;
+}
+
+void ParallelDecompressor::fail(std::string msg) {
+    LOG_WARNING("%s\n", msg.data());
+    error_ = std::move(msg);
+    failed_ = true;
+    stop_ = true;
+}
+
+// Single-threaded fallback: decode from offset onwards and write to the pipe as fast as the parser takes it.
+void ParallelDecompressor::stream_from(size_t offset) {
+    const int fd(::open(path_.data(), O_RDONLY));
+    if(fd < 0 || (offset && ::lseek(fd, offset, SEEK_SET) != off_t(offset))) {
+        fail("Could not open " + path_ + " for reading: " + std::strerror(errno));
+        if(fd >= 0) ::close(fd);
+        return;
+    }
+    gzFile fp(gzdopen(fd, "rb"));
+    gzbuffer(fp, 1 << 17);
+    std::vector<char> buf(1 << 20);
+    int n;
+    while((n = gzread(fp, buf.data(), buf.size())) > 0 && write_all(buf.data(), n));
+    // gzread takes a truncated stream for EOF, leaving only gzerror to say otherwise.
+    int err(Z_OK);
+    const char *msg(gzerror(fp, &err)), *fd_end(std::strstr(msg, ">: "));
+    if(n < 0 || err != Z_OK) fail("Could not decode " + path_ + ": " + (fd_end ? fd_end + 3: msg)); // Drop gzdopen's "<fd:n>: "
+    gzclose(fp);
+}
+
+void ParallelDecompressor::produce() {
+    // Get EPIPE instead of being killed if the parser closes its end early.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+
+    size_t offset(0);
+    struct stat st;
+    const int fd(::open(path_.data(), O_RDONLY));
+    const u8 *in(nullptr);
+    if(fd >= 0 && ::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *map(::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+        if(map != MAP_FAILED) in = static_cast<const u8 *>(map), ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+    if(fd >= 0) ::close(fd);
+
+    block_format fmt(UNKNOWN);
+    size_t usize;
+    bool done(false);
+    if(in) {
+        const size_t size(st.st_size);
+        if(bgzf_block(in, size, usize)) fmt = BGZF;
+#if ZWRAP_USE_ZSTD
+        else if(zstd_block(in, size, usize)) fmt = ZSTD;
+#endif
+        LOG_DEBUG("Decoding %s %s.\n", path_.data(), fmt == UNKNOWN ? "in one thread": "in parallel");
+        // Decode batch i while the previous one is being written.
+        std::vector<block_t> blocks;
+        std::vector<char> bufs[2];
+        std::thread writer;
+        unsigned cur(0);
+        const size_t batch_bytes(BATCH_BYTES_PER_THREAD * nthreads_);
+        while(fmt != UNKNOWN && offset < size && !stop_) {
+            blocks.clear();
+            size_t in_bytes(0), out_bytes(0), bsize;
+            while(offset < size && in_bytes < batch_bytes && (bsize = next_block(fmt, in + offset, size - offset, usize))) {
+                blocks.push_back(block_t{offset, bsize, out_bytes, usize});
+                offset += bsize, in_bytes += bsize, out_bytes += usize;
+            }
+            if(blocks.empty()) break; // Not a block we can decode in place: stream the rest.
+            bufs[cur].resize(out_bytes);
+            decode_data_t data{fmt, in, blocks, bufs[cur].data(), {-1}};
+            kt_for(nthreads_, &decode_helper, (void *)&data, blocks.size());
+            if(writer.joinable()) writer.join();
+            if(data.bad_ >= 0) {
+                fail("Could not decode " + path_ + ": corrupt block at offset " + std::to_string(blocks[data.bad_].offset_));
+                break;
+            }
+            writer = std::thread([this, &buf=bufs[cur]]() {write_all(buf.data(), buf.size());});
+            cur ^= 1;
+        }
+        if(writer.joinable()) writer.join();
+        ::munmap((void *)in, size);
+        done = offset == size;
+    }
+    if(!done && !stop_) stream_from(offset);
+    ::close(wfd_);
+}
+
+} // namespace emp
@@ -24,6 +24,7 @@ void dist_usage(const char *arg) {
                          "-e\tEmit in scientific notation\n"
                          "-f\tReport results as float. (Only important for binary format.) This halves the memory footprint at the cost of precision loss.\n"
                          "-F\tGet paths to genomes from file rather than positional arguments\n"
+                         "-Z\tCompress -o and -O output as none, gzip (BGZF) or zstd, on -p threads alongside the comparisons [none]\n"
                 , arg);
     std::exit(EXIT_FAILURE);
 }
@@ -82,7 +83,7 @@ namespace detail {
 
 struct kt_sketch_helper {
     std::vector<hll::hll_t>  &hlls_; // HyperLogLog scratch space
-    std::vector<kseq_t>     &kseqs_;
+    std::vector<SeqScanner> &scanners_;
     const int bs_, sketch_size_, kmer_size_, window_size_, csz_;
     const spvec_t sv_;
     std::vector<std::vector<std::string>> &ssvec_; // scratch string vector
@@ -105,7 +106,7 @@ void kt_for_helper(void  *data_, long index, int tid) {
         fname = hll_fname(scratch_stringvec[0].data(), helper.sketch_size_, helper.window_size_, helper.kmer_size_, helper.csz_, helper.spacing_, helper.suffix_, helper.prefix_);
         if(helper.write_gz_) fname += ".gz";
         if(helper.skip_cached_ && isfile(fname)) continue;
-        fill_hll(hll, scratch_stringvec, helper.kmer_size_, helper.window_size_, helper.sv_, helper.canon_, nullptr, 1, helper.sketch_size_, &helper.kseqs_[tid]); // Avoid allocation fights.
+        fill_hll(hll, scratch_stringvec, helper.kmer_size_, helper.window_size_, helper.sv_, helper.canon_, nullptr, 1, helper.sketch_size_, &helper.scanners_[tid]); // Avoid allocation fights.
         hll.set_estim(helper.estim_);
         hll.write(helper.write_to_dev_null_ ? "/dev/null": fname.data(), helper.write_gz_);
         hll.clear();
@@ -152,8 +153,8 @@ int sketch_main(int argc, char *argv[]) {
         for(const auto &el: inpaths) ivecs.emplace_back(std::vector<std::string>{el});
     }
     std::vector<hll::hll_t> hlls;
-    std::vector<kseq_t>    kseqs;
-    while(hlls.size() < (unsigned)nthreads) hlls.emplace_back(sketch_size), kseqs.emplace_back(kseq_init_stack());
+    std::vector<SeqScanner> scanners;
+    while(hlls.size() < (unsigned)nthreads) hlls.emplace_back(sketch_size), scanners.emplace_back();
     assert(hlls[0].size() == ((1ull << sketch_size)));
     if(wsz < sp.c_) wsz = sp.c_;
     if(ivecs.size() == 0) {
@@ -161,11 +162,8 @@ int sketch_main(int argc, char *argv[]) {
         sketch_usage(*argv);
     }
     if(ivecs.size() / (unsigned)(nthreads) > (unsigned)bs) bs = (ivecs.size() / (nthreads) / 2);
-    detail::kt_sketch_helper helper {hlls, kseqs, bs, sketch_size, k, wsz, (int)sp.c_, sv, ivecs, suffix, prefix, spacing, skip_cached, canon, estim, write_to_dev_null, write_gz};
+    detail::kt_sketch_helper helper {hlls, scanners, bs, sketch_size, k, wsz, (int)sp.c_, sv, ivecs, suffix, prefix, spacing, skip_cached, canon, estim, write_to_dev_null, write_gz};
     kt_for(nthreads, detail::kt_for_helper, &helper, ivecs.size() / bs + (ivecs.size() % bs != 0));
-    for(auto &kseq: kseqs) {
-        kseq_destroy_stack(kseq);
-    }
     LOG_DEBUG("Finished sketching\n");
     return EXIT_SUCCESS;
 }
@@ -178,9 +176,9 @@ struct LockSmith {
 };
 
 template<typename FType, typename=std::enable_if_t<std::is_floating_point_v<FType>>>
-size_t submit_emit_dists(const int pairfi, const FType *ptr, u64 hs, size_t index, ks::string &str, const std::vector<std::string> &inpaths, bool write_binary, bool use_scientific, const size_t buffer_flush_size=1ull<<18) {
+size_t submit_emit_dists(ParallelCompressor &out, const FType *ptr, u64 hs, size_t index, ks::string &str, const std::vector<std::string> &inpaths, bool write_binary, bool use_scientific, const size_t buffer_flush_size=1ull<<18) {
     if(write_binary) {
-       ::write(pairfi, ptr, sizeof(FType) * hs);
+       out.write(ptr, sizeof(FType) * hs);
     } else {
         const char *const fmt(use_scientific ? "%e\t": "%f\t");
         str += inpaths[index];
@@ -191,7 +189,7 @@ size_t submit_emit_dists(const int pairfi, const FType *ptr, u64 hs, size_t inde
             for(k = 0; k < hs - index - 1; str.sprintf(fmt, ptr[k++]));
         }
         str.back() = '\n';
-        if(str.size() >= 1 << 18) str.write(pairfi), str.clear();
+        if(str.size() >= 1 << 18) out.write(str.data(), str.size()), str.clear();
     }
     return index;
 }
@@ -204,7 +202,7 @@ FType2 dist_index(FType1 ji, FType2 ksinv) {
 }
 
 template<typename FType, typename=std::enable_if_t<std::is_floating_point_v<FType>>>
-void dist_loop(const int pairfi, std::vector<hll::hll_t> &hlls, const std::vector<std::string> &inpaths, const bool use_scientific, const unsigned k, const bool emit_jaccard, bool write_binary, const size_t buffer_flush_size=1ull<<18) {
+void dist_loop(ParallelCompressor &out, std::vector<hll::hll_t> &hlls, const std::vector<std::string> &inpaths, const bool use_scientific, const unsigned k, const bool emit_jaccard, bool write_binary, const size_t buffer_flush_size=1ull<<18) {
     std::array<std::vector<FType>, 2> dps;
     dps[0].resize(hlls.size() - 1);
     dps[1].resize(hlls.size() - 2);
@@ -232,10 +230,10 @@ void dist_loop(const int pairfi, std::vector<hll::hll_t> &hlls, const std::vecto
 #else
         if(i) submitter.get();
 #endif
-        submitter = std::async(std::launch::async, submit_emit_dists<FType>, pairfi, dists.data(), hlls.size(), i, std::ref(str), std::ref(inpaths), write_binary, use_scientific, buffer_flush_size);
+        submitter = std::async(std::launch::async, submit_emit_dists<FType>, std::ref(out), dists.data(), hlls.size(), i, std::ref(str), std::ref(inpaths), write_binary, use_scientific, buffer_flush_size);
     }
     submitter.get();
-    if(!write_binary) str.write(pairfi), str.clear();
+    if(!write_binary) out.write(str.data(), str.size()), str.clear();
 }
 
 enum CompReading: unsigned {
@@ -244,14 +242,14 @@ enum CompReading: unsigned {
     AUTODETECT
 };
 int dist_main(int argc, char *argv[]) {
-    int wsz(-1), k(31), sketch_size(16), use_scientific(false), co, cache_sketch(false), nthreads(1);
+    int wsz(-1), k(31), sketch_size(16), use_scientific(false), co, cache_sketch(false), nthreads(1), compression(COMPRESS_NONE);
     bool canon(true), presketched_only(false), write_binary(false), emit_jaccard(true), emit_float(false);
     hll::EstimationMethod estim = hll::EstimationMethod::ERTL_MLE;
     std::string spacing, paths_file, suffix, prefix;
     CompReading reading_type = UNCOMPRESSED;
     FILE *ofp(stdout), *pairofp(stdout);
     omp_set_num_threads(1);
-    while((co = getopt(argc, argv, "P:x:F:c:p:o:s:w:O:S:k:azfJICbMEeHh?")) >= 0) {
+    while((co = getopt(argc, argv, "P:x:F:c:p:o:s:w:O:S:k:Z:azfJICbMEeHh?")) >= 0) {
         switch(co) {
             case 'z': reading_type = GZ; break;
             case 'a': reading_type = AUTODETECT; break;
@@ -274,6 +272,7 @@ int dist_main(int argc, char *argv[]) {
             case 's': spacing = optarg; break;
             case 'w': wsz = std::atoi(optarg); break;
             case 'x': suffix = optarg; break;
+            case 'Z': compression = parse_compression(optarg); break;
             case 'h': case '?': dist_usage(*argv);
         }
     }
@@ -316,45 +315,49 @@ int dist_main(int argc, char *argv[]) {
     assert(str == "#Path\tSize (est.)\n");
     str.resize(1 << 18);
     {
-        const int fn(fileno(ofp));
+        ParallelCompressor out(fileno(ofp), compression, nthreads);
         for(size_t i(0); i < hlls.size(); ++i) {
             str.sprintf("%s\t%lf\n", inpaths[i].data(), hlls[i].report());
-            if(str.size() >= 1 << 18) str.write(fn), str.clear();
+            if(str.size() >= 1 << 18) out.write(str.data(), str.size()), str.clear();
         }
-        str.write(fn), str.clear();
+        out.write(str.data(), str.size()), str.clear();
+        if(!out.close()) LOG_EXIT("Could not write genome size estimates: %s\n", std::strerror(errno));
     }
     // TODO: Emit overlaps and symmetric differences.
     if(ofp != stdout) std::fclose(ofp);
     str.clear();
+    // Rows are compressed and written while the next ones are computed.
+    ParallelCompressor pairout(fileno(pairofp), compression, nthreads);
     if(write_binary) {
         const size_t hs(hlls.size());
-        std::fwrite(&hs, sizeof(hs), 1, pairofp);
+        pairout.write(&hs, sizeof(hs));
     } else {
         str.sprintf("##Names \t");
         for(const auto &path: inpaths) str.sprintf("%s\t", path.data());
         str.back() = '\n';
-        str.write(fileno(pairofp)); str.free();
+        pairout.write(str.data(), str.size()); str.free();
     }
     if(emit_float)
-        dist_loop<float>(fileno(pairofp), hlls, inpaths, k, use_scientific, emit_jaccard, write_binary);
+        dist_loop<float>(pairout, hlls, inpaths, k, use_scientific, emit_jaccard, write_binary);
     else
-        dist_loop<double>(fileno(pairofp), hlls, inpaths, k, use_scientific, emit_jaccard, write_binary);
+        dist_loop<double>(pairout, hlls, inpaths, k, use_scientific, emit_jaccard, write_binary);
+    if(!pairout.close()) LOG_EXIT("Could not write distances: %s\n", std::strerror(errno));
     if(pairofp != stdout) std::fclose(pairofp);
     return EXIT_SUCCESS;
 }
 
 int setdist_main(int argc, char *argv[]) {
-    int wsz(-1), k(31), use_scientific(false), co;
+    int wsz(-1), k(31), use_scientific(false), co, nthreads(1), compression(COMPRESS_NONE);
     bool canon(true);
     unsigned bufsize(1 << 18);
     std::string spacing, paths_file;
     FILE *ofp(stdout), *pairofp(stdout);
     omp_set_num_threads(1);
-    while((co = getopt(argc, argv, "F:c:p:o:O:S:B:k:CMeh?")) >= 0) {
+    while((co = getopt(argc, argv, "F:c:p:o:O:S:B:k:Z:CMeh?")) >= 0) {
         switch(co) {
             case 'B': std::stringstream(optarg) << bufsize; break;
             case 'k': k = std::atoi(optarg); break;
-            case 'p': omp_set_num_threads(std::atoi(optarg)); break;
+            case 'p': nthreads = std::atoi(optarg); break;
             case 's': spacing = optarg; break;
             case 'C': canon = false; break;
             case 'w': wsz = std::atoi(optarg); break;
@@ -362,10 +365,12 @@ int setdist_main(int argc, char *argv[]) {
             case 'o': ofp = fopen(optarg, "w"); break;
             case 'O': pairofp = fopen(optarg, "w"); break;
             case 'e': use_scientific = true; break;
+            case 'Z': compression = parse_compression(optarg); break;
             case 'h': case '?': dist_usage(*argv);
         }
     }
-    std::vector<char> rdbuf(bufsize);
+    if(ofp == nullptr || pairofp == nullptr) LOG_EXIT("Could not open output for writing.\n");
+    omp_set_num_threads(nthreads);
     spvec_t sv(spacing.size() ? parse_spacing(spacing.data(), k): spvec_t(k - 1, 0));
     Spacer sp(k, wsz, sv);
     std::vector<std::string> inpaths(paths_file.size() ? get_paths(paths_file.data())
@@ -388,12 +393,13 @@ int setdist_main(int argc, char *argv[]) {
     ks::string str;
     str.sprintf("#Path\tSize (est.)\n");
     {
-        const int fn(fileno(ofp));
+        ParallelCompressor out(fileno(ofp), compression, nthreads);
         for(size_t i(0); i < hashes.size(); ++i) {
             str.sprintf("%s\t%zu\n", inpaths[i].data(), kh_size(hashes[i]));
-            if(str.size() > 1 << 17) str.write(fn), str.clear();
+            if(str.size() > 1 << 17) out.write(str.data(), str.size()), str.clear();
         }
-        str.write(fn), str.clear();
+        out.write(str.data(), str.size()), str.clear();
+        if(!out.close()) LOG_EXIT("Could not write set sizes: %s\n", std::strerror(errno));
     }
     // TODO: Emit overlaps and symmetric differences.
     if(ofp != stdout) std::fclose(ofp);
@@ -402,8 +408,8 @@ int setdist_main(int argc, char *argv[]) {
     str.sprintf("##Names \t");
     for(auto &path: inpaths) str.sprintf("%s\t", path.data());
     str.back() = '\n';
-    str.write(fileno(pairofp)); str.free();
-    setvbuf(pairofp, rdbuf.data(), _IOLBF, rdbuf.size());
+    // Rows are buffered up to -B bytes, then compressed and written while the next ones are computed.
+    ParallelCompressor pairout(fileno(pairofp), compression, nthreads);
     const char *const fmt(use_scientific ? "\t%e": "\t%f");
     for(size_t i = 0; i < hashes.size(); ++i) {
         auto &h1(hashes[i]);
@@ -411,13 +417,17 @@ int setdist_main(int argc, char *argv[]) {
         #pragma omp parallel for
         for(j = i + 1; j < hashes.size(); ++j)
             dists[j - i - 1] = jaccard_index(hashes[j], h1);
-        for(j = 0; j < i + 1; ++j) fputc('\t', pairofp), fputc('-', pairofp);
+        for(j = 0; j < i + 1; ++j) str.putsn_("\t-", 2);
         for(j = 0; j < hashes.size() - i - 1; ++j)
-            fprintf(pairofp, fmt, dists[j]);
-        fputc('\n', pairofp);
+            str.sprintf(fmt, dists[j]);
+        str.putc_('\n');
+        if(str.size() >= bufsize) pairout.write(str.data(), str.size()), str.clear();
         khash_destroy(h1), h1 = nullptr;
         // Delete data as soon as we don't need it.
     }
+    pairout.write(str.data(), str.size()), str.free();
+    if(!pairout.close()) LOG_EXIT("Could not write distances: %s\n", std::strerror(errno));
+    if(pairofp != stdout) std::fclose(pairofp);
     return EXIT_SUCCESS;
 }
 
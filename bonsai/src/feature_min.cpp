@@ -5,13 +5,13 @@
 namespace emp {
 
 
-void lca2depth(khash_t(c) *lca_map, const khash_t(p) *tax_map) {
+void lca2depth(khash_t(c) *lca_map, const FlatTaxonomy *tax_map) {
     for(khiter_t ki(kh_begin(lca_map)); ki != kh_end(lca_map); ++ki)
         if(kh_exist(lca_map, ki))
-            kh_val(lca_map, ki) = node_depth(tax_map, kh_val(lca_map, ki));
+            kh_val(lca_map, ki) = tax_map->depth(kh_val(lca_map, ki));
 }
 
-khash_t(c) *make_depth_hash(khash_t(c) *lca_map, const khash_t(p) *tax_map) {
+khash_t(c) *make_depth_hash(khash_t(c) *lca_map, const FlatTaxonomy *tax_map) {
     khash_t(c) *ret(kh_init(c));
     kh_resize(c, ret, kh_size(lca_map));
     khiter_t ki1;
@@ -19,13 +19,13 @@ khash_t(c) *make_depth_hash(khash_t(c) *lca_map, const khash_t(p) *tax_map) {
     for(khiter_t ki2(kh_begin(lca_map)); ki2 != kh_end(lca_map); ++ki2) {
         if(kh_exist(lca_map, ki2)) {
             ki1 = kh_put(c, ret, kh_key(lca_map, ki2), &khr);
-            kh_val(ret, ki1) = node_depth(tax_map, kh_val(lca_map, ki2));
+            kh_val(ret, ki1) = tax_map->depth(kh_val(lca_map, ki2));
         }
     }
     return ret;
 }
 
-void update_feature_counter(khash_t(64) *kc, const khash_t(all) *set, const khash_t(p) *tax, const tax_t taxid) {
+void update_feature_counter(khash_t(64) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, const tax_t taxid) {
     // TODO: make this threadsafe.
     int khr;
     khint_t k2;
@@ -33,8 +33,8 @@ void update_feature_counter(khash_t(64) *kc, const khash_t(all) *set, const khas
         if(kh_exist(set, ki)) {
            if((k2 = kh_get(64, kc, kh_key(set, ki))) == kh_end(kc)) {
                 k2 = kh_put(64, kc, kh_key(set, ki), &khr);
-                kh_val(kc, k2) = FMencode(1, node_depth(tax, taxid));
-            } else while(!kh_try_set(64, kc, k2, FMencode(FMcount(kh_val(kc, k2)), lca(tax, taxid, kh_val(kc, k2)))));
+                kh_val(kc, k2) = FMencode(1, tax->depth(taxid));
+            } else while(!kh_try_set(64, kc, k2, FMencode(FMcount(kh_val(kc, k2)), tax->lca(taxid, kh_val(kc, k2)))));
         }
     }
 }
@@ -54,7 +54,7 @@ void update_minimized_map(const khash_t(all) *set, const khash_t(64) *full_map,
     return;
 }
 
-khash_t(64) *make_taxdepth_hash(khash_t(c) *kc, const khash_t(p) *tax) {
+khash_t(64) *make_taxdepth_hash(khash_t(c) *kc, const FlatTaxonomy *tax) {
     khash_t(64) *ret(kh_init(64));
     int khr;
     khiter_t kir;
@@ -62,14 +62,14 @@ khash_t(64) *make_taxdepth_hash(khash_t(c) *kc, const khash_t(p) *tax) {
     for(khiter_t ki(0); ki != kh_end(kc); ++ki) {
         if(kh_exist(kc, ki)) {
             kir = kh_put(64, ret, kh_key(kc, ki), &khr);
-            kh_val(ret, kir) = TDencode(node_depth(tax, kh_val(kc, ki)), kh_val(kc, ki));
+            kh_val(ret, kir) = TDencode(tax->depth(kh_val(kc, ki)), kh_val(kc, ki));
         }
     }
     return ret;
 }
 
 
-void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const khash_t(p) *tax, tax_t taxid) {
+void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, tax_t taxid) {
     int khr;
     khint_t k2;
     LOG_DEBUG("Adding set of size %zu t total set of current size %zu.\n", kh_size(set), kh_size(kc));
@@ -82,7 +82,7 @@ void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const khash_t(p) *t
                 if(unlikely(kh_size(kc) % 1000000 == 0)) LOG_DEBUG("Final hash size %zu\n", kh_size(kc));
 #endif
             } else if(kh_val(kc, k2) != taxid) {
-                kh_val(kc, k2) = lca(tax, taxid, kh_val(kc, k2));
+                kh_val(kc, k2) = tax->lca(taxid, kh_val(kc, k2));
                 if(kh_val(kc, k2) == UINT32_C(-1)) kh_val(kc, k2) = 1, LOG_WARNING("Missing taxid %u. Setting lca to 1\n", taxid);
             }
         }
@@ -90,7 +90,7 @@ void update_lca_map(khash_t(c) *kc, const khash_t(all) *set, const khash_t(p) *t
     LOG_DEBUG("After updating with set of size %zu, total set current size is %zu.\n", kh_size(set), kh_size(kc));
 }
 
-void update_td_map(khash_t(64) *kc, const khash_t(all) *set, const khash_t(p) *tax, tax_t taxid) {
+void update_td_map(khash_t(64) *kc, const khash_t(all) *set, const FlatTaxonomy *tax, tax_t taxid) {
     int khr;
     khint_t k2;
     tax_t val;
@@ -99,11 +99,11 @@ void update_td_map(khash_t(64) *kc, const khash_t(all) *set, const khash_t(p) *t
         if(kh_exist(set, ki)) {
             if((k2 = kh_get(64, kc, kh_key(set, ki))) == kh_end(kc)) {
                 k2 = kh_put(64, kc, kh_key(set, ki), &khr);
-                kh_val(kc, k2) = TDencode(node_depth(tax, kh_val(kc, ki)), kh_val(kc, ki));
+                kh_val(kc, k2) = TDencode(tax->depth(taxid), taxid);
                 if(unlikely(kh_size(kc) % 1000000 == 0)) LOG_INFO("Final hash size %zu\n", kh_size(kc));
-            } else if(kh_val(kc, k2) != taxid) {
-                do val = lca(tax, taxid, kh_val(kc, k2));
-                while(!kh_try_set(64, kc, k2, val == (tax_t)-1 ? 1: TDencode(node_depth(tax, val), val)));
+            } else if(TDtax(kh_val(kc, k2)) != taxid) {
+                do val = tax->lca(taxid, TDtax(kh_val(kc, k2)));
+                while(!kh_try_set(64, kc, k2, val == (tax_t)-1 ? 1: TDencode(tax->depth(val), val)));
             }
         }
     }
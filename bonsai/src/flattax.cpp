@@ -0,0 +1,223 @@
+#include "flattax.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace emp {
+
+namespace {
+// Taxids index a flat array, so they need to stay reasonably dense.
+static constexpr tax_t MAX_TAXID = tax_t(1) << 30;
+
+INLINE u64 u32_words(u64 n) {return (n + 1) >> 1;}
+}
+
+FlatTaxonomy::FlatTaxonomy(const khash_t(p) *map): map_(nullptr), map_size_(0) {
+    if(map == nullptr) LOG_EXIT("null taxonomy.\n");
+    build(map);
+}
+
+FlatTaxonomy::FlatTaxonomy(const char *path): map_(nullptr), map_size_(0) {
+    u64 magic(0);
+    if(std::FILE *fp = std::fopen(path, "rb")) {
+        if(std::fread(&magic, sizeof(magic), 1, fp) != 1) magic = 0;
+        std::fclose(fp);
+    } else LOG_EXIT("Could not open %s for reading.\n", path);
+    if(magic == TAX_MAGIC) {
+        load_mapped(path);
+        return;
+    }
+    khash_t(p) *map(build_parent_map(path));
+    build(map);
+    kh_destroy(p, map);
+}
+
+FlatTaxonomy::~FlatTaxonomy() {
+    if(map_) ::munmap(map_, map_size_);
+}
+
+void FlatTaxonomy::set_pointers(const u64 *data) {
+    const u64 n(h_.n_);
+    masks_  = data;
+    ids_    = reinterpret_cast<const u32 *>(data += n);
+    parent_ = reinterpret_cast<const u32 *>(data += u32_words(n));
+    depth_  = reinterpret_cast<const u32 *>(data += u32_words(n));
+    end_    = reinterpret_cast<const u32 *>(data += u32_words(n));
+    index_  = reinterpret_cast<const u32 *>(data += u32_words(n));
+    sparse_ = reinterpret_cast<const u32 *>(data += u32_words(u64(h_.maxid_) + 1));
+}
+
+void FlatTaxonomy::build(const khash_t(p) *map) {
+    // (parent, child) edges, sorted so that children are visited in taxid order.
+    std::vector<std::pair<tax_t, tax_t>> edges;
+    edges.reserve(kh_size(map));
+    tax_t maxid(0);
+    size_t norphans(0);
+    for(khiter_t ki(0); ki != kh_end(map); ++ki) {
+        if(!kh_exist(map, ki) || kh_key(map, ki) == 0) continue;
+        const tax_t child(kh_key(map, ki));
+        tax_t parent(kh_val(map, ki));
+        if(parent == child) parent = 0;
+        else if(parent && kh_get(p, map, parent) == kh_end(map)) parent = 0, ++norphans;
+        edges.emplace_back(parent, child);
+        maxid = std::max(maxid, child);
+    }
+    if(maxid >= MAX_TAXID) LOG_EXIT("Taxid %u is too large for a flat taxonomy.\n", maxid);
+    if(norphans) LOG_WARNING("%zu taxa have parents missing from the taxonomy. Treating them as roots.\n", norphans);
+    SORT(edges.begin(), edges.end());
+
+    std::vector<u32> index(u64(maxid) + 1, NONE), ids{0}, parents{0}, depths{0}, ends{0};
+    index[0] = 0;
+    struct frame_t {
+        u32 dense_;
+        size_t next_, stop_;
+    };
+    auto children = [&](tax_t a) {
+        const auto lo(std::lower_bound(edges.begin(), edges.end(), std::make_pair(a, tax_t(0))));
+        const auto hi(std::lower_bound(lo, edges.end(), std::make_pair(a + 1, tax_t(0))));
+        return std::make_pair(size_t(lo - edges.begin()), size_t(hi - edges.begin()));
+    };
+    auto root(children(0));
+    std::vector<frame_t> stack{frame_t{0, root.first, root.second}};
+    while(stack.size()) {
+        frame_t &f(stack.back());
+        if(f.next_ == f.stop_) {
+            ends[f.dense_] = ids.size();
+            stack.pop_back();
+            continue;
+        }
+        const tax_t child(edges[f.next_++].second);
+        const u32 parent(f.dense_), d(ids.size());
+        index[child] = d;
+        ids.push_back(child), parents.push_back(parent), depths.push_back(depths[parent] + 1), ends.push_back(0);
+        const auto range(children(child));
+        stack.push_back(frame_t{d, range.first, range.second});
+    }
+    if(ids.size() - 1 != edges.size())
+        LOG_WARNING("%zu taxa are not reachable from a root (cycle in the taxonomy?). Dropping them.\n", edges.size() - (ids.size() - 1));
+
+    const u32 n(ids.size()), nblocks((n + 63) >> 6);
+    h_ = flattax_header_t{TAX_MAGIC, TAX_VERSION, n, maxid, nblocks, u32(32 - __builtin_clz(nblocks)), 0, 0, {0, 0, 0}};
+    h_.words_ = n + 4 * u32_words(n) + u32_words(u64(maxid) + 1) + u32_words(u64(h_.nlevels_) * nblocks);
+    data_.assign(h_.words_, 0);
+    set_pointers(data_.data());
+    std::memcpy(const_cast<u32 *>(ids_),    ids.data(),     n * sizeof(u32));
+    std::memcpy(const_cast<u32 *>(parent_), parents.data(), n * sizeof(u32));
+    std::memcpy(const_cast<u32 *>(depth_),  depths.data(),  n * sizeof(u32));
+    std::memcpy(const_cast<u32 *>(end_),    ends.data(),    n * sizeof(u32));
+    std::memcpy(const_cast<u32 *>(index_),  index.data(),   index.size() * sizeof(u32));
+
+    // Within each block, masks_[j] marks the positions which are the minimum of everything after them up to j.
+    u64 *masks(const_cast<u64 *>(masks_));
+    u32 *sparse(const_cast<u32 *>(sparse_));
+    for(u32 b(0); b < nblocks; ++b) {
+        const u32 start(b << 6), stop(std::min(n, start + 64));
+        u64 cur(0);
+        u32 min(NONE);
+        for(u32 j(start); j < stop; ++j) {
+            while(cur && parents[start + 63 - __builtin_clzll(cur)] >= parents[j])
+                cur &= ~(UINT64_C(1) << (63 - __builtin_clzll(cur)));
+            masks[j] = (cur |= UINT64_C(1) << (j - start));
+            min = std::min(min, parents[j]);
+        }
+        sparse[b] = min;
+    }
+    for(u32 lev(1); lev < h_.nlevels_; ++lev) {
+        const u32 *prev(sparse + size_t(lev - 1) * nblocks);
+        u32 *row(sparse + size_t(lev) * nblocks);
+        for(u32 b(0); b + (1u << lev) <= nblocks; ++b)
+            row[b] = std::min(prev[b], prev[b + (1u << (lev - 1))]);
+    }
+    LOG_DEBUG("Compiled taxonomy with %u taxa, max taxid %u, %zu bytes.\n", n - 1, maxid, size_t(h_.words_ * sizeof(u64)));
+}
+
+void FlatTaxonomy::write(const char *path) const {
+    std::FILE *fp(std::fopen(path, "wb"));
+    if(fp == nullptr) LOG_EXIT("Could not open %s for writing.\n", path);
+    const u64 *data(masks_);
+    if(std::fwrite(&h_, sizeof(h_), 1, fp) != 1 || std::fwrite(data, sizeof(u64), h_.words_, fp) != h_.words_)
+        LOG_EXIT("Could not write taxonomy to %s.\n", path);
+    std::fclose(fp);
+}
+
+void FlatTaxonomy::load_mapped(const char *path) {
+    const int fd(::open(path, O_RDONLY));
+    struct stat st;
+    if(fd < 0 || ::fstat(fd, &st)) LOG_EXIT("Could not open %s for reading.\n", path);
+    if(size_t(st.st_size) < sizeof(h_)) LOG_EXIT("Taxonomy %s is truncated.\n", path);
+    if((map_ = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+        LOG_EXIT("Could not mmap %s: %s\n", path, std::strerror(errno));
+    ::close(fd);
+    map_size_ = st.st_size;
+    std::memcpy(&h_, map_, sizeof(h_));
+    if(h_.version_ != TAX_VERSION) LOG_EXIT("Taxonomy %s has version %u, expected %u.\n", path, h_.version_, TAX_VERSION);
+    if(map_size_ != sizeof(h_) + h_.words_ * sizeof(u64)) LOG_EXIT("Taxonomy %s is truncated.\n", path);
+    set_pointers(reinterpret_cast<const u64 *>(static_cast<const u8 *>(map_) + sizeof(h_)));
+    LOG_DEBUG("Mapped taxonomy with %u taxa from %s.\n", h_.n_ - 1, path);
+}
+
+u32 FlatTaxonomy::score_paths(const tax_counter &hit_counts, std::vector<path_hit_t> &hits, u64 &max_score) const {
+    // Hits in preorder, so that a hit's hit ancestors precede it.
+    std::vector<u32> path; // Hits on the path from the root to the current one
+    hits.reserve(hit_counts.size());
+    for(unsigned i(0); i < hit_counts.size(); ++i) {
+        const u32 d(dense(hit_counts.keys()[i]));
+        if(d && d != NONE) hits.push_back(path_hit_t{d, hit_counts.values()[i], hit_counts.values()[i]});
+    }
+    SORT(hits.begin(), hits.end(), [](const path_hit_t &a, const path_hit_t &b) {return a.dense_ < b.dense_;});
+    u32 best(0);
+    max_score = 0;
+    for(size_t i(0); i < hits.size(); ++i) {
+        while(path.size() && !is_ancestor_dense(hits[path.back()].dense_, hits[i].dense_)) path.pop_back();
+        if(path.size()) hits[i].score_ += hits[path.back()].score_;
+        path.push_back(i);
+        // If several root-to-leaf paths are tied, take the lca of their leaves.
+        if(hits[i].score_ > max_score) max_score = hits[i].score_, best = hits[i].dense_;
+        else if(hits[i].score_ == max_score) best = lca_dense(best, hits[i].dense_);
+    }
+    return best;
+}
+
+tax_t FlatTaxonomy::resolve_tree(const tax_counter &hit_counts) const {
+    std::vector<path_hit_t> hits;
+    u64 max_score;
+    return ids_[score_paths(hit_counts, hits, max_score)];
+}
+
+FlatTaxonomy::resolution_t FlatTaxonomy::resolve(const tax_counter &hit_counts) const {
+    std::vector<path_hit_t> hits;
+    resolution_t ret{0, 0, 0, 0, 0};
+    const u32 best(score_paths(hit_counts, hits, ret.score_));
+    ret.taxon_ = ids_[best];
+    // A path leaving best's subtree branches off at its deepest hit outside of it (or at the root),
+    // so the best such path scores the best of those hits' path scores.
+    for(const auto &hit: hits) {
+        if(is_ancestor_dense(best, hit.dense_)) ret.clade_ += hit.count_;
+        else ret.outside_ = std::max(ret.outside_, hit.score_);
+    }
+    for(unsigned i(0); i < hit_counts.size(); ret.total_ += hit_counts.values()[i++]);
+    return ret;
+}
+
+tax_t FlatTaxonomy::confident_ancestor(const tax_counter &hit_counts, tax_t taxon,
+                                       double confidence, u64 nmissing) const {
+    u32 d(dense(taxon));
+    u64 total(nmissing);
+    if(d == NONE) return 0;
+    for(unsigned i(0); i < hit_counts.size(); total += hit_counts.values()[i++]);
+    const double needed(confidence * total);
+    for(; d; d = parent_[d]) {
+        u64 clade(0);
+        for(unsigned i(0); i < hit_counts.size(); ++i) {
+            const u32 h(dense(hit_counts.keys()[i]));
+            if(h != NONE && is_ancestor_dense(d, h)) clade += hit_counts.values()[i];
+        }
+        if(clade >= needed) break;
+    }
+    return ids_[d];
+}
+
+} // namespace emp
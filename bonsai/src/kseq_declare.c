@@ -11,11 +11,12 @@ static inline void trim_readno(kstring_t *s)
 }
 
 
-bseq1_t *bseq_read(int chunk_size, int *n_, void *ks1_, void *ks2_)
+bseq1_t *bseq_read(int64_t chunk_size, int *n_, void *ks1_, void *ks2_)
 {
     kseq_t *ks = (kseq_t*)ks1_, *ks2 = (kseq_t*)ks2_;
-    int m, n, size;
-    m = n = size = 0;
+    int m, n;
+    int64_t size; // Chunks may hold more than 2 GB of sequence.
+    m = n = 0, size = 0;
     bseq1_t *seqs = 0;
     while (kseq_read(ks) >= 0) {
         if (ks2 && kseq_read(ks2) < 0) { // the 2nd file has fewer reads
@@ -46,9 +47,10 @@ bseq1_t *bseq_read(int chunk_size, int *n_, void *ks1_, void *ks2_)
     return seqs;
 }
 
-bseq1_t *bseq_realloc_read(int chunk_size, int *n_, void *ks1_, void *ks2_, bseq1_t *seqs) {
+bseq1_t *bseq_realloc_read(int64_t chunk_size, int *n_, void *ks1_, void *ks2_, bseq1_t *seqs) {
     if(!seqs) return bseq_read(chunk_size, n_, ks1_, ks2_);
-    int n = 0, size = 0;
+    int n = 0;
+    int64_t size = 0;
     kseq_t *ks = (kseq_t *)ks1_, *ks2 = (kseq_t *)ks2_;
     while (kseq_read(ks) >= 0) {
         if (ks2 && kseq_read(ks2) < 0) { // the 2nd file has fewer reads
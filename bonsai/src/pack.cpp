@@ -0,0 +1,104 @@
+#include "pack.h"
+#include "kmerutil.h"
+#include <immintrin.h>
+
+namespace emp {
+
+namespace {
+
+// Each kernel packs 32 bases into one word and sets their 32 ambiguity bits.
+INLINE u64 block_scalar(const char *s, u32 &amb) {
+    u64 ret(0);
+    amb = 0;
+    for(unsigned i(0); i < 32; ++i) {
+        const u8 c(s[i]);
+        const int v(c < 128 ? cstr_lut[c]: -1);
+        ret = (ret << 2) | (v < 0 ? 0: v);
+        amb |= u32(v < 0) << i;
+    }
+    return ret;
+}
+
+// A, C, G and T (either case) are told apart by bits 1-3: ((c >> 1) ^ (c >> 2)) & 3 maps them to 0, 1, 2 and 3.
+// maddubs and madd then fold each 4 codes into one byte, first base highest.
+__attribute__((target("ssse3")))
+INLINE u32 half_ssse3(const char *s, u32 &amb) {
+    const __m128i c(_mm_loadu_si128((const __m128i *)s)), lower(_mm_or_si128(c, _mm_set1_epi8(0x20)));
+    const __m128i valid(_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('a')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('c'))),
+                                     _mm_or_si128(_mm_cmpeq_epi8(lower, _mm_set1_epi8('g')), _mm_cmpeq_epi8(lower, _mm_set1_epi8('t')))));
+    amb = ~u32(_mm_movemask_epi8(valid)) & 0xFFFFu;
+    __m128i codes(_mm_and_si128(_mm_xor_si128(_mm_srli_epi16(c, 1), _mm_srli_epi16(c, 2)), _mm_set1_epi8(3)));
+    codes = _mm_and_si128(codes, valid);
+    const __m128i quads(_mm_madd_epi16(_mm_maddubs_epi16(codes, _mm_set1_epi16(0x0104)), _mm_set1_epi32(0x00010010)));
+    const __m128i bytes(_mm_shuffle_epi8(quads, _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+    return __builtin_bswap32(_mm_cvtsi128_si32(bytes));
+}
+__attribute__((target("ssse3")))
+INLINE u64 block_ssse3(const char *s, u32 &amb) {
+    u32 lo, hi;
+    const u64 ret((u64(half_ssse3(s, lo)) << 32) | half_ssse3(s + 16, hi));
+    amb = lo | (hi << 16);
+    return ret;
+}
+
+__attribute__((target("avx2")))
+INLINE u64 block_avx2(const char *s, u32 &amb) {
+    const __m256i c(_mm256_loadu_si256((const __m256i *)s)), lower(_mm256_or_si256(c, _mm256_set1_epi8(0x20)));
+    const __m256i valid(_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('a')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('c'))),
+                                        _mm256_or_si256(_mm256_cmpeq_epi8(lower, _mm256_set1_epi8('g')), _mm256_cmpeq_epi8(lower, _mm256_set1_epi8('t')))));
+    amb = ~u32(_mm256_movemask_epi8(valid));
+    __m256i codes(_mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi16(c, 1), _mm256_srli_epi16(c, 2)), _mm256_set1_epi8(3)));
+    codes = _mm256_and_si256(codes, valid);
+    const __m256i quads(_mm256_madd_epi16(_mm256_maddubs_epi16(codes, _mm256_set1_epi16(0x0104)), _mm256_set1_epi32(0x00010010)));
+    const __m256i bytes(_mm256_shuffle_epi8(quads, _mm256_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+                                                                    0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1)));
+    return __builtin_bswap64(u64(u32(_mm256_extract_epi32(bytes, 0))) | (u64(u32(_mm256_extract_epi32(bytes, 4))) << 32));
+}
+
+// A macro rather than a template so that the loop picks up each kernel's target attribute and inlines its block.
+#define PACK_ALL(block) \
+    do { \
+        std::memset(ambig, 0, sizeof(*ambig) * ((l + 63) / 64)); \
+        u32 amb; \
+        size_t i(0); \
+        for(; i + 32 <= l; i += 32) { \
+            bases[i >> 5] = block(s + i, amb); \
+            ambig[i >> 6] |= u64(amb) << (i & 32); \
+        } \
+        if(i < l) { \
+            /* Pad the last block with Ns. */ \
+            char buf[32]; \
+            std::memset(buf, 'N', sizeof(buf)); \
+            std::memcpy(buf, s + i, l - i); \
+            bases[i >> 5] = block(buf, amb); \
+            ambig[i >> 6] |= u64(amb) << (i & 32); \
+        } \
+        if(l & 63) ambig[l >> 6] |= UINT64_C(-1) << (l & 63); \
+    } while(0)
+
+} // anonymous namespace
+
+namespace pack {
+
+void scalar(const char *s, size_t l, u64 *bases, u64 *ambig) {PACK_ALL(block_scalar);}
+__attribute__((target("ssse3")))
+void ssse3(const char *s, size_t l, u64 *bases, u64 *ambig) {PACK_ALL(block_ssse3);}
+__attribute__((target("avx2")))
+void avx2(const char *s, size_t l, u64 *bases, u64 *ambig) {PACK_ALL(block_avx2);}
+
+pack_fn best() {
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))  return avx2;
+    if(__builtin_cpu_supports("ssse3")) return ssse3;
+    return scalar;
+}
+const char *best_name() {
+    const pack_fn fn(best());
+    return fn == avx2 ? "avx2": fn == ssse3 ? "ssse3": "scalar";
+}
+
+} // namespace pack
+
+#undef PACK_ALL
+
+} // namespace emp
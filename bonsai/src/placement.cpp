@@ -0,0 +1,149 @@
+#include "placement.h"
+#include <cerrno>
+#include <cstring>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace emp {
+
+// From linux/mempolicy.h, which we cannot count on being installed.
+static constexpr int MPOL_BIND_       = 2;
+static constexpr int MPOL_INTERLEAVE_ = 3;
+static constexpr size_t MAX_NODES     = 1024;
+
+std::string placement_t::str() const {
+    static const char *huge_names[]{"4 KB pages", "transparent huge pages", "explicit huge pages"};
+    static const char *numa_names[]{"first-touch NUMA placement", "interleaved across NUMA nodes", "replicated on each NUMA node"};
+    std::string ret(huge_names[huge_]);
+    ret += ", ";
+    ret += numa_names[numa_];
+    if(pin_) ret += ", threads pinned";
+    return ret;
+}
+
+int parse_huge_pages(const char *s) {
+    if(std::strcmp(s, "none") == 0)    return HUGE_NONE;
+    if(std::strcmp(s, "thp") == 0)     return HUGE_TRANSPARENT;
+    if(std::strcmp(s, "hugetlb") == 0) return HUGE_EXPLICIT;
+    LOG_EXIT("Unknown huge page mode %s. Options: none, thp, hugetlb.\n", s);
+    return HUGE_NONE;
+}
+
+int parse_numa(const char *s) {
+    if(std::strcmp(s, "local") == 0)      return NUMA_LOCAL;
+    if(std::strcmp(s, "interleave") == 0) return NUMA_INTERLEAVE;
+    if(std::strcmp(s, "replicate") == 0)  return NUMA_REPLICATE;
+    LOG_EXIT("Unknown NUMA mode %s. Options: local, interleave, replicate.\n", s);
+    return NUMA_LOCAL;
+}
+
+// Parses sysfs lists such as "0-3,8-11".
+static std::vector<int> read_list(const char *path) {
+    std::vector<int> ret;
+    std::FILE *fp(std::fopen(path, "r"));
+    if(fp == nullptr) return ret;
+    for(int a, b, c; std::fscanf(fp, "%d", &a) == 1;) {
+        b = a;
+        if((c = std::fgetc(fp)) == '-') {
+            if(std::fscanf(fp, "%d", &b) != 1) break;
+            c = std::fgetc(fp);
+        }
+        while(a <= b) ret.push_back(a++);
+        if(c != ',') break;
+    }
+    std::fclose(fp);
+    return ret;
+}
+
+struct numa_topology_t {
+    std::vector<int> online_;            // Every online node, for interleaving
+    std::vector<int> ids_;               // Nodes with cores
+    std::vector<std::vector<int>> cpus_; // Their cores
+    numa_topology_t(): online_(read_list("/sys/devices/system/node/online")) {
+        char buf[128];
+        for(const int node: online_) {
+            std::snprintf(buf, sizeof(buf), "/sys/devices/system/node/node%d/cpulist", node);
+            std::vector<int> cpus(read_list(buf));
+            if(cpus.empty()) continue; // Memory-only nodes run no threads.
+            ids_.push_back(node);
+            cpus_.push_back(std::move(cpus));
+        }
+        if(cpus_.empty()) {
+            ids_.assign(1, 0);
+            cpus_.emplace_back();
+            for(long i(0), n(::sysconf(_SC_NPROCESSORS_ONLN)); i < n; cpus_[0].push_back(i++));
+        }
+    }
+};
+
+static const numa_topology_t &topology() {
+    static const numa_topology_t ret;
+    return ret;
+}
+
+const std::vector<std::vector<int>> &numa_cpus() {return topology().cpus_;}
+int numa_node_id(unsigned index) {return topology().ids_[index];}
+
+static size_t huge_page_size() {
+    size_t ret(2 << 20);
+    std::FILE *fp(std::fopen("/proc/meminfo", "r"));
+    if(fp == nullptr) return ret;
+    char line[256];
+    unsigned long kb;
+    while(std::fgets(line, sizeof(line), fp))
+        if(std::sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) ret = size_t(kb) << 10;
+    std::fclose(fp);
+    return ret;
+}
+
+static void set_policy(void *p, size_t len, int mode, const std::vector<int> &nodes) {
+    constexpr size_t bits(8 * sizeof(unsigned long));
+    unsigned long mask[MAX_NODES / bits]{};
+    for(const int node: nodes) if(size_t(node) < MAX_NODES) mask[node / bits] |= 1ul << (node % bits);
+    // The kernel reads one bit less than maxnode.
+    if(::syscall(SYS_mbind, p, len, mode, mask, MAX_NODES + 1, 0))
+        LOG_WARNING("Could not set NUMA policy %i over %zu nodes: %s. Pages go where they are first touched.\n",
+                    mode, nodes.size(), std::strerror(errno));
+}
+
+void *map_placed(size_t len, const placement_t &p, int node, size_t &maplen) {
+    void *ret(MAP_FAILED);
+    int huge(p.huge_);
+    if(huge == HUGE_EXPLICIT) {
+        const size_t page(huge_page_size());
+        maplen = (len + page - 1) / page * page;
+        if((ret = ::mmap(nullptr, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) == MAP_FAILED) {
+            LOG_WARNING("Could not get %zu bytes of explicit huge pages (%s). Is vm.nr_hugepages large enough? Using transparent huge pages.\n",
+                        maplen, std::strerror(errno));
+            huge = HUGE_TRANSPARENT;
+        }
+    }
+    if(ret == MAP_FAILED) {
+        const size_t page(::sysconf(_SC_PAGESIZE));
+        maplen = (len + page - 1) / page * page;
+        if((ret = ::mmap(nullptr, maplen, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+            LOG_EXIT("Could not map %zu bytes: %s\n", maplen, std::strerror(errno));
+    }
+    if(huge == HUGE_TRANSPARENT && ::madvise(ret, maplen, MADV_HUGEPAGE))
+        LOG_WARNING("Could not ask for transparent huge pages: %s\n", std::strerror(errno));
+    // Set before the first touch, which is when pages are placed.
+    if(node >= 0) set_policy(ret, maplen, MPOL_BIND_, {numa_node_id(node)});
+    else if(p.numa_ == NUMA_INTERLEAVE && topology().online_.size() > 1) set_policy(ret, maplen, MPOL_INTERLEAVE_, topology().online_);
+    return ret;
+}
+
+int thread_cpu(int tid) {
+    const auto &cpus(numa_cpus()[thread_node(tid)]);
+    return cpus[(tid / numa_nodes()) % cpus.size()];
+}
+
+void pin_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(::sched_setaffinity(0, sizeof(set), &set)) LOG_WARNING("Could not pin thread to core %i: %s\n", cpu, std::strerror(errno));
+}
+
+} // namespace emp
@@ -0,0 +1,42 @@
+#include "report.h"
+
+namespace emp {
+
+AbundanceReport::AbundanceReport(const FlatTaxonomy &tax, unsigned nthreads):
+    tax_(tax), nthreads_(nthreads), stride_((u64(tax.nodes()) + 7) & ~u64(7)),
+    counts_(stride_ * nthreads)
+{
+    LOG_DEBUG("Counting reads for %zu taxa in %u threads, %zu bytes.\n", tax.size(), nthreads, counts_.size() * sizeof(u64));
+}
+
+void AbundanceReport::merge(std::vector<u64> &direct, std::vector<u64> &clade) const {
+    const u32 n(tax_.nodes());
+    direct.assign(counts_.begin(), counts_.begin() + n);
+    for(unsigned t(1); t < nthreads_; ++t) {
+        const u64 *row(counts_.data() + t * stride_);
+        for(u32 d(0); d < n; ++d) direct[d] += row[d];
+    }
+    clade = direct;
+    for(u32 d(n - 1); d; --d) clade[tax_.parent_dense(d)] += clade[d];
+}
+
+void AbundanceReport::write(std::FILE *fp) const {
+    std::vector<u64> direct, clade;
+    merge(direct, clade);
+    const double total(clade[0]), scale(total ? 100. / total: 0.);
+    std::fprintf(fp, "%6.2f\t%" PRIu64 "\t%" PRIu64 "\tU\t0\tunclassified\n", direct[0] * scale, direct[0], direct[0]);
+    for(u32 d(1), n(tax_.nodes()); d < n; ++d) {
+        if(clade[d] == 0) continue;
+        std::fprintf(fp, "%6.2f\t%" PRIu64 "\t%" PRIu64 "\t-\t%u\t%*s%u\n", clade[d] * scale, clade[d], direct[d],
+                     tax_.id(d), int(2 * (tax_.depth_dense(d) - 1)), "", tax_.id(d));
+    }
+}
+
+void AbundanceReport::write(const char *path) const {
+    std::FILE *fp(std::fopen(path, "w"));
+    if(fp == nullptr) LOG_EXIT("Could not open %s for writing.\n", path);
+    write(fp);
+    std::fclose(fp);
+}
+
+} // namespace emp
@@ -0,0 +1,316 @@
+#include "seqscan.h"
+#include <cctype>
+#include <climits>
+#include <cstring>
+#include <immintrin.h>
+
+namespace emp {
+
+namespace scan {
+
+const char *newline_scalar(const char *p, const char *end) {
+    return static_cast<const char *>(std::memchr(p, '\n', end - p));
+}
+
+__attribute__((target("avx2")))
+const char *newline_avx2(const char *p, const char *end) {
+    const __m256i nl(_mm256_set1_epi8('\n'));
+    for(; p + 32 <= end; p += 32)
+        if(const u32 m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl)))
+            return p + __builtin_ctz(m);
+    return newline_scalar(p, end);
+}
+
+const char *record_scalar(const char *p, const char *end, char c) {
+    for(--end; p < end && (p = static_cast<const char *>(std::memchr(p, '\n', end - p))); ++p)
+        if(p[1] == c) return p;
+    return nullptr;
+}
+
+// Compares each block against newlines and the block one byte on against c.
+__attribute__((target("avx2")))
+const char *record_avx2(const char *p, const char *end, char c) {
+    const __m256i nl(_mm256_set1_epi8('\n')), mark(_mm256_set1_epi8(c));
+    for(; p + 33 <= end; p += 32) {
+        const __m256i here(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p), nl)),
+                      next(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)(p + 1)), mark));
+        if(const u32 m = _mm256_movemask_epi8(_mm256_and_si256(here, next)))
+            return p + __builtin_ctz(m);
+    }
+    return record_scalar(p, end, c);
+}
+
+newline_fn best_newline() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? newline_avx2: newline_scalar;
+}
+record_fn best_record() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? record_avx2: record_scalar;
+}
+const char *best_name() {
+    return best_record() == record_avx2 ? "avx2": "scalar";
+}
+
+} // namespace scan
+
+static const scan::newline_fn find_newline(scan::best_newline());
+static const scan::record_fn  find_record(scan::best_record());
+
+SeqScanner::SeqScanner(gzFile fp, size_t bufsize):
+    fp_(fp), buf_(nullptr), cap_(std::max(bufsize, size_t(64))), begin_(0), end_(0), eof_(false) {}
+
+SeqScanner::SeqScanner(SeqScanner &&other) noexcept:
+    fp_(other.fp_), buf_(other.buf_), cap_(other.cap_), begin_(other.begin_), end_(other.end_), eof_(other.eof_),
+    error_(std::move(other.error_)), lines_(std::move(other.lines_))
+{
+    other.buf_ = nullptr;
+}
+
+SeqScanner::~SeqScanner() {std::free(buf_);}
+
+void SeqScanner::assign(gzFile fp) {
+    fp_ = fp;
+    begin_ = end_ = 0;
+    eof_ = false;
+    error_.clear();
+}
+
+// Moves unparsed input to the front, doubling the buffer if that is all it holds, and reads more after it.
+bool SeqScanner::refill() {
+    if(eof_) return false;
+    if(buf_ == nullptr && (buf_ = static_cast<char *>(std::malloc(cap_ + 1))) == nullptr)
+        LOG_EXIT("Could not allocate %zu bytes for parsing.\n", cap_ + 1);
+    if(begin_) {
+        std::memmove(buf_, buf_ + begin_, end_ - begin_);
+        end_ -= begin_, begin_ = 0;
+    }
+    if(end_ == cap_) {
+        char *tmp(static_cast<char *>(std::realloc(buf_, (cap_ << 1) + 1)));
+        if(tmp == nullptr) LOG_EXIT("Could not grow parsing buffer to %zu bytes.\n", (cap_ << 1) + 1);
+        buf_ = tmp, cap_ <<= 1;
+    }
+    const int rc(gzread(fp_, buf_ + end_, std::min(cap_ - end_, size_t(INT_MAX))));
+    if(rc <= 0) {
+        // A gzip stream which ends early reads as the end of the input, which only gzerror tells apart.
+        int err(Z_OK);
+        const char *msg(gzerror(fp_, &err)), *path_end(std::strstr(msg, ": "));
+        if(rc < 0 || err != Z_OK) error_ = path_end ? path_end + 2: msg; // Drop the "<path>: " gzerror starts with.
+        eof_ = true;
+        return false;
+    }
+    end_ += rc;
+    return true;
+}
+
+// Joins the lines in lines_[first, last) at the position of the first of them, NUL-terminates them there and returns their length.
+size_t SeqScanner::join(size_t first, size_t last) {
+    char *const base(buf_ + begin_), *w(base + lines_[first].first);
+    for(size_t i(first); i < last; ++i) {
+        const size_t len(lines_[i].second - lines_[i].first);
+        if(w != base + lines_[i].first) std::memmove(w, base + lines_[i].first, len);
+        w += len;
+    }
+    *w = '\0';
+    return w - (base + lines_[first].first);
+}
+
+INLINE size_t trim_cr(const char *s, size_t start, size_t end) {
+    return end > start && s[end - 1] == '\r' ? end - 1: end;
+}
+
+// The header line is buf_[start, end), offsets from begin_, marker included.
+void SeqScanner::parse_header(seq_record_t &rec, size_t start, size_t end) {
+    char *const base(buf_ + begin_);
+    end = trim_cr(base, start, end);
+    size_t i(start + 1);
+    while(i < end && base[i] != ' ' && base[i] != '\t') ++i;
+    rec.name_ = base + start + 1, rec.l_name_ = i - start - 1;
+    if(i < end) {
+        rec.comment_ = base + i + 1, rec.l_comment_ = end - i - 1;
+        base[i] = '\0';
+    } else rec.comment_ = nullptr, rec.l_comment_ = 0;
+    base[end] = '\0';
+}
+
+// The record runs until the next newline followed by '>'. Where the search stopped is kept across refills.
+bool SeqScanner::next_fasta(seq_record_t &rec) {
+    size_t scanned(0), stop;
+    for(;;) {
+        const char *p(find_record(buf_ + begin_ + scanned, buf_ + end_, '>'));
+        if(p) {
+            stop = p - (buf_ + begin_);
+            break;
+        }
+        scanned = end_ - begin_ > 0 ? end_ - begin_ - 1: 0; // The last newline's next byte has not been read yet.
+        if(!refill()) {
+            stop = end_ - begin_;
+            break;
+        }
+    }
+    char *const base(buf_ + begin_);
+    const char *nl(find_newline(base, base + stop));
+    const size_t header_end(nl ? nl - base: stop);
+    lines_.clear();
+    for(size_t start(header_end + 1); start < stop;) {
+        nl = find_newline(base + start, base + stop);
+        const size_t end(nl ? nl - base: stop);
+        lines_.emplace_back(start, trim_cr(base, start, end));
+        start = end + 1;
+    }
+    if(lines_.empty()) lines_.emplace_back(stop, stop); // No sequence. base[stop] is the newline or the spare byte.
+    parse_header(rec, 0, header_end);
+    rec.l_seq_ = join(0, lines_.size());
+    rec.seq_   = base + lines_[0].first;
+    rec.qual_  = nullptr, rec.l_qual_ = 0;
+    begin_ += std::min(stop + 1, end_ - begin_);
+    return true;
+}
+
+// Returns 1 for a record, 0 if the buffer does not hold the whole record yet and -1 for a truncated record at the end of the input.
+// Nothing is changed until the whole record has been found, so it can be called again after a refill.
+int SeqScanner::next_fastq(seq_record_t &rec) {
+    char *const base(buf_ + begin_);
+    const size_t n(end_ - begin_);
+    // The line from start, as [start, end) and the next line's start. Lines at the end of input need not end in a newline.
+    auto line = [&](size_t start, size_t &end, size_t &next) {
+        const char *nl(find_newline(base + start, base + n));
+        if(nl == nullptr && !eof_) return false;
+        next = nl ? nl - base + 1: n;
+        end  = trim_cr(base, start, nl ? nl - base: n);
+        return true;
+    };
+    size_t header_end, pos, end, next, seq_len(0), qual_len(0);
+    if(!line(0, header_end, pos)) return 0;
+    lines_.clear();
+    for(;;) {
+        if(pos >= n) return eof_ ? -1: 0;
+        if(base[pos] == '+') break;
+        if(!line(pos, end, next)) return 0;
+        lines_.emplace_back(pos, end), seq_len += end - pos, pos = next;
+    }
+    const size_t plus(pos), nseq(lines_.size());
+    if(!line(pos, end, pos)) return 0;
+    do {
+        if(pos >= n) {
+            if(!eof_) return 0;
+            if(qual_len < seq_len) return -1;
+            break;
+        }
+        if(!line(pos, end, next)) return 0;
+        lines_.emplace_back(pos, end), qual_len += end - pos, pos = next;
+    } while(qual_len < seq_len);
+    parse_header(rec, 0, header_end);
+    if(nseq) {
+        rec.seq_ = base + lines_[0].first, rec.l_seq_ = join(0, nseq);
+    } else {
+        // The '+' is no longer needed, so an empty sequence can be terminated there.
+        rec.seq_ = base + plus, rec.l_seq_ = 0;
+        *rec.seq_ = '\0';
+    }
+    if(lines_.size() > nseq) {
+        rec.qual_ = base + lines_[nseq].first, rec.l_qual_ = join(nseq, lines_.size());
+    } else rec.qual_ = nullptr, rec.l_qual_ = 0;
+    begin_ += pos;
+    return 1;
+}
+
+bool SeqScanner::next(seq_record_t &rec) {
+    // Skip to the next line starting with '>' or '@'.
+    for(bool skipping(false);;) {
+        while(begin_ < end_) {
+            if(!skipping && (buf_[begin_] == '>' || buf_[begin_] == '@')) break;
+            const char *nl(find_newline(buf_ + begin_, buf_ + end_));
+            skipping = nl == nullptr;
+            begin_ = nl ? nl - buf_ + 1: end_;
+        }
+        if(begin_ < end_) break;
+        if(!refill()) return false;
+    }
+    if(buf_[begin_] == '>') return next_fasta(rec);
+    for(;;) {
+        switch(next_fastq(rec)) {
+            case 1: return true;
+            case -1:
+                if(error_.empty()) LOG_WARNING("Truncated FASTQ record at the end of the input.\n");
+                begin_ = end_;
+                return false;
+        }
+        refill(); // At the end of the input, next_fastq either finishes the record or rejects it.
+    }
+}
+
+namespace {
+
+INLINE void trim_readno(seq_record_t &rec) {
+    if(rec.l_name_ > 2 && rec.name_[rec.l_name_ - 2] == '/' && std::isdigit(rec.name_[rec.l_name_ - 1]))
+        rec.name_[rec.l_name_ -= 2] = '\0';
+}
+
+INLINE size_t batch_put(bseq_batch_t *b, const char *s, size_t l) {
+    const size_t ret(b->l);
+    std::memcpy(b->buf + b->l, s, l);
+    b->buf[b->l += l] = '\0';
+    ++b->l;
+    return ret;
+}
+
+// Fields are kept as offsets in the record's pointers until the arena stops moving.
+void batch_add(bseq_batch_t *b, const seq_record_t &rec) {
+    const size_t need(b->l + rec.l_name_ + rec.l_comment_ + rec.l_seq_ + rec.l_qual_ + 4);
+    if(b->n >= b->m) {
+        b->m = b->m ? b->m << 1: 4096;
+        if((b->seqs = static_cast<bseq1_t *>(std::realloc(b->seqs, b->m * sizeof(bseq1_t)))) == nullptr)
+            LOG_EXIT("Could not allocate %i records.\n", b->m);
+    }
+    if(need > b->cap) {
+        b->cap = std::max(need, b->cap << 1);
+        if((b->buf = static_cast<char *>(std::realloc(b->buf, b->cap))) == nullptr)
+            LOG_EXIT("Could not allocate %zu bytes of records.\n", b->cap);
+    }
+    bseq1_t &s(b->seqs[b->n]);
+    s.name    = reinterpret_cast<char *>(batch_put(b, rec.name_, rec.l_name_));
+    s.comment = rec.l_comment_ ? reinterpret_cast<char *>(batch_put(b, rec.comment_, rec.l_comment_)): nullptr;
+    s.seq     = reinterpret_cast<char *>(batch_put(b, rec.seq_, rec.l_seq_));
+    s.qual    = rec.l_qual_ ? reinterpret_cast<char *>(batch_put(b, rec.qual_, rec.l_qual_)): nullptr;
+    s.l_seq   = int(rec.l_seq_);
+    s.id      = b->n++;
+    s.sam     = nullptr;
+    s.l_sam   = 0;
+}
+
+} // anonymous namespace
+
+int bseq_batch_read(int64_t chunk_size, bseq_batch_t *b, SeqScanner &s1, SeqScanner *s2) {
+    seq_record_t r1, r2;
+    int64_t size(0);
+    b->n = 0, b->l = 0;
+    while(s1.next(r1)) {
+        if(s2 && !s2->next(r2)) {
+            if(s2->error()) return -1;
+            LOG_WARNING("The 2nd file has fewer sequences.\n");
+            break;
+        }
+        trim_readno(r1);
+        batch_add(b, r1);
+        size += r1.l_seq_;
+        if(s2) {
+            trim_readno(r2);
+            batch_add(b, r2);
+            size += r2.l_seq_;
+        }
+        if(size >= chunk_size && (b->n & 1) == 0) break;
+    }
+    if(s1.error() || (s2 && s2->error())) return -1;
+    if(size == 0 && s2 && s2->next(r2)) LOG_WARNING("The 1st file has fewer sequences.\n");
+    for(int i(0); i < b->n; ++i) {
+        bseq1_t &s(b->seqs[i]);
+        s.name = b->buf + reinterpret_cast<size_t>(s.name);
+        s.seq  = b->buf + reinterpret_cast<size_t>(s.seq);
+        if(s.comment) s.comment = b->buf + reinterpret_cast<size_t>(s.comment);
+        if(s.qual)    s.qual    = b->buf + reinterpret_cast<size_t>(s.qual);
+    }
+    return b->n;
+}
+
+} // namespace emp
@@ -0,0 +1,119 @@
+#include "serve.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+namespace emp {
+
+static sockaddr_un unix_address(const char *path) {
+    sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(std::strlen(path) >= sizeof(addr.sun_path)) LOG_EXIT("Socket path %s is too long.\n", path);
+    std::strcpy(addr.sun_path, path);
+    return addr;
+}
+
+int unix_listen(const char *path) {
+    const sockaddr_un addr(unix_address(path));
+    const int fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if(fd < 0) LOG_EXIT("Could not create socket: %s\n", std::strerror(errno));
+    // A socket left over from a server which did not shut down cleanly is replaced. Anything else is left alone:
+    // a live server's socket, or a file which is not a socket at all.
+    struct stat st;
+    if(::lstat(path, &st) == 0) {
+        if(!S_ISSOCK(st.st_mode)) LOG_EXIT("%s exists and is not a socket.\n", path);
+        const int probe(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if(probe < 0) LOG_EXIT("Could not create socket: %s\n", std::strerror(errno));
+        const int rc(::connect(probe, (const sockaddr *)&addr, sizeof(addr))), err(errno);
+        ::close(probe);
+        if(rc == 0) LOG_EXIT("A server is already listening on %s.\n", path);
+        if(err != ECONNREFUSED) LOG_EXIT("Could not check whether %s is in use: %s\n", path, std::strerror(err));
+        if(::unlink(path)) LOG_EXIT("Could not remove stale socket %s: %s\n", path, std::strerror(errno));
+    } else if(errno != ENOENT) LOG_EXIT("Could not stat %s: %s\n", path, std::strerror(errno));
+    if(::bind(fd, (const sockaddr *)&addr, sizeof(addr)) || ::listen(fd, SOMAXCONN))
+        LOG_EXIT("Could not listen on %s: %s\n", path, std::strerror(errno));
+    return fd;
+}
+
+int unix_connect(const char *path) {
+    const sockaddr_un addr(unix_address(path));
+    const int fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if(fd < 0) LOG_EXIT("Could not create socket: %s\n", std::strerror(errno));
+    if(::connect(fd, (const sockaddr *)&addr, sizeof(addr))) LOG_EXIT("Could not connect to %s: %s\n", path, std::strerror(errno));
+    return fd;
+}
+
+bool read_line(int fd, std::string &line, size_t maxlen) {
+    line.clear();
+    for(char c;;) {
+        const ssize_t rc(::read(fd, &c, 1));
+        if(rc < 0 && errno == EINTR) continue;
+        if(rc <= 0) return false;
+        if(c == '\n') return true;
+        if(line.size() == maxlen) return false;
+        line.push_back(c);
+    }
+}
+
+void send_error(int fd, const char *msg) {
+    std::string line("ERR ");
+    line += msg;
+    line += '\n';
+    write_all(fd, line.data(), line.size()); // Nothing more to do if the client has gone.
+}
+
+void log_request(u64 id, const char *what, const request_stats_t &stats) {
+    LOG_INFO("Request %" PRIu64 " (%s): %" PRIu64 " reads, %" PRIu64 " classified in %.3lfs after %.3lfs queued (%.0lf reads/s).\n",
+             id, what, stats.nreads_, stats.nclassified_, stats.seconds_, stats.queued_seconds_,
+             stats.seconds_ > 0. ? stats.nreads_ / stats.seconds_: 0.);
+}
+
+bool submit_request(const char *socket_path, const std::string &header, const char *stream_path, std::FILE *out) {
+    const int fd(unix_connect(socket_path));
+    if(!write_all(fd, header.data(), header.size()) || !write_all(fd, "\n", 1))
+        LOG_EXIT("Could not send request: %s\n", std::strerror(errno));
+    std::thread sender;
+    if(stream_path) {
+        // Send from another thread, since the server starts answering before it has all the records.
+        const int in(std::strcmp(stream_path, "-") ? ::open(stream_path, O_RDONLY): STDIN_FILENO);
+        if(in < 0) LOG_EXIT("Could not open %s: %s\n", stream_path, std::strerror(errno));
+        sender = std::thread([fd, in]() {
+            std::vector<char> buf(1 << 16);
+            for(ssize_t rc; (rc = ::read(in, buf.data(), buf.size())) != 0;) {
+                if(rc < 0) {
+                    if(errno == EINTR) continue;
+                    LOG_EXIT("Could not read input: %s\n", std::strerror(errno));
+                }
+                if(!write_all(fd, buf.data(), rc)) break; // The server has stopped reading: it answered with an error.
+            }
+            if(in != STDIN_FILENO) ::close(in);
+            ::shutdown(fd, SHUT_WR);
+        });
+    }
+    // An error is the last line of the response, so the last line is held back until the server hangs up.
+    std::vector<char> buf(1 << 16);
+    std::string last;
+    std::fflush(out);
+    for(ssize_t rc; (rc = ::read(fd, buf.data(), buf.size())) != 0;) {
+        if(rc < 0) {
+            if(errno == EINTR) continue;
+            LOG_EXIT("Could not read response: %s\n", std::strerror(errno));
+        }
+        last.append(buf.data(), rc);
+        const size_t end(last.size() > 1 ? last.rfind('\n', last.size() - 2): std::string::npos);
+        if(end == std::string::npos) continue;
+        if(!write_all(fileno(out), last.data(), end + 1)) LOG_EXIT("Could not write output: %s\n", std::strerror(errno));
+        last.erase(0, end + 1);
+    }
+    if(sender.joinable()) sender.join();
+    ::close(fd);
+    if(last.compare(0, 4, "ERR ") == 0) {
+        std::fwrite(last.data(), 1, last.size(), stderr);
+        return false;
+    }
+    if(!write_all(fileno(out), last.data(), last.size())) LOG_EXIT("Could not write output: %s\n", std::strerror(errno));
+    return true;
+}
+
+} // namespace emp
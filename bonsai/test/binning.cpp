@@ -0,0 +1,84 @@
+#include "test/phix.h"
+#include <map>
+#include <sstream>
+using namespace emp;
+
+TEST_CASE("Reads are binned by their calls") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return 2 + (i / 1000 & 1);});
+    Classifier &c(f.c_);
+    const FlatTaxonomy &tax(f.tax_);
+    const std::vector<std::string> reads(f.write_reads("__zomg_reads.fq", 100, 11, [&](size_t i, size_t offset) {
+        return i % 5 ? f.genome_.substr(offset, 100): std::string(100, 'A');
+    }));
+
+    // The calls each read should be binned by, from kraken-style output.
+    std::vector<std::pair<std::string, tax_t>> calls;
+    {
+        std::istringstream iss(f.classify_file("__zomg_reads.fq", 4000, 8));
+        for(std::string line; std::getline(iss, line);) {
+            const size_t name_end(line.find('\t', 2));
+            calls.emplace_back(line.substr(2, name_end - 2), std::strtoul(line.data() + name_end + 1, nullptr, 10));
+        }
+    }
+    // Names of the reads in a bin, each of which must be the whole record as it was read.
+    auto bin_names = [&](const std::string &path) {
+        std::vector<std::string> ret;
+        std::ifstream ifs(path);
+        for(std::string name, seq, plus, qual; std::getline(ifs, name) && std::getline(ifs, seq) && std::getline(ifs, plus) && std::getline(ifs, qual);) {
+            REQUIRE(name.substr(0, 5) == "@read");
+            REQUIRE(seq == reads[std::stoul(name.substr(5))]);
+            REQUIRE(plus == "+");
+            REQUIRE(qual == std::string(seq.size(), 'I'));
+            ret.push_back(name.substr(1));
+        }
+        return ret;
+    };
+    struct {bool classified, unclassified; std::vector<tax_t> clades;} configs[] {
+        {true,  true,  {}},
+        {false, true,  {}},
+        {true,  false, {1}}
+    };
+    for(const auto &config: configs) {
+        TaxonBins bins(tax, config.classified, config.unclassified, 1);
+        if(config.clades.size()) bins.set_clades(config.clades);
+        c.bins_ = &bins;
+        c.set_emit_kraken(false), c.set_emit_all(false);
+        std::FILE *out(std::fopen("__zomg_out.txt", "w"));
+        process_dataset(c, tax, "__zomg_reads.fq", nullptr, out, 4000, 8, true, 1, COMPRESS_NONE, 1, "__zomg_bin.");
+        std::fclose(out);
+        std::map<tax_t, std::vector<std::string>> expected;
+        for(const auto &call: calls)
+            if(bins.bin(call.second) != TaxonBins::NO_BIN) expected[bins.bin(call.second)].push_back(call.first);
+        REQUIRE(expected.size() > 0);
+        for(const tax_t bin: {0u, 1u, 2u, 3u}) {
+            const std::string path(bin ? "__zomg_bin." + std::to_string(bin) + ".fq": std::string("__zomg_bin.unclassified.fq"));
+            REQUIRE(bin_names(path) == expected[bin]);
+            std::remove(path.data());
+        }
+        c.set_emit_kraken(true), c.set_emit_all(true);
+    }
+    c.bins_ = nullptr;
+    for(const char *path: {"__zomg_reads.fq", "__zomg_out.txt"}) std::remove(path);
+}
+
+TEST_CASE("Bins are FASTQ whatever the input, and closing twice is harmless") {
+    char name[] = "fasta_read", seq[] = "ACGTACGTAC";
+    bseq1_t bs{10, 0, 0, name, nullptr, seq, nullptr, nullptr};
+    ks::string entries;
+    append_bin_entry(7, &bs, 0, kspp2ks(entries));
+    {
+        ReadBinner binner("__zomg_bin.", 4);
+        binner.add(entries.data(), entries.size());
+        REQUIRE(binner.close());
+        REQUIRE(binner.close());
+        REQUIRE(slurp("__zomg_bin.7.fq") == "@fasta_read\nACGTACGTAC\n+\n" + std::string(10, TaxonBins::PLACEHOLDER_QUAL) + "\n");
+    }
+    std::remove("__zomg_bin.7.fq");
+    ReadBinner failing("/nonexistent/__zomg_bin.", 4);
+    failing.add(entries.data(), entries.size());
+    REQUIRE(!failing.close());
+    const int err(errno);
+    REQUIRE(!failing.close());
+    REQUIRE(errno == err);
+}
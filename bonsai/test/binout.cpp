@@ -0,0 +1,70 @@
+#include "test/phix.h"
+#include "binout.h"
+#include <sstream>
+using namespace emp;
+
+TEST_CASE("Binary output converts back to classify's text") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return i % 7 ? 2 + (i / 1000 & 1): 0;});
+    Classifier &c(f.c_);
+    const std::string &genome(f.genome_);
+    // Some reads miss the database entirely, and some have ambiguous bases.
+    f.write_reads("__zomg_reads1.fq", 100, 11, [&](size_t i, size_t offset) {
+        std::string seq(i % 5 ? genome.substr(offset, 100): std::string(100, 'A'));
+        if(i % 3 == 0) seq[i % 100] = 'N';
+        return seq;
+    });
+    f.write_reads("__zomg_reads2.fq", 100, 11, [&](size_t, size_t offset) {return genome.substr(genome.size() - offset - 100, 100);}, '5');
+    auto classify = [&](bool binary, bool paired) {
+        c.set_emit_binary(binary);
+        return f.classify_file(c, "__zomg_reads1.fq", paired ? "__zomg_reads2.fq": nullptr, 4000, 8);
+    };
+    auto view = [&](const char *path) {
+        const BinaryCalls calls(path);
+        std::FILE *out(std::fopen("__zomg_view.txt", "w"));
+        REQUIRE(calls.write_text(fileno(out), 3));
+        std::fclose(out);
+        return slurp("__zomg_view.txt");
+    };
+    struct {bool all, fastq, kraken, paired;} configs[] {
+        {false, false, true,  false},
+        {true,  false, true,  true},
+        {true,  true,  true,  true},
+        {false, true,  false, false}
+    };
+    for(const auto &config: configs) {
+        c.set_emit_all(config.all), c.set_emit_fastq(config.fastq), c.set_emit_kraken(config.kraken);
+        const std::string expected(classify(false, config.paired));
+        REQUIRE(expected.size());
+        const std::string binary(classify(true, config.paired));
+        REQUIRE(binary.size() < expected.size());
+        std::ofstream("__zomg_out.bin").write(binary.data(), binary.size());
+        REQUIRE(view("__zomg_out.bin") == expected);
+        if(!config.fastq) {
+            // Blocks can be read on their own: the index gives each one's first record.
+            const BinaryCalls calls("__zomg_out.bin");
+            std::istringstream iss(expected);
+            std::string line;
+            binout_record_t rec;
+            u64 nrecords(0);
+            for(size_t i(0); i < calls.nblocks(); ++i) {
+                REQUIRE(calls.first_record(i) == nrecords);
+                calls.for_each(i, [&](const binout_record_t &rec) {
+                    REQUIRE(std::getline(iss, line));
+                    REQUIRE(rec.taxon_ == std::strtoul(line.data() + line.find('\t', 2) + 1, nullptr, 10));
+                    ++nrecords;
+                }, rec);
+            }
+            REQUIRE(!std::getline(iss, line));
+            REQUIRE(calls.nrecords() == nrecords);
+        }
+
+        // Without its index, the file is read block by block.
+        binout_trailer_t t;
+        std::memcpy(&t, binary.data() + binary.size() - sizeof(t), sizeof(t));
+        REQUIRE(t.nblocks_ > 1);
+        std::ofstream("__zomg_out.bin").write(binary.data(), t.index_offset_);
+        REQUIRE(view("__zomg_out.bin") == expected);
+    }
+    for(const char *path: {"__zomg_reads1.fq", "__zomg_reads2.fq", "__zomg_out.bin", "__zomg_view.txt"}) std::remove(path);
+}
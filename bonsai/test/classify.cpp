@@ -0,0 +1,441 @@
+#include "test/phix.h"
+#include "database.h"
+#include <sstream>
+using namespace emp;
+
+TEST_CASE("Batched lookups match unbatched lookups") {
+    PhixTest f(1);
+    f.add_kmers([](size_t i) {return i % 3 ? 2 + (i & 1): 0;}); // Leave some k-mers out of the database.
+    std::vector<tax_t> taxa, unbatched_taxa;
+    for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 97) {
+        std::string seq(f.genome_.substr(offset, 150));
+        if(offset & 1) seq[offset % 150] = 'N';
+        std::string results[2];
+        for(const bool batch: {true, false}) {
+            f.c_.batch_ = batch;
+            results[batch] = f.classify(seq, "read", batch ? &taxa: &unbatched_taxa);
+        }
+        REQUIRE(taxa == unbatched_taxa);
+        REQUIRE(results[0] == results[1]);
+    }
+    REQUIRE(f.c_.n_classified() > 0);
+}
+
+TEST_CASE("Early exit calls the full call or one of its ancestors") {
+    // 1 -> {2 -> 4, 3}
+    PhixTest f(1, 31, {{1, 0}, {2, 1}, {3, 1}, {4, 2}});
+    f.add_kmers([](size_t i) {return i % 7 == 0 ? 0: i % 11 == 0 ? 3: i % 13 == 0 ? 2: 4;});
+    auto call = [](const std::string &s) {return tax_t(std::strtoul(std::strchr(std::strchr(s.data(), '\t') + 1, '\t') + 1, nullptr, 10));};
+    std::vector<tax_t> taxa, full_taxa;
+    size_t nfull(0), nearly(0);
+    for(const double confidence: {0., 0.5, 0.9}) {
+        f.c_.confidence_ = confidence;
+        for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 97) {
+            std::string seq(f.genome_.substr(offset, 150));
+            if(offset & 1) seq[offset % 150] = 'N';
+            tax_t calls[2];
+            for(const bool early_exit: {false, true}) {
+                f.c_.early_exit_ = early_exit;
+                calls[early_exit] = call(f.classify(seq, "read", early_exit ? &taxa: &full_taxa));
+            }
+            REQUIRE(taxa.size() <= full_taxa.size());
+            REQUIRE(std::equal(taxa.begin(), taxa.end(), full_taxa.begin()));
+            if(calls[1]) REQUIRE(f.tax_.lca(calls[0], calls[1]) == calls[1]);
+            else         REQUIRE(calls[0] == 0);
+            nfull += full_taxa.size(), nearly += taxa.size();
+        }
+    }
+    REQUIRE(nearly < nfull);
+}
+
+TEST_CASE("Windowed databases are classified by minimizers") {
+    PhixTest f(1, 50, {{1, 0}, {2, 1}});
+    REQUIRE(!f.enc_.sp_.unwindowed());
+    int khr;
+    f.enc_.for_each_seq([&](u64 min) {kh_val(f.db_, kh_put(c, f.db_, min, &khr)) = 2;}, &f.genome_[0], f.genome_.size());
+    REQUIRE(kh_size(f.db_) < f.genome_.size() / 4);
+    for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 97) {
+        f.classify(f.genome_.substr(offset, 150));
+        REQUIRE(f.taxa_.size() == 150 - 50 + 1);
+        REQUIRE(std::count(f.taxa_.begin(), f.taxa_.end(), 2u) == f.taxa_.size());
+    }
+    REQUIRE(f.c_.n_unclassified() == 0);
+}
+
+// Fills f.db_ with phiX's minimizers as taxon 2, built the way phase1 builds databases: from the file, through Encoder::add.
+template<typename ScoreType>
+static void add_built_minimizers(PhixTest &f, const Encoder<ScoreType> &proto) {
+    Encoder<ScoreType> enc(proto);
+    khash_t(all) *set(kh_init(all));
+    enc.add(set, "test/phix.fa");
+    int khr;
+    for(khiter_t ki(0); ki != kh_end(set); ++ki)
+        if(kh_exist(set, ki)) kh_val(f.db_, kh_put(c, f.db_, kh_key(set, ki), &khr)) = 2;
+    kh_destroy(all, set);
+}
+
+TEST_CASE("Entropy-scored windowed databases are classified by the minimizers they were built with") {
+    PhixTest f(1, 50, {{1, 0}, {2, 1}});
+    ClassifierGeneric<score::Entropy> ec(f.db_, f.sv_, 31, 50, 1, true, false, true, true);
+    Encoder<score::Entropy> enc(ec.enc_);
+    REQUIRE(!enc.sp_.unwindowed());
+    add_built_minimizers(f, enc);
+    REQUIRE(kh_size(f.db_) < f.genome_.size() / 4);
+    for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 97) {
+        std::string seq(f.genome_.substr(offset, 150)), qual(seq.size(), 'I');
+        bseq1_t bs{int(seq.size()), 0, 0, const_cast<char *>("read"), nullptr, &seq[0], &qual[0], nullptr};
+        classify_seq(ec, enc, f.tax_, &bs, 0, f.taxa_, f.kmers_);
+        std::free(bs.sam);
+        REQUIRE(f.taxa_.size() == 150 - 50 + 1);
+        REQUIRE(std::count(f.taxa_.begin(), f.taxa_.end(), 2u) == f.taxa_.size());
+    }
+    REQUIRE(ec.n_unclassified() == 0);
+}
+
+TEST_CASE("Legacy windowed databases, whose scoring is unknown, have all their k-mers looked up") {
+    PhixTest f(1, 50, {{1, 0}, {2, 1}});
+    {
+        ClassifierGeneric<score::Entropy> ec(f.db_, f.sv_, 31, 50, 1, true, false, true, true);
+        add_built_minimizers(f, ec.enc_);
+        Database<khash_t(c)> built(31, 50, f.sv_, 0, f.db_);
+        built.scheme_ = score_scheme::ENTROPY;
+        built.write("__zomg_legacy_entropy.db");
+    }
+    Database<khash_t(c)> db("__zomg_legacy_entropy.db");
+    REQUIRE(!db.is_mapped());
+    REQUIRE(db.w_ == 50);
+    REQUIRE(db.scheme_ == SCHEME_UNKNOWN);
+    REQUIRE(db.lookup_window() == 31);
+    // Hits over k-mers looked up, for reads across the genome, each encoded as c is set up to.
+    auto hit_rate = [&f](Classifier &c) {
+        Encoder<score::Lex> enc(c.enc_);
+        u64 nhits(0), nkmers(0);
+        for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 97) {
+            std::string seq(f.genome_.substr(offset, 150)), qual(seq.size(), 'I');
+            bseq1_t bs{int(seq.size()), 0, 0, const_cast<char *>("read"), nullptr, &seq[0], &qual[0], nullptr};
+            classify_seq(c, enc, f.tax_, &bs, 0, f.taxa_, f.kmers_);
+            std::free(bs.sam);
+            nhits += std::count(f.taxa_.begin(), f.taxa_.end(), 2u), nkmers += f.taxa_.size();
+        }
+        return double(nhits) / nkmers;
+    };
+    Classifier c(db.db_, db.s_, db.k_, db.lookup_window(), 1, true, false, true, true);
+    REQUIRE(hit_rate(c) > 0.);
+    REQUIRE(c.n_unclassified() == 0);
+    // Lexicographic minimizers, which is what the window used to be read as, mostly miss.
+    Classifier lex(db.db_, db.s_, db.k_, db.w_, 1, true, false, true, true);
+    REQUIRE(hit_rate(lex) < 0.5);
+    std::remove("__zomg_legacy_entropy.db");
+}
+
+TEST_CASE("All-T minimizers are not taken for runs of ambiguous k-mers") {
+    PhixTest f(1);
+    // Uncanonicalized with k = 32, a minimizer of all Ts is BF.
+    spvec_t sv(31, 0);
+    Classifier uncanon(f.db_, sv, 32, 50, 1, true, false, true, false);
+    Encoder<score::Lex> enc(uncanon.enc_);
+    REQUIRE(!enc.sp_.unwindowed());
+    REQUIRE(!enc.canonicalize());
+    int khr;
+    enc.for_each_seq([&](u64 min) {kh_val(f.db_, kh_put(c, f.db_, min, &khr)) = 2;}, &f.genome_[0], f.genome_.size());
+    const std::string reads[] {std::string(100, 'T'), f.genome_.substr(0, 80) + std::string(60, 'T') + f.genome_.substr(80, 80)};
+    for(const std::string &read: reads) {
+        std::string seq(read), qual(seq.size(), 'I');
+        bseq1_t bs{int(seq.size()), 0, 0, const_cast<char *>("read"), nullptr, &seq[0], &qual[0], nullptr};
+        classify_seq(uncanon, enc, f.tax_, &bs, 0, f.taxa_, f.kmers_);
+        std::free(bs.sam);
+        REQUIRE(f.taxa_.size() <= seq.size() - 50 + 1);
+    }
+    REQUIRE(uncanon.n_unclassified() == 1);
+    REQUIRE(uncanon.n_classified() == 1);
+}
+
+TEST_CASE("Pipelined classification matches sequential classification") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return i % 7 ? 2 + (i / 1000 & 1): 0;});
+    const std::string expected(f.classify_reads(f.write_reads("__zomg_reads.fq", 100, 7)));
+    // Chunks of a few reads, so that many are read, classified and written at once; each must still come out in turn.
+    for(const u64 chunk_size: {500u, 5000u, 1u << 20})
+        for(const bool pipeline: {true, false})
+            REQUIRE(f.classify_file("__zomg_reads.fq", chunk_size, 32, pipeline) == expected);
+    std::remove("__zomg_reads.fq");
+}
+
+TEST_CASE("Arena read batches match per-record reads") {
+    std::FILE *ofp(std::fopen("__zomg_reads.fq", "w"));
+    for(size_t i(0); i < 3000; ++i) {
+        const size_t len(20 + i * 37 % 400);
+        if(i % 3) std::fprintf(ofp, "@read%zu/1\n%s\n+\n%s\n", i, std::string(len, "ACGT"[i & 3]).data(), std::string(len, 'I').data());
+        else      std::fprintf(ofp, "@read%zu comment%zu\n%s\n+\n%s\n", i, i, std::string(len, 'A').data(), std::string(len, 'I').data());
+    }
+    std::fclose(ofp);
+    auto str = [](const char *s) {return s ? std::string(s): std::string("(null)");};
+    gzFile fp1(gzopen("__zomg_reads.fq", "rb")), fp2(gzopen("__zomg_reads.fq", "rb"));
+    kseq_t *ks1(kseq_init(fp1));
+    SeqScanner ss(fp2, 1 << 12); // Smaller than a chunk, so that records straddle refills.
+    bseq_batch_t batch{nullptr, 0, 0, nullptr, 0, 0};
+    size_t total(0), nchunks(0);
+    for(int n;;) {
+        bseq1_t *seqs(bseq_read(10000, &n, (void *)ks1, nullptr));
+        REQUIRE(bseq_batch_read(10000, &batch, ss) == n);
+        for(int i(0); i < n; ++i) {
+            REQUIRE(str(batch.seqs[i].name) == str(seqs[i].name));
+            REQUIRE(str(batch.seqs[i].comment) == str(seqs[i].comment));
+            REQUIRE(str(batch.seqs[i].seq) == str(seqs[i].seq));
+            REQUIRE(str(batch.seqs[i].qual) == str(seqs[i].qual));
+            REQUIRE(batch.seqs[i].l_seq == seqs[i].l_seq);
+            bseq_destroy(seqs + i);
+        }
+        std::free(seqs);
+        if(n == 0) break;
+        total += n, ++nchunks;
+    }
+    REQUIRE(total == 3000);
+    REQUIRE(nchunks > 1);
+    bseq_batch_destroy(&batch);
+    kseq_destroy(ks1);
+    gzclose(fp1), gzclose(fp2);
+    std::remove("__zomg_reads.fq");
+}
+
+TEST_CASE("Abundance report matches per-read calls") {
+    PhixTest f(4);
+    // Leave whole stretches out, so that some reads are unclassified.
+    f.add_kmers([](size_t i) {return i / 500 % 4 ? 2 + (i / 1000 & 1): 0;});
+    const size_t nreads(f.write_reads("__zomg_reads.fq", 100, 7).size());
+
+    std::vector<u64> direct[2], clade[2];
+    std::map<tax_t, u64> calls;
+    std::string table;
+    for(const bool per_read: {true, false}) {
+        AbundanceReport report(f.tax_, f.c_.nt_);
+        f.c_.report_ = &report;
+        f.c_.set_emit_all(per_read), f.c_.set_emit_kraken(per_read);
+        std::istringstream iss(f.classify_file("__zomg_reads.fq", 5000, 32));
+        for(std::string line; std::getline(iss, line);) {
+            REQUIRE(per_read);
+            ++calls[std::strtoul(line.data() + line.find('\t', 2) + 1, nullptr, 10)];
+        }
+        report.merge(direct[per_read], clade[per_read]);
+        if(!per_read) report.write("__zomg_report.txt"), table = slurp("__zomg_report.txt");
+        f.c_.report_ = nullptr;
+    }
+    REQUIRE(direct[0] == direct[1]);
+    REQUIRE(clade[0] == clade[1]);
+    REQUIRE(calls.size() > 1);
+    REQUIRE(calls[0] > 0);
+    for(const auto &pair: calls) REQUIRE(direct[1][f.tax_.dense(pair.first)] == pair.second);
+    REQUIRE(clade[1][0] == nreads);
+    REQUIRE(clade[1][f.tax_.dense(1)] == nreads - calls[0]);
+    // The table has the same counts: reads in the clade, then reads called there.
+    auto row = [&](tax_t taxon) {return '\t' + std::to_string(clade[0][f.tax_.dense(taxon)]) + '\t' + std::to_string(calls[taxon]) + '\t';};
+    const std::string unclassified(std::to_string(calls[0]));
+    REQUIRE(table.find('\t' + unclassified + '\t' + unclassified + "\tU\t0\tunclassified\n") != std::string::npos);
+    for(const tax_t taxon: {1u, 2u, 3u}) REQUIRE(table.find(row(taxon) + "-\t" + std::to_string(taxon) + '\t') != std::string::npos);
+    std::remove("__zomg_reads.fq");
+    std::remove("__zomg_report.txt");
+}
+
+TEST_CASE("K-mer cache does not change calls") {
+    PhixTest f(1);
+    f.add_kmers([](size_t i) {return i % 3 ? 2 + (i & 1): 0;}); // Cache misses too.
+    std::vector<tax_t> taxa, cached_taxa;
+    for(const bool batch: {true, false}) {
+        f.c_.batch_ = batch;
+        f.c_.enable_cache(6); // Small enough for evictions.
+        // Overlapping reads, so that k-mers recur.
+        for(size_t offset(0); offset + 150 < f.genome_.size(); offset += 13) {
+            const std::string seq(f.genome_.substr(offset, 150));
+            std::string results[2];
+            for(const bool cached: {false, true}) {
+                std::vector<KmerCache> saved; // Set the caches aside for the uncached run.
+                if(!cached) saved.swap(f.c_.caches_);
+                results[cached] = f.classify(seq, "read", cached ? &cached_taxa: &taxa);
+                if(!cached) saved.swap(f.c_.caches_);
+            }
+            REQUIRE(taxa == cached_taxa);
+            REQUIRE(results[0] == results[1]);
+        }
+        REQUIRE(f.c_.cache_hits() > 0);
+        REQUIRE(f.c_.cache_misses() > 0);
+    }
+}
+
+TEST_CASE("Length-balanced groups match sequential classification") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return i % 7 ? 2 + (i / 1000 & 1): 0;});
+    // Mostly short reads, with a few reads nearly the length of the genome.
+    const std::string &genome(f.genome_);
+    const std::string expected(f.classify_reads(f.write_reads("__zomg_reads.fq", 100, 7, [&](size_t i, size_t offset) {
+        return i % 97 ? genome.substr(offset, 100): genome.substr(offset / 2, genome.size() / 2);
+    })));
+    const void *workers(nullptr);
+    for(const unsigned groups_per_thread: {1u, 16u, 1000u}) {
+        REQUIRE(f.classify_file("__zomg_reads.fq", 300, groups_per_thread) == expected);
+        // Each thread's encoder and buffers are made once and kept for every chunk and run after.
+        REQUIRE(f.c_.workers_.size() == f.nthreads_);
+        if(workers == nullptr) workers = f.c_.workers_.data();
+        REQUIRE(f.c_.workers_.data() == workers);
+    }
+    std::remove("__zomg_reads.fq");
+}
+
+TEST_CASE("Split long reads match unsplit classification") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return i % 7 ? 2 + (i / 1000 & 1): 0;});
+    // Short reads between long ones, some of which have ambiguous bases at segment boundaries.
+    const std::string &genome(f.genome_);
+    const std::vector<std::string> reads(f.write_reads("__zomg_reads.fq", 100, 41, [&](size_t i, size_t offset) {
+        std::string seq(i % 13 ? genome.substr(offset, 100): genome.substr(offset / 2, genome.size() / 2));
+        if(i % 26 == 0) seq[500] = seq[1010] = 'N';
+        return seq;
+    }));
+    const std::string expected(f.classify_reads(reads));
+    f.c_.segment_len_ = 500;
+    for(const bool emit_segments: {false, true}) {
+        f.c_.emit_segments_ = emit_segments;
+        std::string result(f.classify_file("__zomg_reads.fq", 1 << 14, 4));
+        if(emit_segments) {
+            // Split reads have one call per segment, and those spanning both taxa change calls along their length.
+            std::istringstream iss(result);
+            size_t nchimeric(0);
+            for(std::string line; std::getline(iss, line);) {
+                const std::string &read(reads[std::stoul(line.substr(line.find("\tread") + 5))]);
+                const size_t pos(line.find("\tG:"));
+                if(read.size() <= f.c_.segment_len_) {
+                    REQUIRE(pos == std::string::npos);
+                    continue;
+                }
+                size_t nsegments(0);
+                for(size_t start(0); start == 0 || start + f.wsz_ - 1 < read.size(); start += f.c_.segment_len_, ++nsegments);
+                const std::string calls(line.substr(pos + 3, line.find('\t', pos + 1) - pos - 3));
+                REQUIRE(size_t(std::count(calls.begin(), calls.end(), ',')) + 1 == nsegments);
+                nchimeric += calls.find('2') != std::string::npos && calls.find('3') != std::string::npos;
+            }
+            REQUIRE(nchimeric > 0);
+            // Drop the segment calls to compare the rest.
+            size_t nsplit(0);
+            for(size_t pos; (pos = result.find("\tG:")) != std::string::npos; ++nsplit)
+                result.erase(pos + 1, result.find('\t', pos + 1) - pos);
+            REQUIRE(nsplit > 0);
+        }
+        REQUIRE(result == expected);
+    }
+    std::remove("__zomg_reads.fq");
+}
+
+TEST_CASE("Batch classification matches classifying samples one at a time") {
+    PhixTest f(4);
+    f.add_kmers([](size_t i) {return i % 5 ? 2 + (i / 1000 & 1): 0;});
+    // Two single-end samples, a paired one and an empty one, with a few reads from elsewhere.
+    const char *paths[]{"__zomg_s0.fq", "__zomg_s1.fq", "__zomg_s2_1.fq", "__zomg_s2_2.fq", "__zomg_s3.fq"};
+    const std::string junk(150, 'A');
+    auto with_junk = [&](size_t i, size_t offset) {return i % 9 ? f.genome_.substr(offset, 150): junk;};
+    // No read as long as the genome fits, so the last sample is empty.
+    const u64 nreads[]{f.write_reads(paths[0], 150, 23, with_junk).size(), f.write_reads(paths[1], 150, 37).size(),
+                       f.write_reads(paths[2], 150, 29, with_junk).size(), f.write_reads(paths[4], f.genome_.size(), 1).size()};
+    auto mate = [&](size_t, size_t offset) {return f.genome_.substr(f.genome_.size() - offset - 150, 150);};
+    REQUIRE(f.write_reads(paths[3], 150, 29, mate, '5').size() == nreads[2]);
+    std::FILE *mfp(std::fopen("__zomg_manifest.txt", "w"));
+    std::fprintf(mfp, "# name output r1 r2\ns0 __zomg_s0.out %s\ns1 __zomg_s1.out %s\n\ns2 __zomg_s2.out %s %s\ns3 __zomg_s3.out %s\n",
+                 paths[0], paths[1], paths[2], paths[3], paths[4]);
+    std::fclose(mfp);
+    std::vector<sample_t> samples(parse_manifest("__zomg_manifest.txt"));
+    REQUIRE(samples.size() == 4);
+    REQUIRE(samples[2].is_paired());
+    REQUIRE(!samples[3].is_paired());
+
+    std::string expected[4];
+    u64 nclassified[4];
+    for(unsigned i(0); i < 4; ++i) {
+        const u64 before(f.c_.n_classified());
+        expected[i] = f.classify_file(f.c_, samples[i].fq1_.data(), samples[i].is_paired() ? samples[i].fq2_.data(): nullptr, 1 << 12, 4);
+        nclassified[i] = f.c_.n_classified() - before;
+    }
+    for(const bool pipeline: {true, false}) {
+        for(auto &sample: samples) sample.nreads_ = sample.nclassified_ = sample.nchunks_ = 0;
+        process_samples(f.c_, f.tax_, samples, 1 << 12, 4, pipeline);
+        for(unsigned i(0); i < 4; ++i) {
+            REQUIRE(slurp(samples[i].out_path_.data()) == expected[i]);
+            REQUIRE(samples[i].nclassified_ == nclassified[i]);
+            REQUIRE(samples[i].nreads_ == nreads[i]); // Pairs for the paired sample
+        }
+        REQUIRE(samples[0].nclassified_ < samples[0].nreads_);
+        REQUIRE(samples[2].nchunks_ > 1);
+        REQUIRE(samples[3].nchunks_ == 0);
+    }
+    for(const char *path: paths) std::remove(path);
+    for(const auto &sample: samples) std::remove(sample.out_path_.data());
+    std::remove("__zomg_manifest.txt");
+}
+
+TEST_CASE("Cascaded databases classify what the first leaves unclassified") {
+    PhixTest f(4);
+    // The small database holds the first half of the genome, the large one all of it.
+    khash_t(c) *small(f.db_), *large(f.new_db());
+    const size_t half(f.genome_.size() / 2);
+    f.add_kmers([half](size_t i) {return i < half ? 2: 0;}, small);
+    f.add_kmers([](size_t) {return 3;}, large);
+    Classifier &c1(f.c_);
+    std::unique_ptr<Classifier> c2(f.new_classifier(large)), cascade(f.new_classifier(small));
+    cascade->add_stage(large, nullptr, nullptr);
+    const std::vector<std::string> reads(f.write_reads("__zomg_reads.fq", 100, 23, [&](size_t i, size_t offset) {
+        return i % 9 ? f.genome_.substr(offset, 100): std::string(100, 'A');
+    }));
+    const u64 nreads(reads.size());
+    std::string expected;
+    u64 nsmall(0), nlarge(0);
+    for(size_t i(0); i < nreads; ++i) {
+        const u64 before(c1.n_classified());
+        std::string result(f.classify(c1, reads[i], f.read_name(i)));
+        if(c1.n_classified() == before) {
+            const u64 before2(c2->n_classified());
+            result = f.classify(*c2, reads[i], f.read_name(i));
+            nlarge += c2->n_classified() != before2;
+        } else ++nsmall;
+        expected += result;
+    }
+    REQUIRE(nsmall > 0);
+    REQUIRE(nlarge > 0);
+    REQUIRE(f.classify_file(*cascade, "__zomg_reads.fq", nullptr, 1 << 14, 4) == expected);
+    REQUIRE(cascade->stage_reads(0) == nreads);
+    REQUIRE(cascade->stage_classified(0) == nsmall);
+    REQUIRE(cascade->stage_reads(1) == nreads - nsmall);
+    REQUIRE(cascade->stage_classified(1) == nlarge);
+
+    // Reads straddling the end of the small database's half are only partly covered by it.
+    std::unique_ptr<Classifier> strict(f.new_classifier(small));
+    strict->add_stage(large, nullptr, nullptr);
+    strict->cascade_confidence_ = 1.;
+    f.classify_file(*strict, "__zomg_reads.fq", nullptr, 1 << 14, 4);
+    REQUIRE(strict->stage_reads(1) > cascade->stage_reads(1));
+    std::remove("__zomg_reads.fq");
+}
+
+TEST_CASE("Split long reads go down the cascade as unsplit ones do") {
+    PhixTest f(4);
+    // The small database holds the first half of the genome, the large one all of it.
+    khash_t(c) *small(f.db_), *large(f.new_db());
+    const size_t half(f.genome_.size() / 2);
+    f.add_kmers([half](size_t i) {return i < half && i % 7 ? 2: 0;}, small);
+    f.add_kmers([](size_t i) {return i % 5 ? 3: 0;}, large);
+    // Long reads within either half or straddling both, and short ones between them.
+    const std::vector<std::string> reads(f.write_reads("__zomg_reads.fq", 1200, 97, [&](size_t i, size_t offset) {
+        return f.genome_.substr(offset, i % 3 ? 1200: 100);
+    }));
+    for(const double cascade_confidence: {0., 1.}) {
+        std::unique_ptr<Classifier> unsplit(f.new_classifier(small)), split(f.new_classifier(small));
+        for(Classifier *c: {unsplit.get(), split.get()})
+            c->add_stage(large, nullptr, nullptr), c->cascade_confidence_ = cascade_confidence;
+        split->segment_len_ = 300;
+        const std::string expected(f.classify_reads(*unsplit, reads));
+        REQUIRE(f.classify_file(*split, "__zomg_reads.fq", nullptr, 1 << 14, 4) == expected);
+        REQUIRE(split->stage_reads(1) > 0);
+        REQUIRE(split->stage_classified(1) > 0);
+        for(const unsigned stage: {0u, 1u}) {
+            REQUIRE(split->stage_reads(stage) == unsplit->stage_reads(stage));
+            REQUIRE(split->stage_classified(stage) == unsplit->stage_classified(stage));
+        }
+    }
+    std::remove("__zomg_reads.fq");
+}
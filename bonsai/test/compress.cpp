@@ -0,0 +1,42 @@
+#include "test/catch.hpp"
+#include "compress.h"
+#include "decompress.h"
+using namespace emp;
+
+TEST_CASE("Parallel compression round-trips through gzread and ParallelDecompressor") {
+    std::string data;
+    {
+        std::ifstream ifs("test/phix.fa");
+        const std::string genome((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        for(int i(0); i < 300; ++i) data += genome;
+    }
+    REQUIRE(data.size() > 2 * ParallelCompressor::BLOCK_SIZE);
+    auto slurp = [](gzFile fp) {
+        std::string ret;
+        char buf[4096];
+        int n;
+        while((n = gzread(fp, buf, sizeof(buf))) > 0) ret.append(buf, n);
+        return ret;
+    };
+    for(const int format: {COMPRESS_NONE, COMPRESS_GZIP}) {
+        for(const unsigned nthreads: {1u, 4u}) {
+            std::FILE *fp(std::fopen("__zomg_compressed", "wb"));
+            {
+                // Writes of all sizes, crossing block boundaries.
+                ParallelCompressor out(fileno(fp), format, nthreads);
+                for(size_t i(0), n(1); i < data.size(); i += n, n = n * 3 % 100003 + 1)
+                    out.write(&data[i], std::min(n, data.size() - i));
+                REQUIRE(out.close());
+            }
+            std::fclose(fp);
+            gzFile gzfp(gzopen("__zomg_compressed", "rb"));
+            REQUIRE(slurp(gzfp) == data);
+            gzclose(gzfp);
+            ParallelDecompressor in("__zomg_compressed", 4);
+            REQUIRE(slurp(in.fp()) == data);
+        }
+    }
+    REQUIRE(parse_compression("gzip") == COMPRESS_GZIP);
+    REQUIRE(parse_compression("none") == COMPRESS_NONE);
+    std::remove("__zomg_compressed");
+}
@@ -0,0 +1,135 @@
+#include "test/catch.hpp"
+#include "database.h"
+#include <memory>
+using namespace emp;
+
+// Taxa 2-18 under 1, for the values of the tables below.
+static std::unique_ptr<FlatTaxonomy> star_taxonomy() {
+    khash_t(p) *taxmap(kh_init(p));
+    int khr;
+    for(tax_t i(1); i < 19; ++i) kh_val(taxmap, kh_put(p, taxmap, i, &khr)) = i > 1;
+    std::unique_ptr<FlatTaxonomy> ret(new FlatTaxonomy(taxmap));
+    kh_destroy(p, taxmap);
+    return ret;
+}
+
+TEST_CASE("Mapped database matches legacy database") {
+    Database<khash_t(c)> db(31, 31, spvec_t(30, 0));
+    db.db_ = kh_init(c);
+    khint_t ki;
+    int khr;
+    for(size_t i(0); i < 1 << 12; ++i) {
+        ki = kh_put(c, db.db_, (i << 14) | (i + 2), &khr);
+        kh_val(db.db_, ki) = i + 1;
+    }
+    db.write("__zomg_legacy__");
+    db.write("__zomg_mapped__", true);
+    REQUIRE(!db_is_mapped("__zomg_legacy__"));
+    REQUIRE(db_is_mapped("__zomg_mapped__"));
+    {
+        Database<khash_t(c)> legacy("__zomg_legacy__"), mapped("__zomg_mapped__");
+        REQUIRE(!legacy.is_mapped());
+        REQUIRE(mapped.is_mapped());
+        REQUIRE(mapped.k_ == legacy.k_);
+        REQUIRE(mapped.w_ == legacy.w_);
+        REQUIRE(mapped.s_ == legacy.s_);
+        REQUIRE(kh_size(mapped.db_) == kh_size(legacy.db_));
+        REQUIRE(((u64)mapped.db_->keys & (DB_ALIGNMENT - 1)) == 0);
+        for(size_t i(0); i < 1 << 12; ++i) {
+            const u64 key((i << 14) | (i + 2));
+            REQUIRE((ki = kh_get(c, mapped.db_, key)) != kh_end(mapped.db_));
+            REQUIRE(kh_val(mapped.db_, ki) == i + 1);
+            REQUIRE(kh_val(legacy.db_, kh_get(c, legacy.db_, key)) == i + 1);
+        }
+        REQUIRE(kh_get(c, mapped.db_, 1) == kh_end(mapped.db_));
+    }
+    std::remove("__zomg_legacy__");
+    std::remove("__zomg_mapped__");
+}
+
+TEST_CASE("Compact table matches khash") {
+    Database<khash_t(c)> db(31, 31, spvec_t(30, 0));
+    db.db_ = kh_init(c);
+    khint_t ki;
+    int khr;
+    for(u64 i(0); i < 1 << 16; ++i) {
+        ki = kh_put(c, db.db_, wang_hash(i), &khr);
+        kh_val(db.db_, ki) = i % 17 + 1;
+    }
+    db.make_compact(*star_taxonomy());
+    REQUIRE(db.db_ == nullptr);
+    REQUIRE(db.ct_->size() == 1 << 16);
+    REQUIRE(db.ct_->bytes() < (1 << 16) * sizeof(u32) * 2);
+    for(u64 i(0); i < 1 << 16; ++i) REQUIRE(db.ct_->get(wang_hash(i)) == i % 17 + 1);
+    db.write("__zomg_compact__");
+    {
+        Database<khash_t(c)> mapped("__zomg_compact__");
+        REQUIRE(mapped.is_mapped());
+        REQUIRE(mapped.db_ == nullptr);
+        REQUIRE(mapped.ct_->size() == db.ct_->size());
+        size_t nfalse(0);
+        for(u64 i(0); i < 1 << 16; ++i) {
+            REQUIRE(mapped.ct_->get(wang_hash(i)) == i % 17 + 1);
+            nfalse += mapped.ct_->get(wang_hash(i + (1 << 16))) != 0;
+        }
+        REQUIRE(nfalse < 16);
+    }
+    std::remove("__zomg_compact__");
+}
+
+TEST_CASE("Bloom filter is stored with the database and keeps every key") {
+    Database<khash_t(c)> db(31, 31, spvec_t(30, 0));
+    db.db_ = kh_init(c);
+    khint_t ki;
+    int khr;
+    for(u64 i(0); i < 1 << 16; ++i) {
+        ki = kh_put(c, db.db_, i * 3, &khr);
+        kh_val(db.db_, ki) = i % 17 + 1;
+    }
+    db.make_bloom(10.);
+    db.make_compact(*star_taxonomy());
+    REQUIRE(db.bf_->bytes() <= (10 << 16) / 8 + 64);
+    db.write("__zomg_bloom__");
+    {
+        Database<khash_t(c)> mapped("__zomg_bloom__"), unfiltered("__zomg_bloom__", false);
+        REQUIRE(mapped.bf_ != nullptr);
+        REQUIRE(unfiltered.bf_ == nullptr);
+        REQUIRE(((u64)mapped.bf_->words_ & (DB_ALIGNMENT - 1)) == 0);
+        size_t nfalse(0);
+        for(u64 i(0); i < 1 << 16; ++i) {
+            REQUIRE(mapped.bf_->may_contain(i * 3));
+            nfalse += mapped.bf_->may_contain(i * 3 + 1);
+        }
+        // About 1% for a flat filter; blocking costs a little.
+        REQUIRE(nfalse < (1 << 16) / 40);
+    }
+    std::remove("__zomg_bloom__");
+}
+
+TEST_CASE("Placed databases match the mapped database") {
+    Database<khash_t(c)> db(31, 31, spvec_t(30, 0));
+    db.db_ = kh_init(c);
+    khint_t ki;
+    int khr;
+    for(u64 i(0); i < 1 << 16; ++i) {
+        ki = kh_put(c, db.db_, wang_hash(i), &khr);
+        kh_val(db.db_, ki) = i % 17 + 1;
+    }
+    db.make_bloom();
+    db.make_compact(*star_taxonomy());
+    db.write("__zomg_placed__");
+    for(const int numa: {NUMA_LOCAL, NUMA_INTERLEAVE, NUMA_REPLICATE}) {
+        placement_t placement;
+        placement.huge_ = HUGE_TRANSPARENT, placement.numa_ = numa;
+        Database<khash_t(c)> placed("__zomg_placed__", true, placement);
+        REQUIRE(placed.is_mapped());
+        REQUIRE(placed.replicas_.size() == (numa == NUMA_REPLICATE ? numa_nodes() - 1: 0));
+        std::vector<const CompactTable *> tables{placed.ct_};
+        for(const auto &replica: placed.replicas_) tables.push_back(replica.ct_);
+        for(const CompactTable *ct: tables) {
+            REQUIRE(ct->size() == db.ct_->size());
+            for(u64 i(0); i < 1 << 16; ++i) REQUIRE(ct->get(wang_hash(i)) == i % 17 + 1);
+        }
+    }
+    std::remove("__zomg_placed__");
+}
@@ -0,0 +1,135 @@
+#include "test/catch.hpp"
+#include "decompress.h"
+#include <sys/resource.h>
+using namespace emp;
+
+namespace {
+// Write data as BGZF members of at most bsize input bytes each.
+void write_bgzf(std::FILE *fp, const std::string &data, size_t bsize) {
+    std::vector<u8> buf(compressBound(bsize) + 64);
+    for(size_t i(0); i < data.size(); i += bsize) {
+        const size_t l(std::min(bsize, data.size() - i));
+        z_stream zs;
+        std::memset(&zs, 0, sizeof(zs));
+        REQUIRE(deflateInit2(&zs, 6, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK);
+        zs.next_in = (Bytef *)&data[i], zs.avail_in = l;
+        zs.next_out = &buf[18], zs.avail_out = buf.size() - 26;
+        REQUIRE(deflate(&zs, Z_FINISH) == Z_STREAM_END);
+        const size_t total(18 + zs.total_out + 8);
+        deflateEnd(&zs);
+        const u8 header[18] {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0,
+                             u8((total - 1) & 0xFF), u8((total - 1) >> 8)};
+        std::memcpy(buf.data(), header, sizeof(header));
+        const u32 crc(crc32(0, (const Bytef *)&data[i], l)), tail[2]{crc, u32(l)};
+        std::memcpy(&buf[total - 8], tail, sizeof(tail));
+        std::fwrite(buf.data(), 1, total, fp);
+    }
+}
+std::string slurp(const char *path) {
+    std::ifstream ifs(path);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+std::string slurp(gzFile fp) {
+    std::string ret;
+    char buf[4096];
+    int n;
+    while((n = gzread(fp, buf, sizeof(buf))) > 0) ret.append(buf, n);
+    return ret;
+}
+}
+
+TEST_CASE("Parallel decompression matches gzread") {
+    std::string data;
+    {
+        std::ifstream ifs("test/phix.fa");
+        const std::string genome((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+        for(int i(0); i < 40; ++i) data += genome;
+    }
+    std::FILE *fp(std::fopen("__zomg_bgzf.gz", "wb"));
+    write_bgzf(fp, data, 5000);
+    std::fclose(fp);
+    // A plain gzip member after BGZF members: the rest of the file is decoded in one thread.
+    gzFile gzfp(gzopen("__zomg_gz.gz", "wb"));
+    gzwrite(gzfp, data.data(), data.size());
+    gzclose(gzfp);
+    std::system("cat __zomg_bgzf.gz __zomg_gz.gz > __zomg_mixed.gz");
+    fp = std::fopen("__zomg_plain.fa", "wb");
+    std::fwrite(data.data(), 1, data.size(), fp);
+    std::fclose(fp);
+
+    const std::pair<const char *, std::string> expected[] {
+        {"__zomg_bgzf.gz", data}, {"__zomg_gz.gz", data}, {"__zomg_mixed.gz", data + data}, {"__zomg_plain.fa", data}
+    };
+    for(const auto &pair: expected) {
+        for(const unsigned nthreads: {0u, 1u, 4u}) {
+            ParallelDecompressor in(pair.first, nthreads);
+            REQUIRE(in);
+            REQUIRE(slurp(in.fp()) == pair.second);
+        }
+        {
+            ParallelDecompressor in(pair.first, 4);
+            kseq_t *ks(kseq_init(in.fp()));
+            size_t n(0);
+            while(kseq_read(ks) >= 0) {
+                REQUIRE(ks->seq.l > 5000);
+                ++n;
+            }
+            kseq_destroy(ks);
+            REQUIRE(n == (pair.second.size() > data.size() ? 80: 40));
+        }
+        {
+            // Stopping early must not leave the decoding threads blocked.
+            ParallelDecompressor in(pair.first, 4);
+            char buf[100];
+            REQUIRE(gzread(in.fp(), buf, sizeof(buf)) == sizeof(buf));
+        }
+        std::remove(pair.first);
+    }
+    REQUIRE(!ParallelDecompressor("__zomg_does_not_exist", 2));
+
+    // Corrupt input ends decoding early, and says why.
+    fp = std::fopen("__zomg_bgzf.gz", "wb");
+    write_bgzf(fp, data, 5000);
+    std::fclose(fp);
+    std::string bytes(slurp("__zomg_bgzf.gz"));
+    bytes[(u8(bytes[16]) | (u8(bytes[17]) << 8)) + 1 + 100] ^= 0x55; // Inside the second member's deflate stream
+    std::ofstream("__zomg_bgzf.gz").write(bytes.data(), bytes.size());
+    gzfp = gzopen("__zomg_gz.gz", "wb");
+    gzwrite(gzfp, data.data(), data.size());
+    gzclose(gzfp);
+    bytes = slurp("__zomg_gz.gz");
+    std::ofstream("__zomg_gz.gz").write(bytes.data(), bytes.size() / 2);
+    for(const char *path: {"__zomg_bgzf.gz", "__zomg_gz.gz"}) {
+        ParallelDecompressor in(path, 4);
+        REQUIRE(in);
+        REQUIRE(slurp(in.fp()).size() < data.size());
+        REQUIRE(in.error());
+        std::remove(path);
+    }
+    {
+        ParallelDecompressor in("test/phix.fa", 4);
+        slurp(in.fp());
+        REQUIRE(!in.error());
+    }
+}
+
+TEST_CASE("Running out of descriptors throws instead of exiting") {
+    rlimit old;
+    REQUIRE(::getrlimit(RLIMIT_NOFILE, &old) == 0);
+    const int lowest(::dup(0)); // The lowest free descriptor
+    REQUIRE(lowest >= 0);
+    ::close(lowest);
+    rlimit tight(old);
+    tight.rlim_cur = lowest + 1; // Room for one descriptor, and a pipe needs two.
+    REQUIRE(::setrlimit(RLIMIT_NOFILE, &tight) == 0);
+    bool threw(false);
+    try {
+        ParallelDecompressor in("test/phix.fa", 2);
+    } catch(const std::runtime_error &e) {
+        threw = std::strstr(e.what(), "pipe") != nullptr;
+    }
+    REQUIRE(::setrlimit(RLIMIT_NOFILE, &old) == 0);
+    REQUIRE(threw);
+    ParallelDecompressor in("test/phix.fa", 2);
+    REQUIRE(in);
+}
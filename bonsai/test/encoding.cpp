@@ -3,6 +3,7 @@
 #include "encoder.h"
 #include <algorithm>
 #include <numeric>
+#include <random>
 
 using namespace emp;
 using EncType = Encoder<score::Lex>;
@@ -162,3 +163,106 @@ TEST_CASE( "Spacer encodes and decodes contiguous, unminimized seeds correctly."
         }
     }
 }
+
+TEST_CASE("Rolling encoder matches from-scratch encoding") {
+    gzFile fp(gzopen("test/phix.fa", "rb"));
+    REQUIRE(fp);
+    kseq_t *ks(kseq_init(fp));
+    REQUIRE(kseq_read(ks) >= 0);
+    std::string seq(ks->seq.s, ks->seq.l);
+    kseq_destroy(ks);
+    gzclose(fp);
+    for(size_t i(97); i < seq.size(); i += 389) seq[i] = 'N';
+    seq += std::string(40, 'T');
+    // Contiguous, a few small gaps, a comb over 32 bases and one over 64.
+    std::vector<std::pair<unsigned, spvec_t>> spacings {
+        {31, spvec_t(30, 0)}, {32, spvec_t(31, 0)}, {13, spvec_t(12, 0)},
+        {21, spvec_t{1, 0, 2, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 3, 0, 0, 0, 0, 0, 1}},
+        {32, spvec_t(31, 1)}, {16, spvec_t(15, 4)}
+    };
+    for(const auto &pair: spacings) {
+        Spacer sp(pair.first, pair.first, pair.second);
+        EncType enc(sp, true), ref(sp, true);
+        enc.assign(seq.data(), seq.size());
+        ref.assign(seq.data(), seq.size());
+        for(unsigned start(0); enc.has_next_kmer(); ++start) {
+            const u64 expected(ref.kmer(start));
+            if(start & 1) REQUIRE(enc.next_canonical_kmer() == (expected == BF ? BF: canonical_representation(expected, sp.k_)));
+            else          REQUIRE(enc.next_kmer() == expected);
+        }
+        if(sp.unspaced() && sp.k_ < 32) {
+            std::vector<u64> rolled, scratch;
+            EncType cenc(sp, true);
+            cenc.for_each_seq([&](u64 kmer) {rolled.push_back(kmer);}, seq.data(), seq.size());
+            for(unsigned start(0); start + sp.c_ <= seq.size(); ++start)
+                if(ref.kmer(start) != BF) scratch.push_back(canonical_representation(ref.kmer(start), sp.k_));
+            REQUIRE(rolled == scratch);
+        }
+        // Minimizers against a window fed k-mers encoded from scratch.
+        for(const unsigned wextra: {0u, 10u}) {
+            for(const bool canon: {true, false}) {
+                Spacer wsp(pair.first, sp.c_ + wextra, pair.second);
+                if(wsp.unwindowed()) continue;
+                if(!canon && wsp.unspaced()) continue; // Has its own loop, which skips ambiguous k-mers.
+                std::vector<u64> rolled, scratch;
+                EncType wenc(wsp, canon);
+                qmap_t q(wsp.w_ - wsp.c_ + 1);
+                wenc.for_each_seq([&](u64 min) {rolled.push_back(min);}, seq.data(), seq.size());
+                for(unsigned start(0); start + wsp.c_ <= seq.size(); ++start) {
+                    u64 kmer(ref.kmer(start)), min;
+                    if(canon) kmer = canonical_representation(kmer, wsp.k_);
+                    if((min = q.next_value(kmer, lex_score(kmer, nullptr))) != BF) scratch.push_back(min);
+                }
+                REQUIRE(rolled.size() > 0);
+                REQUIRE(rolled == scratch);
+            }
+        }
+    }
+}
+
+TEST_CASE("Packed sequences match the lookup table") {
+    std::mt19937_64 gen(13);
+    const std::string alphabet("ACGTacgtNnRY-\x80");
+    for(const size_t len: {0u, 1u, 31u, 32u, 33u, 63u, 64u, 65u, 100u, 1000u}) {
+        std::string seq;
+        for(size_t i(0); i < len; ++i) seq += alphabet[gen() % (gen() & 1 ? 8: alphabet.size())];
+        for(const pack_fn fn: {pack::scalar, pack::ssse3, pack::avx2}) {
+            if(fn == pack::avx2 && !__builtin_cpu_supports("avx2")) continue;
+            std::vector<u64> bases((len + 31) / 32 + 1), ambig((len + 63) / 64 + 1);
+            fn(seq.data(), seq.size(), bases.data(), ambig.data());
+            for(size_t i(0); i < len; ++i) {
+                const u8 c(seq[i]);
+                const bool is_ambig(c >= 128 || cstr_lut[c] < 0);
+                REQUIRE(((ambig[i >> 6] >> (i & 63)) & 1) == is_ambig);
+                REQUIRE(((bases[i >> 5] >> (62 - ((i & 31) << 1))) & 3) == (is_ambig ? 0: u64(cstr_lut[c])));
+            }
+        }
+        PackedSeq ps;
+        ps.assign(seq.data(), seq.size());
+        for(size_t i(0); i < len; ++i) {
+            size_t j(i);
+            while(j < len && !ps.ambiguous(j)) ++j;
+            REQUIRE(ps.next_ambiguous(i) == j);
+            for(j = i; j < len && ps.ambiguous(j); ++j);
+            REQUIRE(ps.next_unambiguous(i) == j);
+        }
+    }
+}
+
+TEST_CASE("for_each_kmer skips runs of ambiguous k-mers") {
+    std::string seq("ACGTTGCANNNNNACGGGTACCATTAGGACCATTTACAGATTACAAAGGGCCCTTTNACGTAGCTAGCATCGACTNNN");
+    for(const auto &spaces: {spvec_t(12, 0), spvec_t{0, 0, 1, 0, 2, 0, 0, 0, 0, 0, 1, 0}}) {
+        Spacer sp(13, 13, spaces);
+        for(const bool canon: {false, true}) {
+            EncType enc(sp, canon), ref(sp, canon);
+            std::vector<u64> expected, found;
+            ref.assign(seq.data(), seq.size());
+            while(ref.has_next_kmer()) expected.push_back(canon ? ref.next_canonical_kmer(): ref.next_kmer());
+            enc.assign(seq.data(), seq.size());
+            if(canon) enc.for_each_kmer<true>([&](u64 kmer) {found.push_back(kmer);}, [&](u64 n) {found.insert(found.end(), n, BF);});
+            else      enc.for_each_kmer<false>([&](u64 kmer) {found.push_back(kmer);}, [&](u64 n) {found.insert(found.end(), n, BF);});
+            REQUIRE(std::count(expected.begin(), expected.end(), BF) > 0);
+            REQUIRE(found == expected);
+        }
+    }
+}
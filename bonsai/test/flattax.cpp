@@ -0,0 +1,72 @@
+#include "test/catch.hpp"
+#include "flattax.h"
+#include <random>
+using namespace emp;
+
+TEST_CASE("Flat taxonomy matches parent map") {
+    std::mt19937_64 rng(1337);
+    // Sparse taxids, with both bushy and deep (chain-like) parts.
+    std::vector<tax_t> ids{1};
+    khash_t(p) *taxmap(kh_init(p));
+    khint_t ki;
+    int khr;
+    ki = kh_put(p, taxmap, 1, &khr), kh_val(taxmap, ki) = 0;
+    while(ids.size() < 5000) {
+        const tax_t id(2 + rng() % 200000);
+        if(kh_get(p, taxmap, id) != kh_end(taxmap)) continue;
+        const size_t pi(rng() & 1 ? rng() % ids.size(): ids.size() - 1 - rng() % std::min(ids.size(), size_t(4)));
+        ki = kh_put(p, taxmap, id, &khr), kh_val(taxmap, ki) = ids[pi];
+        ids.push_back(id);
+    }
+    const FlatTaxonomy built(taxmap);
+    REQUIRE(built.size() == ids.size());
+    built.write("__zomg_tax.flat");
+    const FlatTaxonomy mapped("__zomg_tax.flat");
+    REQUIRE(mapped.is_mapped());
+    for(const FlatTaxonomy *tax: {&built, &mapped}) {
+        REQUIRE(!tax->has(0));
+        REQUIRE(!tax->has(200002));
+        for(const auto id: ids) {
+            REQUIRE(tax->has(id));
+            REQUIRE(tax->depth(id) == node_depth(taxmap, id));
+            REQUIRE(tax->parent(id) == get_parent(taxmap, id));
+        }
+        for(size_t i(0); i < 20000; ++i) {
+            const tax_t a(ids[rng() % ids.size()]), b(ids[rng() % ids.size()]);
+            REQUIRE(tax->lca(a, b) == lca(taxmap, a, b));
+        }
+        REQUIRE(tax->lca(ids[7], 0) == ids[7]);
+        REQUIRE(tax->lca(0, ids[7]) == ids[7]);
+        REQUIRE(tax->lca(ids[7], 300000) == tax_t(-1));
+        for(size_t i(0); i < 2000; ++i) {
+            linear::counter<tax_t, u16> lhits;
+            tax_counter hits;
+            // Hits mostly along a few lineages, so that ties and nested hits are common.
+            const tax_t leaf(ids[rng() % ids.size()]);
+            for(size_t j(0), n(1 + rng() % 12); j < n; ++j) {
+                tax_t id(rng() & 1 ? leaf: ids[rng() % ids.size()]);
+                for(size_t up(rng() % 4); up-- && id != 1; id = get_parent(taxmap, id));
+                lhits.add(id), hits.add(id);
+            }
+            REQUIRE(hits.size() == lhits.size());
+            const tax_t called(resolve_tree(lhits, taxmap));
+            REQUIRE(tax->resolve_tree(hits) == called);
+            REQUIRE(tax->resolve(hits).taxon_ == called);
+            // Walk up by hand, counting clades through the parent map.
+            const double confidence(0.1 * (rng() % 11));
+            const u64 nmissing(rng() % 8);
+            u64 total(nmissing);
+            for(unsigned k(0); k < hits.size(); total += hits.values()[k++]);
+            tax_t expected(called);
+            for(; expected; expected = get_parent(taxmap, expected)) {
+                u64 clade(0);
+                for(unsigned k(0); k < hits.size(); ++k)
+                    if(lca(taxmap, expected, hits.keys()[k]) == expected) clade += hits.values()[k];
+                if(clade >= confidence * total) break;
+            }
+            if(called) REQUIRE(tax->confident_ancestor(hits, called, confidence, nmissing) == expected);
+        }
+    }
+    std::remove("__zomg_tax.flat");
+    kh_destroy(p, taxmap);
+}
@@ -0,0 +1,130 @@
+#ifndef _TEST_PHIX_H__
+#define _TEST_PHIX_H__
+#include "test/catch.hpp"
+#include "classifier.h"
+
+namespace emp {
+
+inline std::string slurp(const char *path) {
+    std::ifstream ifs(path);
+    return std::string(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+}
+
+inline void write_fastq(std::FILE *fp, const std::string &name, const std::string &seq, char qual='I') {
+    std::fprintf(fp, "@%s\n%s\n+\n%s\n", name.data(), seq.data(), std::string(seq.size(), qual).data());
+}
+
+// The setup the classification tests share: phiX, a small taxonomy, and a Classifier over a database
+// which each test fills with phiX's k-mers as it needs to.
+struct PhixTest {
+    using edge_t = std::pair<tax_t, tax_t>; // Taxon, parent
+    spvec_t                   sv_;
+    std::string               genome_;
+    khash_t(p)               *taxmap_;
+    const FlatTaxonomy        tax_;
+    std::vector<khash_t(c) *> dbs_; // Every database made, destroyed with the test
+    khash_t(c)               *db_;
+    const unsigned            nthreads_, wsz_;
+    Classifier                c_;
+    Encoder<score::Lex>       enc_;
+    std::vector<tax_t>        taxa_;
+    std::vector<u64>          kmers_;
+
+    // Taxa default to 1 -> {2, 3}.
+    PhixTest(unsigned nthreads, unsigned wsz=31, const std::vector<edge_t> &edges={{1, 0}, {2, 1}, {3, 1}}):
+        sv_(30, 0), genome_(load_genome()), taxmap_(make_taxmap(edges)), tax_(taxmap_), dbs_(), db_(new_db()),
+        nthreads_(nthreads), wsz_(wsz), c_(db_, sv_, 31, wsz, nthreads, true, false, true, true), enc_(c_.enc_) {}
+    ~PhixTest() {
+        for(khash_t(c) *db: dbs_) kh_destroy(c, db);
+        kh_destroy(p, taxmap_);
+    }
+    static std::string load_genome() {
+        gzFile fp(gzopen("test/phix.fa", "rb"));
+        REQUIRE(fp);
+        kseq_t *ks(kseq_init(fp));
+        REQUIRE(kseq_read(ks) >= 0);
+        std::string ret(ks->seq.s, ks->seq.l);
+        kseq_destroy(ks);
+        gzclose(fp);
+        return ret;
+    }
+    static khash_t(p) *make_taxmap(const std::vector<edge_t> &edges) {
+        khash_t(p) *ret(kh_init(p));
+        int khr;
+        for(const edge_t &edge: edges) kh_val(ret, kh_put(p, ret, edge.first, &khr)) = edge.second;
+        return ret;
+    }
+    khash_t(c) *new_db() {
+        dbs_.push_back(kh_init(c));
+        return dbs_.back();
+    }
+    // Another classifier set up as c_, over db.
+    std::unique_ptr<Classifier> new_classifier(khash_t(c) *db) {
+        return std::unique_ptr<Classifier>(new Classifier(db, sv_, 31, wsz_, nthreads_, true, false, true, true));
+    }
+    // Puts phiX's i-th k-mer into db as taxon value(i), or leaves it out if that is 0.
+    template<typename Functor>
+    void add_kmers(const Functor &value, khash_t(c) *db=nullptr) {
+        if(db == nullptr) db = db_;
+        int khr;
+        enc_.assign(&genome_[0], genome_.size());
+        for(size_t i(0); enc_.has_next_kmer(); ++i) {
+            const u64 kmer(enc_.next_kmer());
+            if(const tax_t taxon = value(i)) kh_val(db, kh_put(c, db, kmer, &khr)) = taxon;
+        }
+    }
+    // classify_seq's output for one read. Its k-mers' taxa are left in taxa, or taxa_ if not set.
+    std::string classify(Classifier &c, std::string seq, const std::string &name="read", std::vector<tax_t> *taxa=nullptr) {
+        std::string qual(seq.size(), 'I');
+        bseq1_t bs{int(seq.size()), 0, 0, const_cast<char *>(name.data()), nullptr, &seq[0], &qual[0], nullptr};
+        classify_seq(c, enc_, tax_, &bs, 0, taxa ? *taxa: taxa_, kmers_);
+        std::string ret(bs.sam, bs.l_sam);
+        std::free(bs.sam);
+        return ret;
+    }
+    std::string classify(std::string seq, const std::string &name="read", std::vector<tax_t> *taxa=nullptr) {
+        return classify(c_, std::move(seq), name, taxa);
+    }
+    // process_dataset's output for fq1 (and fq2, if set).
+    std::string classify_file(Classifier &c, const char *fq1, const char *fq2, u64 chunk_size, unsigned groups_per_thread,
+                              bool pipeline=true) {
+        std::FILE *out(std::fopen("__zomg_out.txt", "w"));
+        process_dataset(c, tax_, fq1, fq2, out, chunk_size, groups_per_thread, pipeline);
+        std::fclose(out);
+        std::string ret(slurp("__zomg_out.txt"));
+        std::remove("__zomg_out.txt");
+        return ret;
+    }
+    std::string classify_file(const char *fq1, u64 chunk_size, unsigned groups_per_thread, bool pipeline=true) {
+        return classify_file(c_, fq1, nullptr, chunk_size, groups_per_thread, pipeline);
+    }
+    static std::string read_name(size_t i) {return "read" + std::to_string(i);}
+    // Writes reads along phiX to path as FASTQ, named read_name(i): one every step bases for as long as len bases fit.
+    // Read i is read(i, offset), which is the len bases there for the overload without it. Returns the reads.
+    template<typename Functor>
+    std::vector<std::string> write_reads(const char *path, size_t len, size_t step, const Functor &read, char qual='I') {
+        std::vector<std::string> ret;
+        std::FILE *fp(std::fopen(path, "w"));
+        REQUIRE(fp);
+        for(size_t offset(0); offset + len < genome_.size(); offset += step) {
+            ret.push_back(read(ret.size(), offset));
+            write_fastq(fp, read_name(ret.size() - 1), ret.back(), qual);
+        }
+        std::fclose(fp);
+        return ret;
+    }
+    std::vector<std::string> write_reads(const char *path, size_t len, size_t step) {
+        return write_reads(path, len, step, [this, len](size_t, size_t offset) {return genome_.substr(offset, len);});
+    }
+    // classify's output for reads, one at a time, as written by write_reads.
+    std::string classify_reads(Classifier &c, const std::vector<std::string> &reads) {
+        std::string ret;
+        for(size_t i(0); i < reads.size(); ++i) ret += classify(c, reads[i], read_name(i));
+        return ret;
+    }
+    std::string classify_reads(const std::vector<std::string> &reads) {return classify_reads(c_, reads);}
+};
+
+} // namespace emp
+
+#endif // #ifndef _TEST_PHIX_H__
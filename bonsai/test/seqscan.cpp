@@ -0,0 +1,111 @@
+#include "test/catch.hpp"
+#include "seqscan.h"
+using namespace emp;
+
+namespace {
+struct record_t {
+    std::string name_, comment_, seq_, qual_;
+    bool operator==(const record_t &o) const {return name_ == o.name_ && comment_ == o.comment_ && seq_ == o.seq_ && qual_ == o.qual_;}
+};
+std::vector<record_t> kseq_records(const char *path) {
+    std::vector<record_t> ret;
+    gzFile fp(gzopen(path, "rb"));
+    REQUIRE(fp);
+    kseq_t *ks(kseq_init(fp));
+    while(kseq_read(ks) >= 0)
+        ret.push_back(record_t{std::string(ks->name.s, ks->name.l), std::string(ks->comment.s, ks->comment.l),
+                               std::string(ks->seq.s, ks->seq.l), std::string(ks->qual.s, ks->qual.l)});
+    kseq_destroy(ks);
+    gzclose(fp);
+    return ret;
+}
+std::vector<record_t> scanned_records(const char *path, size_t bufsize) {
+    std::vector<record_t> ret;
+    gzFile fp(gzopen(path, "rb"));
+    REQUIRE(fp);
+    SeqScanner ss(fp, bufsize);
+    seq_record_t rec;
+    while(ss.next(rec)) {
+        REQUIRE(rec.seq_[rec.l_seq_] == '\0');
+        ret.push_back(record_t{std::string(rec.name_, rec.l_name_), std::string(rec.comment_ ? rec.comment_: "", rec.l_comment_),
+                               std::string(rec.seq_, rec.l_seq_), std::string(rec.qual_ ? rec.qual_: "", rec.l_qual_)});
+    }
+    gzclose(fp);
+    return ret;
+}
+}
+
+TEST_CASE("SeqScanner matches kseq") {
+    std::FILE *ofp(std::fopen("__zomg_scan.fq", "w"));
+    for(size_t i(0); i < 2000; ++i) {
+        const std::string seq(1 + i * 37 % 300, "ACGTN"[i % 5]), qual(seq.size(), '#');
+        const char *eol("\n");
+        std::fprintf(ofp, "@read%zu%s%s", i, i % 3 ? "": " some comment", eol);
+        // Wrapped records, and qualities starting with '@'.
+        if(i % 5 == 0) std::fprintf(ofp, "%s%s%s%s+%s@%s%s%s", seq.substr(0, 50).data(), eol, seq.substr(std::min(seq.size(), size_t(50))).data(), eol, eol,
+                                    qual.substr(1, 49).data(), eol, qual.substr(std::min(seq.size(), size_t(50))).data());
+        else            std::fprintf(ofp, "%s%s+%s%s", seq.data(), eol, eol, qual.data());
+        std::fputs(eol, ofp);
+    }
+    std::fclose(ofp);
+    for(const char *path: {"test/phix.fa", "test/small_genome.fa", "test/GCF_000302455.1_ASM30245v1_genomic.fna.gz", "__zomg_scan.fq"}) {
+        INFO("Path: " << path);
+        const auto expected(kseq_records(path));
+        REQUIRE(expected.size());
+        for(const size_t bufsize: {size_t(100), size_t(1) << 16, SeqScanner::DEFAULT_BUFFER_SIZE})
+            REQUIRE(scanned_records(path, bufsize) == expected);
+    }
+    std::remove("__zomg_scan.fq");
+}
+
+TEST_CASE("Record search kernels agree") {
+    if(std::strcmp(scan::best_name(), "avx2")) return; // Nothing to compare against.
+    std::string s;
+    for(size_t i(0); i < 5000; ++i) s += "ACGT\n>@+"[(i * 7919) % 9 % 8];
+    for(size_t start(0); start < 200; start += 3) {
+        REQUIRE(scan::newline_avx2(&s[start], &s[s.size()]) == scan::newline_scalar(&s[start], &s[s.size()]));
+        for(const char c: {'>', '@', '+'})
+            for(size_t end(start); end < s.size(); end += 97)
+                REQUIRE(scan::record_avx2(&s[start], &s[end], c) == scan::record_scalar(&s[start], &s[end], c));
+    }
+}
+
+TEST_CASE("Read errors are not taken for the end of the input") {
+    gzFile gzfp(gzopen("__zomg_scan.fq.gz", "wb"));
+    REQUIRE(gzfp);
+    for(size_t i(0); i < 20000; ++i) {
+        const std::string seq(100 + i % 50, "ACGT"[i & 3]);
+        gzprintf(gzfp, "@read%zu\n%s\n+\n%s\n", i, seq.data(), std::string(seq.size(), 'I').data());
+    }
+    gzclose(gzfp);
+    std::string gz;
+    {
+        std::ifstream ifs("__zomg_scan.fq.gz");
+        gz.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    }
+    std::ofstream("__zomg_scan_truncated.fq.gz").write(gz.data(), gz.size() / 2);
+    for(const char *path: {"__zomg_scan.fq.gz", "__zomg_scan_truncated.fq.gz"}) {
+        INFO("Path: " << path);
+        const bool truncated(std::strstr(path, "truncated"));
+        {
+            gzFile fp(gzopen(path, "rb"));
+            SeqScanner ss(fp, 1 << 16);
+            seq_record_t rec;
+            size_t n(0);
+            while(ss.next(rec)) ++n;
+            REQUIRE(bool(ss.error()) == truncated);
+            REQUIRE((n == 20000) != truncated);
+            gzclose(fp);
+        }
+        gzFile fp(gzopen(path, "rb"));
+        SeqScanner ss(fp, 1 << 16);
+        bseq_batch_t batch{nullptr, 0, 0, nullptr, 0, 0};
+        int n, total(0);
+        while((n = bseq_batch_read(1 << 16, &batch, ss)) > 0) total += n;
+        REQUIRE(n == (truncated ? -1: 0));
+        if(!truncated) REQUIRE(total == 20000);
+        bseq_batch_destroy(&batch);
+        gzclose(fp);
+    }
+    for(const char *path: {"__zomg_scan.fq.gz", "__zomg_scan_truncated.fq.gz"}) std::remove(path);
+}
@@ -0,0 +1,145 @@
+#include "test/phix.h"
+#include "serve.h"
+#include <sys/resource.h>
+#include <sys/un.h>
+using namespace emp;
+
+TEST_CASE("Server answers as classify would") {
+    PhixTest f(2);
+    f.add_kmers([](size_t i) {return i % 5 ? 2 + (i / 1000 & 1): 0;});
+    f.write_reads("__zomg_reads.fq", 150, 13);
+    const std::string expected(f.classify_file("__zomg_reads.fq", 1 << 12, 4));
+    REQUIRE(expected.size());
+
+    std::vector<std::unique_ptr<Classifier>> cs;
+    for(unsigned i(0); i < 2; ++i) cs.push_back(f.new_classifier(f.db_));
+    Server<score::Lex> server(std::move(cs), f.tax_, "__zomg.sock", 4, 1 << 12, 4);
+    std::thread thread([&server]() {server.run();});
+    char *path(::realpath("__zomg_reads.fq", nullptr));
+    for(const bool stream: {false, true}) {
+        std::FILE *out(std::fopen("__zomg_out.txt", "w"));
+        REQUIRE(submit_request("__zomg.sock", stream ? "STREAM": std::string("CLASSIFY ") + path, stream ? path: nullptr, out));
+        std::fclose(out);
+        REQUIRE(slurp("__zomg_out.txt") == expected);
+    }
+    {
+        // As many clients at once as the queue holds, shared by both workers.
+        std::vector<std::thread> clients;
+        bool ok[4];
+        for(unsigned i(0); i < 4; ++i)
+            clients.emplace_back([&, i]() {
+                std::FILE *out(std::fopen(("__zomg_out" + std::to_string(i) + ".txt").data(), "w"));
+                ok[i] = submit_request("__zomg.sock", i & 1 ? "STREAM": std::string("CLASSIFY ") + path, i & 1 ? path: nullptr, out);
+                std::fclose(out);
+            });
+        for(auto &client: clients) client.join();
+        for(unsigned i(0); i < 4; ++i) {
+            const std::string out_path("__zomg_out" + std::to_string(i) + ".txt");
+            REQUIRE(ok[i]);
+            REQUIRE(slurp(out_path.data()) == expected);
+            std::remove(out_path.data());
+        }
+    }
+    std::FILE *out(std::fopen("__zomg_out.txt", "w"));
+    REQUIRE(!submit_request("__zomg.sock", "CLASSIFY /nonexistent.fq", nullptr, out));
+    REQUIRE(!submit_request("__zomg.sock", "FROBNICATE", nullptr, out));
+    std::fclose(out);
+    REQUIRE(slurp("__zomg_out.txt").empty());
+    REQUIRE(submit_request("__zomg.sock", "QUIT", nullptr, stdout));
+    thread.join();
+    std::free(path);
+    std::remove("__zomg_reads.fq");
+    std::remove("__zomg_out.txt");
+}
+
+TEST_CASE("Failed requests are answered with errors and the server goes on") {
+    PhixTest f(2);
+    f.add_kmers([](size_t i) {return i % 5 ? 2 + (i / 1000 & 1): 0;});
+    f.write_reads("__zomg_reads.fq", 150, 13);
+    const std::string expected(f.classify_file("__zomg_reads.fq", 1 << 12, 4));
+    {
+        // A gzipped copy, cut off halfway.
+        const std::string reads(slurp("__zomg_reads.fq"));
+        gzFile gzfp(gzopen("__zomg_reads.fq.gz", "wb"));
+        gzwrite(gzfp, reads.data(), reads.size());
+        gzclose(gzfp);
+        const std::string gz(slurp("__zomg_reads.fq.gz"));
+        std::ofstream("__zomg_truncated.fq.gz").write(gz.data(), gz.size() / 2);
+    }
+
+    // One worker, so that each request follows the failed ones on the same classifier.
+    std::vector<std::unique_ptr<Classifier>> cs;
+    cs.push_back(f.new_classifier(f.db_));
+    Server<score::Lex> server(std::move(cs), f.tax_, "__zomg.sock", 4, 1 << 12, 4);
+    std::thread thread([&server]() {server.run();});
+    char *path(::realpath("__zomg_reads.fq", nullptr)), *truncated(::realpath("__zomg_truncated.fq.gz", nullptr)),
+         *cwd(::getcwd(nullptr, 0));
+    std::FILE *out(std::fopen("__zomg_out.txt", "w"));
+    REQUIRE(!submit_request("__zomg.sock", std::string("CLASSIFY ") + truncated, nullptr, out));
+    REQUIRE(!submit_request("__zomg.sock", std::string("CLASSIFY -o /nonexistent/__zomg_served.txt ") + path, nullptr, out));
+    std::fclose(out);
+    REQUIRE(slurp("__zomg_out.txt").size() < expected.size());
+    out = std::fopen("__zomg_out.txt", "w");
+    REQUIRE(submit_request("__zomg.sock", std::string("CLASSIFY ") + path, nullptr, out));
+    std::fclose(out);
+    REQUIRE(slurp("__zomg_out.txt") == expected);
+    // Written by the server itself, with nothing sent back.
+    out = std::fopen("__zomg_out.txt", "w");
+    REQUIRE(submit_request("__zomg.sock", "CLASSIFY -o " + std::string(cwd) + "/__zomg_served.txt " + path, nullptr, out));
+    std::fclose(out);
+    REQUIRE(slurp("__zomg_out.txt").empty());
+    REQUIRE(slurp("__zomg_served.txt") == expected);
+    REQUIRE(submit_request("__zomg.sock", "QUIT", nullptr, stdout));
+    thread.join();
+    std::free(path), std::free(truncated), std::free(cwd);
+    for(const char *p: {"__zomg_reads.fq", "__zomg_reads.fq.gz", "__zomg_truncated.fq.gz", "__zomg_out.txt", "__zomg_served.txt"})
+        std::remove(p);
+}
+
+TEST_CASE("A request which runs out of descriptors fails alone") {
+    PhixTest f(2);
+    f.add_kmers([](size_t i) {return i % 5 ? 2 + (i / 1000 & 1): 0;});
+    f.write_reads("__zomg_reads.fq", 150, 13);
+    const std::string expected(f.classify_file("__zomg_reads.fq", 1 << 12, 4));
+    std::vector<sample_t> samples;
+    samples.emplace_back("reads", "__zomg_reads.fq", "", "__zomg_out.txt");
+    {
+        // Room for the output file, but not the decoder's pipe.
+        rlimit old;
+        REQUIRE(::getrlimit(RLIMIT_NOFILE, &old) == 0);
+        const int lowest(::dup(0));
+        REQUIRE(lowest >= 0);
+        ::close(lowest);
+        rlimit tight(old);
+        tight.rlim_cur = lowest + 2;
+        REQUIRE(::setrlimit(RLIMIT_NOFILE, &tight) == 0);
+        process_samples(f.c_, f.tax_, samples, 1 << 12, 4, false, 1);
+        REQUIRE(::setrlimit(RLIMIT_NOFILE, &old) == 0);
+    }
+    REQUIRE(samples[0].error_.find("pipe") != std::string::npos);
+    samples[0].error_.clear();
+    process_samples(f.c_, f.tax_, samples, 1 << 12, 4, true, 1);
+    REQUIRE(samples[0].error_.empty());
+    REQUIRE(slurp("__zomg_out.txt") == expected);
+    for(const char *p: {"__zomg_reads.fq", "__zomg_out.txt"}) std::remove(p);
+}
+
+TEST_CASE("A socket left behind by a dead server is replaced") {
+    std::remove("__zomg_stale.sock");
+    {
+        // Bound and never listened on, as a crashed server leaves it.
+        const int fd(::socket(AF_UNIX, SOCK_STREAM, 0));
+        sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, "__zomg_stale.sock");
+        REQUIRE(::bind(fd, (const sockaddr *)&addr, sizeof(addr)) == 0);
+        ::close(fd);
+    }
+    const int fd(unix_listen("__zomg_stale.sock"));
+    REQUIRE(fd >= 0);
+    const int client(unix_connect("__zomg_stale.sock"));
+    REQUIRE(client >= 0);
+    ::close(client), ::close(fd);
+    std::remove("__zomg_stale.sock");
+}